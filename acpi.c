@@ -0,0 +1,120 @@
+#include "acpi.h"
+#include <stdint.h>
+#include "string.h"
+
+#define EBDA_POINTER 0x40E
+#define BIOS_AREA_START 0xE0000
+#define BIOS_AREA_END 0x100000
+
+#define MADT_LAPIC 0
+#define MADT_IOAPIC 1
+#define MADT_OVERRIDE 2
+#define MADT_LAPIC_ADDRESS 5
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_header_t;
+
+static acpi_madt_t madt;
+static int madt_found = 0;
+
+static int checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) sum += bytes[i];
+    return sum == 0;
+}
+
+static acpi_rsdp_t* scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)addr;
+        if (strncmp(rsdp->signature, "RSD PTR ", 8) == 0 && checksum_ok(rsdp, 20)) return rsdp;
+    }
+    return 0;
+}
+
+static void parse_madt(acpi_madt_header_t* table) {
+    madt.lapic_address = table->lapic_address;
+    uint8_t* entry = (uint8_t*)(table + 1);
+    uint8_t* end = (uint8_t*)table + table->header.length;
+
+    while (entry + 2 <= end && entry[1] >= 2) {
+        switch (entry[0]) {
+        case MADT_LAPIC:
+            // Enabled processors only; offline-capable ones would need hotplug
+            if ((*(uint32_t*)(entry + 4) & 1) && madt.cpu_count < ACPI_MAX_CPUS) {
+                madt.cpu_apic_ids[madt.cpu_count++] = entry[3];
+            }
+            break;
+        case MADT_IOAPIC:
+            if (!madt.ioapic_address) {
+                madt.ioapic_address = *(uint32_t*)(entry + 4);
+                madt.ioapic_gsi_base = *(uint32_t*)(entry + 8);
+            }
+            break;
+        case MADT_OVERRIDE:
+            if (entry[3] < 16) {
+                madt.irq_gsi[entry[3]] = *(uint32_t*)(entry + 4);
+                madt.irq_flags[entry[3]] = *(uint16_t*)(entry + 8);
+            }
+            break;
+        case MADT_LAPIC_ADDRESS:
+            if (*(uint32_t*)(entry + 8) == 0) madt.lapic_address = *(uint32_t*)(entry + 4);
+            break;
+        }
+        entry += entry[1];
+    }
+}
+
+int acpi_init() {
+    for (int i = 0; i < 16; i++) {
+        madt.irq_gsi[i] = i;        // Identity unless an override says otherwise
+        madt.irq_flags[i] = 0;
+    }
+
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t*)EBDA_POINTER) << 4;
+    acpi_rsdp_t* rsdp = ebda ? scan_rsdp(ebda, ebda + 1024) : 0;
+    if (!rsdp) rsdp = scan_rsdp(BIOS_AREA_START, BIOS_AREA_END);
+    if (!rsdp) return 0;
+
+    acpi_header_t* rsdt = (acpi_header_t*)rsdp->rsdt_address;
+    if (strncmp(rsdt->signature, "RSDT", 4) != 0 || !checksum_ok(rsdt, rsdt->length)) return 0;
+
+    uint32_t* entries = (uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    for (uint32_t i = 0; i < count; i++) {
+        acpi_header_t* table = (acpi_header_t*)entries[i];
+        if (strncmp(table->signature, "APIC", 4) == 0 && checksum_ok(table, table->length)) {
+            parse_madt((acpi_madt_header_t*)table);
+            madt_found = 1;
+            break;
+        }
+    }
+    return madt_found;
+}
+
+const acpi_madt_t* acpi_madt() {
+    return madt_found ? &madt : 0;
+}
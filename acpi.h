@@ -0,0 +1,23 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+#define ACPI_MAX_CPUS 16
+
+// What the MADT says about the interrupt hardware; filled by acpi_init
+typedef struct {
+    int cpu_count;
+    uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+    uint32_t lapic_address;
+    uint32_t ioapic_address;        // 0 if there is none
+    uint32_t ioapic_gsi_base;
+    uint32_t irq_gsi[16];           // ISA IRQ to global system interrupt
+    uint16_t irq_flags[16];         // MPS polarity/trigger flags from overrides
+} acpi_madt_t;
+
+// Must run before paging: the RSDP pointer lives in page 0
+int acpi_init();
+const acpi_madt_t* acpi_madt();
+
+#endif
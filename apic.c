@@ -0,0 +1,179 @@
+#include "apic.h"
+#include <stdint.h>
+#include "io.h"
+#include "acpi.h"
+#include "paging.h"
+#include "pmm.h"
+#include "timer.h"
+#include "interrupts.h"
+#include "spinlock.h"
+
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_ENABLE 0x100
+#define LAPIC_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV16 0x3
+
+#define ICR_INIT 0x500
+#define ICR_STARTUP 0x600
+#define ICR_ASSERT 0x4000
+#define ICR_PENDING 0x1000
+
+#define IOAPIC_SELECT 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_REDIRECT 0x10
+#define IOAPIC_ACTIVE_LOW 0x2000
+#define IOAPIC_LEVEL 0x8000
+#define IOAPIC_MASKED 0x10000
+
+#define PIC1_DATA 0x21
+#define PIC2_DATA 0xA1
+#define CALIBRATION_MS 10
+
+static volatile uint32_t* lapic = 0;
+static volatile uint32_t* ioapic = 0;
+static spinlock_t ioapic_lock;     // IOREGSEL and IOWIN are one access as a pair
+static int active = 0;
+static uint32_t timer_ticks_per_ms = 0;
+
+static uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg >> 2];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg >> 2] = value;
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[IOAPIC_SELECT >> 2] = reg;
+    return ioapic[IOAPIC_WINDOW >> 2];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value) {
+    ioapic[IOAPIC_SELECT >> 2] = reg;
+    ioapic[IOAPIC_WINDOW >> 2] = value;
+}
+
+static uint32_t redirect_reg(int irq) {
+    const acpi_madt_t* madt = acpi_madt();
+    return IOAPIC_REDIRECT + 2 * (madt->irq_gsi[irq] - madt->ioapic_gsi_base);
+}
+
+// ISA lines are edge triggered and active high unless the MADT overrides them
+static void ioapic_route(int irq, uint8_t dest, int masked) {
+    uint16_t flags = acpi_madt()->irq_flags[irq];
+    uint32_t low = IRQ_BASE + irq;
+    if ((flags & 0x3) == 0x3) low |= IOAPIC_ACTIVE_LOW;
+    if (((flags >> 2) & 0x3) == 0x3) low |= IOAPIC_LEVEL;
+    if (masked) low |= IOAPIC_MASKED;
+    uint32_t reg = redirect_reg(irq);
+    ioapic_write(reg + 1, (uint32_t)dest << 24);
+    ioapic_write(reg, low);
+}
+
+static void wait_icr() {
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) __asm__ volatile ("pause");
+}
+
+static void send_icr(uint8_t apic_id, uint32_t command) {
+    uint32_t flags = irq_save();
+    wait_icr();
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    wait_icr();
+    irq_restore(flags);
+}
+
+// Count LAPIC timer ticks against the calibrated clock, once, on the BSP
+static void calibrate_timer() {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    uint64_t end = now_ns() + (uint64_t)CALIBRATION_MS * NS_PER_MS;
+    while (now_ns() < end) __asm__ volatile ("pause");
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    timer_ticks_per_ms = elapsed / CALIBRATION_MS;
+}
+
+int apic_init() {
+    const acpi_madt_t* madt = acpi_madt();
+    if (!madt || !madt->ioapic_address) return 0;
+
+    paging_map(madt->lapic_address & ~(PAGE_SIZE - 1), PAGE_SIZE, PAGE_UNCACHED);
+    paging_map(madt->ioapic_address & ~(PAGE_SIZE - 1), PAGE_SIZE, PAGE_UNCACHED);
+    lapic = (volatile uint32_t*)madt->lapic_address;
+    ioapic = (volatile uint32_t*)madt->ioapic_address;
+
+    lapic_enable();
+    calibrate_timer();
+
+    uint32_t flags = irq_save();
+
+    // Lines the drivers already unmasked on the PIC stay unmasked
+    uint16_t pic_mask = inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+    uint8_t self = lapic_id();
+    for (int irq = 0; irq < 16; irq++) {
+        if (irq == 2) continue;         // Cascade, meaningless without the PICs
+        ioapic_route(irq, self, (pic_mask >> irq) & 1);
+    }
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    active = 1;
+    irq_restore(flags);
+    return 1;
+}
+
+int apic_active() {
+    return active;
+}
+
+void lapic_enable() {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_ENABLE | VECTOR_SPURIOUS);
+}
+
+uint8_t lapic_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_timer_start(uint32_t ms) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, VECTOR_LAPIC_TIMER | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INITIAL, timer_ticks_per_ms * ms);
+}
+
+void apic_send_ipi(uint8_t apic_id, uint8_t vector) {
+    send_icr(apic_id, vector);
+}
+
+void apic_send_init(uint8_t apic_id) {
+    send_icr(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+// The target starts in real mode at trampoline (page aligned, below 1 MB)
+void apic_send_startup(uint8_t apic_id, uint32_t trampoline) {
+    send_icr(apic_id, ICR_STARTUP | ICR_ASSERT | (trampoline >> PAGE_SHIFT));
+}
+
+void ioapic_mask(int irq, int masked) {
+    uint32_t reg = redirect_reg(irq);
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    uint32_t low = ioapic_read(reg);
+    ioapic_write(reg, masked ? low | IOAPIC_MASKED : low & ~IOAPIC_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
@@ -0,0 +1,29 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+// Vectors above the remapped ISA IRQs
+#define VECTOR_LAPIC_TIMER 48
+#define VECTOR_RESCHEDULE 49
+#define VECTOR_TLB_FLUSH 50
+#define VECTOR_SPURIOUS 255
+
+// Take over interrupt delivery from the 8259s: enable this CPU's local APIC
+// and route the ISA IRQs through the IOAPIC to it, keeping their masks
+int apic_init();
+int apic_active();
+
+// Per CPU
+void lapic_enable();
+uint8_t lapic_id();
+void lapic_eoi();
+void lapic_timer_start(uint32_t ms);    // Periodic VECTOR_LAPIC_TIMER
+
+void apic_send_ipi(uint8_t apic_id, uint8_t vector);
+void apic_send_init(uint8_t apic_id);
+void apic_send_startup(uint8_t apic_id, uint32_t trampoline);
+
+void ioapic_mask(int irq, int masked);
+
+#endif
@@ -0,0 +1,112 @@
+#include "arena.h"
+#include <stdint.h>
+#include "pmm.h"
+#include "string.h"
+#include "spinlock.h"
+
+#define ARENA_ALIGN 8
+#define ARENA_MAX_ALLOC ((PAGE_SIZE << PMM_MAX_ORDER) - sizeof(arena_chunk_t))   // The largest chunk's room
+
+// Script jobs make and release arenas on several CPUs at once
+static arena_t* live_arenas = 0;
+static spinlock_t live_lock;
+
+static void unlink_live(arena_t* arena) {
+    uint32_t flags = spin_lock_irqsave(&live_lock);
+    for (arena_t** link = &live_arenas; *link; link = &(*link)->next_live) {
+        if (*link == arena) {
+            *link = arena->next_live;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&live_lock, flags);
+}
+
+void arena_init(arena_t* arena, const char* name) {
+    arena->name = name;
+    arena->chunks = 0;
+    arena->cur = arena->end = arena->last = 0;
+    arena->used = arena->peak = arena->allocs = arena->chunk_count = 0;
+    arena->next_live = 0;
+}
+
+// Start a fresh chunk big enough for `size`; the rest of the old one is abandoned
+static int arena_grow(arena_t* arena, uint32_t size) {
+    if (size > ARENA_MAX_ALLOC) return 0;
+    uint32_t order = pmm_order_for(size + sizeof(arena_chunk_t));
+    if (order < ARENA_CHUNK_ORDER) order = ARENA_CHUNK_ORDER;
+    uint32_t base = pmm_alloc_pages(order);
+    if (!base) return 0;
+
+    arena_chunk_t* chunk = (arena_chunk_t*)base;
+    chunk->size = PAGE_SIZE << order;
+    chunk->next = arena->chunks;
+    if (!arena->chunks) {
+        uint32_t flags = spin_lock_irqsave(&live_lock);
+        arena->next_live = live_arenas;
+        live_arenas = arena;
+        spin_unlock_irqrestore(&live_lock, flags);
+    }
+    arena->chunks = chunk;
+    arena->chunk_count++;
+    arena->cur = (uint8_t*)(chunk + 1);
+    arena->end = (uint8_t*)chunk + chunk->size;
+    return 1;
+}
+
+void* arena_alloc(arena_t* arena, uint32_t size) {
+    if (size > ARENA_MAX_ALLOC) return 0;       // Nor could rounding it up wrap
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size == 0) size = ARENA_ALIGN;
+    if ((uint32_t)(arena->end - arena->cur) < size && !arena_grow(arena, size)) return 0;
+
+    void* ptr = arena->cur;
+    arena->last = arena->cur;
+    arena->cur += size;
+    arena->used += size;
+    arena->allocs++;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return ptr;
+}
+
+// The newest allocation grows in place when the chunk has room; anything
+// else is copied and the old copy stays dead until the arena is released
+void* arena_realloc(arena_t* arena, void* ptr, uint32_t old_size, uint32_t new_size) {
+    if (!ptr) return arena_alloc(arena, new_size);
+    if (new_size <= old_size) return ptr;
+    if (new_size > ARENA_MAX_ALLOC) return 0;
+
+    if ((uint8_t*)ptr == arena->last) {
+        uint32_t size = (new_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        if ((uint32_t)(arena->end - arena->last) >= size) {
+            arena->used += (arena->last + size) - arena->cur;
+            arena->cur = arena->last + size;
+            if (arena->used > arena->peak) arena->peak = arena->used;
+            return ptr;
+        }
+    }
+
+    void* bigger = arena_alloc(arena, new_size);
+    if (!bigger) return 0;
+    memcpy(bigger, ptr, old_size);
+    return bigger;
+}
+
+// One frame-allocator call per chunk, nothing per allocation
+void arena_release(arena_t* arena) {
+    if (arena->chunks) unlink_live(arena);
+    arena_chunk_t* chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t* next = chunk->next;
+        pmm_free_pages((uint32_t)chunk);
+        chunk = next;
+    }
+    arena->chunks = 0;
+    arena->cur = arena->end = arena->last = 0;
+    arena->used = 0;
+    arena->chunk_count = 0;
+}
+
+arena_t* arena_first_live() {
+    return live_arenas;
+}
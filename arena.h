@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+
+#define ARENA_CHUNK_ORDER 2      // Chunks of 4 pages unless one allocation needs more
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    uint32_t size;               // Bytes in the chunk, header included
+} arena_chunk_t;
+
+// Bump-pointer allocator: allocations are never freed one by one, the whole
+// arena is handed back to the frame allocator at once by arena_release()
+typedef struct arena {
+    const char* name;
+    arena_chunk_t* chunks;       // Newest first
+    uint8_t* cur;
+    uint8_t* end;
+    uint8_t* last;               // Most recent allocation, can grow in place
+    uint32_t used;               // Bytes handed out since the last release
+    uint32_t peak;
+    uint32_t allocs;
+    uint32_t chunk_count;
+    struct arena* next_live;
+} arena_t;
+
+void arena_init(arena_t* arena, const char* name);
+void* arena_alloc(arena_t* arena, uint32_t size);
+void* arena_realloc(arena_t* arena, void* ptr, uint32_t old_size, uint32_t new_size);
+void arena_release(arena_t* arena);
+
+// Arenas that currently hold memory, for statistics
+arena_t* arena_first_live();
+
+#endif
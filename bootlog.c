@@ -0,0 +1,68 @@
+#include "bootlog.h"
+#include <stdint.h>
+#include "io.h"
+#include "kprintf.h"
+#include "serial.h"
+#include "spinlock.h"
+#include "timer.h"
+
+typedef struct {
+    const char* phase;
+    uint64_t tsc;
+} boot_mark_t;
+
+uint64_t boot_start_tsc;
+
+static boot_mark_t marks[BOOTLOG_MAX_MARKS];
+static int mark_count = 0;
+static spinlock_t marks_lock;       // Background initializers mark too
+
+void boot_mark(const char* phase) {
+    if (!boot_start_tsc) return;
+    uint64_t now = rdtsc();
+    uint32_t flags = spin_lock_irqsave(&marks_lock);
+    if (mark_count < BOOTLOG_MAX_MARKS) {
+        marks[mark_count].phase = phase;
+        marks[mark_count].tsc = now;
+        mark_count++;
+    }
+    spin_unlock_irqrestore(&marks_lock, flags);
+}
+
+// Microseconds between two TSC readings
+static uint32_t tsc_us(uint64_t from, uint64_t to) {
+    return (uint32_t)div64_32((to - from) * 1000, tsc_khz(), 0);
+}
+
+// One line per phase: time since entry and the phase's own duration
+static int format_line(char* buf, int size, int i) {
+    uint64_t prev = i ? marks[i - 1].tsc : boot_start_tsc;
+    uint32_t at = tsc_us(boot_start_tsc, marks[i].tsc);
+    uint32_t took = tsc_us(prev, marks[i].tsc);
+    return ksnprintf(buf, size, "%5u.%03u ms  +%5u.%03u  %s\n",
+                     at / 1000, at % 1000, took / 1000, took % 1000, marks[i].phase);
+}
+
+void boot_timeline_print(uint8_t color) {
+    if (!boot_start_tsc || !tsc_khz()) {
+        kprintf(color, "No boot timeline: the TSC is unavailable\n");
+        return;
+    }
+    kprintf(color, "Boot timeline since entry:\n");
+    for (int i = 0; i < mark_count; i++) {
+        char line[64];
+        format_line(line, sizeof(line), i);
+        kprintf(color, "%s", line);
+    }
+}
+
+// For headless runs: the serial line only, so the shell screen stays clean
+void boot_timeline_serial() {
+    if (!boot_start_tsc || !tsc_khz()) return;
+    serial_write("Boot timeline since entry:\n");
+    for (int i = 0; i < mark_count; i++) {
+        char line[64];
+        format_line(line, sizeof(line), i);
+        serial_write(line);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef BOOTLOG_H
+#define BOOTLOG_H
+
+#include <stdint.h>
+
+#define BOOTLOG_MAX_MARKS 24
+
+// TSC at the `start` entry point, stored by kernel_entry.asm; 0 without a TSC
+extern uint64_t boot_start_tsc;
+
+// Record that `phase` just finished; the name must stay valid
+void boot_mark(const char* phase);
+
+// Timeline in milliseconds since entry, once the TSC is calibrated
+void boot_timeline_print(uint8_t color);
+void boot_timeline_serial();
+
+#endif
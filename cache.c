@@ -0,0 +1,267 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "cache.h"
+#include "script.h"
+#include "vars.h"
+#include "disk.h"
+#include "arena.h"
+#include "string.h"
+
+extern int strlen(const char* str);
+
+// The file is a header, the code, each loop's enter/exit, each function's
+// entry/params, then the strings, the slot names and the function names,
+// NUL-terminated. Slots are saved by name and interned again on load;
+// hidden loop counters have an empty name. The header carries a hash of
+// everything after it, so a damaged file is compiled again rather than run.
+
+#define CACHE_MAGIC 0x43425357     // "WSBC"
+#define CACHE_VERSION 4            // Bump when the compiler changes what it emits
+#define CACHE_NAME_MAX 32          // The file table's name size
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ops;                  // Opcodes known to the writer
+    uint32_t source_hash;
+    uint32_t source_size;
+    uint32_t code_words;
+    uint32_t string_count;
+    uint32_t slot_count;
+    uint32_t loop_count;
+    uint32_t func_count;
+    uint32_t fallback_lines;
+    uint32_t text_size;
+    uint32_t body_hash;
+} cache_header_t;
+
+// What an opcode's operands refer to, so a damaged file can't send the VM
+// outside the script
+enum { ARG_VALUE = 1, ARG_SLOT, ARG_STRING, ARG_TARGET, ARG_LOOP, ARG_FUNC };
+
+#define OP_COUNT (OP_EXEC + 1)
+
+static const uint8_t operands[OP_COUNT][3] = {
+    [OP_PUSH] = { ARG_VALUE },
+    [OP_LOAD] = { ARG_SLOT },
+    [OP_STORE] = { ARG_SLOT },
+    [OP_ADD_IMM] = { ARG_SLOT, ARG_VALUE },
+    [OP_COPY] = { ARG_SLOT, ARG_SLOT },
+    [OP_SET_TEXT] = { ARG_SLOT, ARG_STRING },
+    [OP_JUMP] = { ARG_TARGET },
+    [OP_JUMP_FALSE] = { ARG_TARGET },
+    [OP_LOOP] = { ARG_TARGET },
+    [OP_CALL] = { ARG_FUNC },
+    [OP_LOCAL] = { ARG_SLOT },
+    [OP_ENTER] = { ARG_LOOP },
+    [OP_LOOP_TEST] = { ARG_SLOT, ARG_SLOT, ARG_TARGET },
+    [OP_NEXT] = { ARG_SLOT, ARG_TARGET },
+    [OP_PRINT_STR] = { ARG_STRING },
+    [OP_PRINT_VAR] = { ARG_SLOT, ARG_STRING },
+    [OP_EXEC] = { ARG_STRING },
+};
+
+#define FNV_START 2166136261u
+
+// FNV-1a, continued from `hash`
+static uint32_t fnv_hash(uint32_t hash, const void* data, uint32_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (uint32_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int cache_name(const char* fname, char* out) {
+    int len = strlen(fname);
+    if (len + 3 > CACHE_NAME_MAX) return 0;
+    strcpy(out, fname);
+    strcpy(out + len, ".c");
+    return 1;
+}
+
+static int check_code(script_t* s) {
+    int32_t* code = s->code;
+    int32_t last = OP_PUSH;
+    for (uint32_t pc = 0; pc < s->length; ) {
+        if ((uint32_t)code[pc] >= OP_COUNT) return 0;
+        last = code[pc];
+        const uint8_t* kinds = operands[code[pc]];
+        pc++;
+        for (int i = 0; i < 3 && kinds[i]; i++, pc++) {
+            if (pc >= s->length) return 0;
+            uint32_t arg = code[pc];
+            uint32_t limit = 0xFFFFFFFF;
+            if (kinds[i] == ARG_SLOT) limit = s->slot_count;
+            if (kinds[i] == ARG_STRING) limit = s->string_count;
+            if (kinds[i] == ARG_TARGET) limit = s->length;
+            if (kinds[i] == ARG_LOOP) limit = s->loop_count;
+            if (kinds[i] == ARG_FUNC) limit = s->func_count;
+            if (kinds[i] != ARG_VALUE && arg >= limit) return 0;
+        }
+    }
+    for (uint32_t i = 0; i < s->loop_count; i++) {
+        if (s->loops[i].enter >= s->length || s->loops[i].exit > s->length) return 0;
+        if (code[s->loops[i].enter] != OP_ENTER) return 0;
+    }
+    for (uint32_t i = 0; i < s->func_count; i++) {
+        if (s->funcs[i].entry >= s->length) return 0;
+    }
+    return last == OP_HALT || last == OP_RET;        // Nothing runs off the end
+}
+
+// The next NUL-terminated string in the text, or 0 past its end
+static const char* next_text(const char** p, const char* end) {
+    const char* start = *p;
+    const char* q = start;
+    while (q < end && *q) q++;
+    if (q == end) return 0;
+    *p = q + 1;
+    return start;
+}
+
+script_t* cache_load(const char* fname, const char* source, arena_t* arena) {
+    char name[CACHE_NAME_MAX];
+    if (!cache_name(fname, name)) return 0;
+    int size = file_size(name);
+    if (size < (int)sizeof(cache_header_t)) return 0;
+
+    // The code is used where it was read; only the tables are rebuilt
+    uint8_t* buf = (uint8_t*)arena_alloc(arena, size);
+    if (!buf || read_file_at(name, 0, (char*)buf, size) != size) return 0;
+    cache_header_t* h = (cache_header_t*)buf;
+    uint32_t source_size = strlen(source);
+    if (h->magic != CACHE_MAGIC || h->version != CACHE_VERSION || h->ops != OP_COUNT ||
+        h->source_size != source_size || h->source_hash != fnv_hash(FNV_START, source, source_size)) {
+        return 0;
+    }
+    // Each count is held to the file's size first, so the sums can't wrap
+    uint32_t limit = (uint32_t)size;
+    if (h->code_words > limit / 4 || h->loop_count > limit / 8 || h->func_count > limit / 8 ||
+        h->text_size > limit || h->string_count > h->text_size || h->slot_count > h->text_size) {
+        return 0;
+    }
+    uint32_t words = h->code_words + 2 * h->loop_count + 2 * h->func_count;
+    if (sizeof(cache_header_t) + words * 4 + h->text_size != limit) return 0;
+    if (h->body_hash != fnv_hash(FNV_START, buf + sizeof(cache_header_t), limit - sizeof(cache_header_t))) {
+        return 0;
+    }
+
+    script_t* s = (script_t*)arena_alloc(arena, sizeof(script_t));
+    if (!s) return 0;
+    memset(s, 0, sizeof(script_t));
+    s->arena = arena;
+    s->code = (int32_t*)(buf + sizeof(cache_header_t));
+    s->length = h->code_words;
+    s->string_count = h->string_count;
+    s->slot_count = h->slot_count;
+    s->loop_count = h->loop_count;
+    s->func_count = h->func_count;
+    s->fallback_lines = h->fallback_lines;
+    s->strings = (const char**)arena_alloc(arena, s->string_count * sizeof(char*));
+    s->vars = (var_t**)arena_alloc(arena, s->slot_count * sizeof(var_t*));
+    s->loops = (script_loop_t*)arena_alloc(arena, s->loop_count * sizeof(script_loop_t));
+    s->funcs = (script_func_t*)arena_alloc(arena, s->func_count * sizeof(script_func_t));
+    if (!s->strings || !s->vars || !s->loops || !s->funcs) return 0;
+
+    uint32_t* table = (uint32_t*)(s->code + s->length);
+    for (uint32_t i = 0; i < s->loop_count; i++) {
+        memset(&s->loops[i], 0, sizeof(script_loop_t));
+        s->loops[i].enter = *table++;
+        s->loops[i].exit = *table++;
+    }
+    for (uint32_t i = 0; i < s->func_count; i++) {
+        s->funcs[i].entry = *table++;
+        s->funcs[i].params = *table++;
+    }
+
+    const char* text = (const char*)table;
+    const char* end = text + h->text_size;
+    for (uint32_t i = 0; i < s->string_count; i++) {
+        if (!(s->strings[i] = next_text(&text, end))) return 0;
+    }
+    for (uint32_t i = 0; i < s->slot_count; i++) {
+        const char* var_name = next_text(&text, end);
+        if (!var_name) return 0;
+        int len = strlen(var_name);
+        if (len) {
+            s->vars[i] = len < VAR_NAME_MAX ? var_intern(var_name, len) : 0;
+        } else {
+            s->vars[i] = (var_t*)arena_alloc(arena, sizeof(var_t));
+            if (s->vars[i]) {
+                memset(s->vars[i], 0, sizeof(var_t));
+                s->vars[i]->type = VAR_INT;
+            }
+        }
+        if (!s->vars[i]) return 0;
+    }
+    for (uint32_t i = 0; i < s->func_count; i++) {
+        if (!(s->funcs[i].name = next_text(&text, end))) return 0;
+    }
+    return check_code(s) ? s : 0;
+}
+
+typedef struct {
+    int writing;
+    uint32_t size;
+    uint32_t hash;
+} body_out_t;
+
+static void put(body_out_t* out, const void* data, uint32_t size) {
+    if (out->writing) {
+        file_write_chunk((const char*)data, size);
+    } else {
+        out->size += size;
+        out->hash = fnv_hash(out->hash, data, size);
+    }
+}
+
+static void put_text(body_out_t* out, const char* text) {
+    put(out, text, strlen(text) + 1);
+}
+
+// Run twice: to size and hash what follows the header, then to write it
+static void write_body(script_t* s, body_out_t* out) {
+    put(out, s->code, s->length * sizeof(int32_t));
+    for (uint32_t i = 0; i < s->loop_count; i++) {
+        put(out, &s->loops[i].enter, sizeof(uint32_t));
+        put(out, &s->loops[i].exit, sizeof(uint32_t));
+    }
+    for (uint32_t i = 0; i < s->func_count; i++) {
+        put(out, &s->funcs[i].entry, sizeof(uint32_t));
+        put(out, &s->funcs[i].params, sizeof(uint32_t));
+    }
+    for (uint32_t i = 0; i < s->string_count; i++) put_text(out, s->strings[i]);
+    for (uint32_t i = 0; i < s->slot_count; i++) put_text(out, s->vars[i]->name);
+    for (uint32_t i = 0; i < s->func_count; i++) put_text(out, s->funcs[i].name);
+}
+
+void cache_save(const char* fname, script_t* s, const char* source) {
+    char name[CACHE_NAME_MAX];
+    if (s->errors || !cache_name(fname, name)) return;
+
+    cache_header_t h;
+    h.magic = CACHE_MAGIC;
+    h.version = CACHE_VERSION;
+    h.ops = OP_COUNT;
+    h.source_size = strlen(source);
+    h.source_hash = fnv_hash(FNV_START, source, h.source_size);
+    h.code_words = s->length;
+    h.string_count = s->string_count;
+    h.slot_count = s->slot_count;
+    h.loop_count = s->loop_count;
+    h.func_count = s->func_count;
+    h.fallback_lines = s->fallback_lines;
+    body_out_t out = { 0, 0, FNV_START };
+    write_body(s, &out);
+    h.text_size = out.size - (s->length + 2 * s->loop_count + 2 * s->func_count) * sizeof(uint32_t);
+    h.body_hash = out.hash;
+
+    // A cache file that would be forgotten at reboot isn't worth a table entry
+    if (!file_persists(name) || file_write_begin(name, sizeof(h) + out.size) < 0) return;
+    file_write_chunk((const char*)&h, sizeof(h));
+    out.writing = 1;
+    write_body(s, &out);
+    file_write_end();
+}
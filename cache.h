@@ -0,0 +1,17 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "script.h"
+#include "arena.h"
+
+// Compiled scripts are kept next to their source as NAME.c, stamped with a
+// hash of the source they were compiled from
+
+// The saved script for `fname` if it was compiled from exactly `source`,
+// loaded into `arena`; 0 if there is none or it is stale
+script_t* cache_load(const char* fname, const char* source, arena_t* arena);
+
+// Save a script just compiled from `source`; scripts with errors aren't kept
+void cache_save(const char* fname, script_t* script, const char* source);
+
+#endif
@@ -0,0 +1,275 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "command.h"
+#include "string.h"
+#include "kprintf.h"
+#include "timer.h"
+#include "io.h"
+#include "heap.h"
+#include "sync.h"
+#include "spinlock.h"
+
+extern int strlen(const char* str);
+
+// Names hash into an open-addressed table, so dispatch costs the same
+// however many commands there are. It is filled at boot and only read
+// after that; the counters are bumped from the shell, scripts and
+// pipelines without a lock, so they may miss the odd call.
+
+#define COMMAND_SLOTS 64           // Power of two, well above the command count
+
+static command_t* table[COMMAND_SLOTS];
+static command_t* order[COMMAND_SLOTS];
+static int command_count;
+
+static const char* bucket_names[CMD_BUCKETS] = {
+    "<10us", "<100us", "<1ms", "<10ms", "<100ms", "more"
+};
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// FNV-1a over the first word
+static uint32_t name_hash(const char* name, int* len) {
+    uint32_t hash = 2166136261u;
+    int n = 0;
+    while (name[n] && !is_blank(name[n])) {
+        hash ^= (uint8_t)name[n++];
+        hash *= 16777619u;
+    }
+    *len = n;
+    return hash;
+}
+
+int command_register(command_t* command) {
+    int len;
+    uint32_t slot = name_hash(command->name, &len) & (COMMAND_SLOTS - 1);
+    if (command_count >= COMMAND_SLOTS / 2) return 0;
+    while (table[slot]) {
+        if (strcmp(table[slot]->name, command->name) == 0) return 0;
+        slot = (slot + 1) & (COMMAND_SLOTS - 1);
+    }
+    table[slot] = command;
+    order[command_count++] = command;
+    return 1;
+}
+
+command_t* command_find(const char* line) {
+    while (is_blank(*line)) line++;
+    int len;
+    uint32_t slot = name_hash(line, &len) & (COMMAND_SLOTS - 1);
+    for (command_t* command; (command = table[slot]); slot = (slot + 1) & (COMMAND_SLOTS - 1)) {
+        if (strncmp(command->name, line, len) == 0 && command->name[len] == '\0') return command;
+    }
+    return 0;
+}
+
+int command_parse(command_t* command, const char* line, command_args_t* args) {
+    const char* p = line;
+    while (is_blank(*p)) p++;
+    p += strlen(command->name);
+    char* out = args->words;
+    char* end = args->words + sizeof(args->words);
+    int optional = 0;
+    args->line = line;
+    args->count = 0;
+    args->in = 0;
+    args->out = 0;
+
+    for (const char* s = command->schema; *s && args->count < CMD_MAX_ARGS; s++) {
+        if (*s == '?') {
+            optional = 1;
+            continue;
+        }
+        while (is_blank(*p)) p++;
+        if (!*p) return optional ? CMD_DONE : CMD_BAD_ARGS;
+        int i = args->count;
+        if (*s == 'i' || *s == 'c') {
+            if (!parse_int(&p, &args->num[i])) return CMD_BAD_ARGS;
+            if (*s == 'c' && (args->num[i] < 0 || args->num[i] > 0xFF)) return CMD_BAD_ARGS;
+        } else if (*s == 'w') {
+            if (out >= end) return CMD_BAD_ARGS;
+            args->text[i] = out;
+            while (*p && !is_blank(*p) && out < end - 1) *out++ = *p++;
+            *out++ = '\0';
+        } else {
+            args->text[i] = p;
+            p += strlen(p);
+        }
+        args->count++;
+    }
+    return CMD_DONE;
+}
+
+void command_call(command_t* command, const command_args_t* args) {
+    uint64_t start = rdtsc();
+    command->run(args);
+    uint64_t cycles = rdtsc() - start;
+
+    uint32_t mhz = tsc_khz() / 1000;
+    uint64_t us = mhz ? div64_32(cycles, mhz, 0) : 0;
+    int bucket = 0;
+    for (uint64_t limit = 10; bucket < CMD_BUCKETS - 1 && us >= limit; limit *= 10) bucket++;
+    command->calls++;
+    command->cycles += cycles;
+    command->histogram[bucket]++;
+}
+
+int command_run(const char* line, int who) {
+    command_t* command = command_find(line);
+    if (!command || !(command->flags & who)) return CMD_UNKNOWN;
+    command_args_t args;
+    int result = command_parse(command, line, &args);
+    if (result == CMD_DONE) command_call(command, &args);
+    return result;
+}
+
+// A pipeline's state is shared with its threads and freed by whichever
+// lets go of it last, as a thread can still be inside semaphore_up()
+// when the caller wakes
+typedef struct pipeline pipeline_t;
+
+typedef struct {
+    command_t* command;
+    command_args_t args;
+    pipeline_t* pipeline;
+} stage_t;
+
+struct pipeline {
+    semaphore_t done;
+    spinlock_t lock;
+    int refs;
+    char text[CMD_LINE_MAX];
+    stage_t stages[CMD_STAGES];
+    pipe_t pipes[];                // One between each pair of stages
+};
+
+// Splits `text` in place at each '|'; the number of parts, or 0 if it is
+// not a pipeline
+static int split_pipeline(char* text, char** parts) {
+    int n = 1;
+    parts[0] = text;
+    for (char* p = text; *p; p++) {
+        if (*p != '|') continue;
+        if (n == CMD_STAGES) return 0;
+        *p = '\0';
+        parts[n++] = p + 1;
+    }
+    return n > 1 ? n : 0;
+}
+
+static int find_stages(const char* line, int who, char* text, char** parts, command_t** found) {
+    int len = strlen(line);
+    if (len >= CMD_LINE_MAX) return 0;
+    memcpy(text, line, len + 1);
+    int n = split_pipeline(text, parts);
+    for (int i = 0; i < n; i++) {
+        found[i] = command_find(parts[i]);
+        if (!found[i] || !(found[i]->flags & who)) return 0;
+    }
+    return n;
+}
+
+int command_is_pipeline(const char* line, int who) {
+    if (!strstr(line, "|")) return 0;
+    char text[CMD_LINE_MAX];
+    char* parts[CMD_STAGES];
+    command_t* found[CMD_STAGES];
+    return find_stages(line, who, text, parts, found) > 0;
+}
+
+static void pipeline_release(pipeline_t* pipeline) {
+    uint32_t flags = spin_lock_irqsave(&pipeline->lock);
+    int last = --pipeline->refs == 0;
+    spin_unlock_irqrestore(&pipeline->lock, flags);
+    if (last) kfree(pipeline);
+}
+
+// A stage that returns without reading all its input or with nothing
+// written lets its neighbours stop waiting on it
+static void stage_close(stage_t* stage) {
+    if (stage->args.in) pipe_close_read(stage->args.in);
+    if (stage->args.out) pipe_close_write(stage->args.out);
+}
+
+static void stage_worker(void* arg) {
+    stage_t* stage = (stage_t*)arg;
+    pipeline_t* pipeline = stage->pipeline;
+    command_call(stage->command, &stage->args);
+    stage_close(stage);
+    semaphore_up(&pipeline->done);
+    pipeline_release(pipeline);
+}
+
+int command_pipeline(const char* line, int who, command_t** failed) {
+    if (!strstr(line, "|")) return CMD_UNKNOWN;
+    char text[CMD_LINE_MAX];
+    char* parts[CMD_STAGES];
+    command_t* found[CMD_STAGES];
+    int n = find_stages(line, who, text, parts, found);
+    if (!n) return CMD_UNKNOWN;
+    if (failed) *failed = 0;
+
+    pipeline_t* pipeline = (pipeline_t*)kmalloc(sizeof(pipeline_t) + (n - 1) * sizeof(pipe_t));
+    if (!pipeline) return CMD_BAD_ARGS;
+    memcpy(pipeline->text, text, sizeof(text));
+    for (int i = 0; i < n; i++) {
+        stage_t* stage = &pipeline->stages[i];
+        stage->command = found[i];
+        stage->pipeline = pipeline;
+        if (command_parse(found[i], pipeline->text + (parts[i] - text), &stage->args) != CMD_DONE) {
+            if (failed) *failed = found[i];
+            kfree(pipeline);
+            return CMD_BAD_ARGS;
+        }
+    }
+    for (int i = 0; i < n - 1; i++) {
+        pipe_init(&pipeline->pipes[i]);
+        pipeline->stages[i].args.out = &pipeline->pipes[i];
+        pipeline->stages[i + 1].args.in = &pipeline->pipes[i];
+    }
+    semaphore_init(&pipeline->done, 0);
+    pipeline->lock.locked = 0;
+    pipeline->refs = n;
+
+    // The last command runs here, so a stopped script stops it, and the
+    // ones before it wind down as the pipes close behind it
+    int priority = thread_current()->priority;
+    for (int i = 0; i < n - 1; i++) {
+        stage_t* stage = &pipeline->stages[i];
+        if (!thread_create("pipe", stage_worker, stage, priority)) {
+            stage_close(stage);
+            semaphore_up(&pipeline->done);
+            pipeline_release(pipeline);    // The share its thread would have dropped
+        }
+    }
+    stage_t* last = &pipeline->stages[n - 1];
+    command_call(last->command, &last->args);
+    stage_close(last);
+    for (int i = 0; i < n - 1; i++) semaphore_down(&pipeline->done);
+    pipeline_release(pipeline);
+    return CMD_DONE;
+}
+
+void command_help(int who, uint8_t color) {
+    for (int i = 0; i < command_count; i++) {
+        if ((order[i]->flags & who) && order[i]->usage) kprintf(color, "%s\n", order[i]->usage);
+    }
+}
+
+void command_stats(uint8_t color) {
+    uint32_t mhz = tsc_khz() / 1000;
+    kprintf(color, "command     calls  avg us");
+    for (int b = 0; b < CMD_BUCKETS; b++) kprintf(color, " %6s", bucket_names[b]);
+    kprintf(color, "\n");
+    for (int i = 0; i < command_count; i++) {
+        command_t* command = order[i];
+        if (!command->calls) continue;
+        uint64_t average = div64_32(command->cycles, command->calls, 0);
+        kprintf(color, "%-10s %6u %7llu", command->name, command->calls,
+                mhz ? div64_32(average, mhz, 0) : 0);
+        for (int b = 0; b < CMD_BUCKETS; b++) kprintf(color, " %6u", command->histogram[b]);
+        kprintf(color, "\n");
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+#include "pipe.h"
+
+// Who may run a command, and how the shell shows it
+#define CMD_SHELL 1
+#define CMD_SCRIPT 2
+#define CMD_BOTH (CMD_SHELL | CMD_SCRIPT)
+#define CMD_DRAWS 4                // The shell gives it the screen until a key
+
+#define CMD_MAX_ARGS 8
+#define CMD_LINE_MAX 256
+#define CMD_BUCKETS 6              // Latency: <10us, <100us, <1ms, <10ms, <100ms, more
+#define CMD_STAGES 8               // Commands in one pipeline
+
+// Results of command_parse() and command_run()
+enum { CMD_BAD_ARGS = -1, CMD_UNKNOWN = 0, CMD_DONE = 1 };
+
+// A command's arguments, as its schema asked for them. The schema has one
+// letter per argument: 'i' an integer, 'c' a color (0-255), 'w' a word,
+// 's' the rest of the line; after a '?' the rest are optional.
+typedef struct {
+    const char* line;                  // The whole command line
+    int count;                         // Arguments given
+    int num[CMD_MAX_ARGS];             // 'i' and 'c' arguments
+    const char* text[CMD_MAX_ARGS];    // 'w' and 's' arguments
+    char words[CMD_LINE_MAX + CMD_MAX_ARGS];
+    pipe_t* in;                        // Output of the command before it in a pipeline, or 0
+    pipe_t* out;                       // Input of the command after it, or 0 for the console
+} command_args_t;
+
+typedef struct {
+    const char* name;
+    const char* schema;
+    int flags;
+    void (*run)(const command_args_t* args);
+    const char* usage;                 // For help and bad arguments; 0 hides an alias
+
+    // Kept by the registry
+    uint32_t calls;
+    uint64_t cycles;
+    uint32_t histogram[CMD_BUCKETS];
+} command_t;
+
+// Add a command; 0 if the name is taken or the table is full
+int command_register(command_t* command);
+
+// The command named by the first word of `line`, or 0
+command_t* command_find(const char* line);
+
+// Parse `line` against the command's schema
+int command_parse(command_t* command, const char* line, command_args_t* args);
+
+// Run a parsed command, counting the call and its time
+void command_call(command_t* command, const command_args_t* args);
+
+// Find, parse and call in one go, for commands open to `who`
+int command_run(const char* line, int who);
+
+// Whether `line` is "cmd | cmd ...", every part a command open to `who`
+int command_is_pipeline(const char* line, int who);
+
+// Run a pipeline, each command but the last on a thread of its own, and
+// return when all are done. CMD_UNKNOWN if `line` is not one; on
+// CMD_BAD_ARGS `failed` is the command that would not parse, or 0 if
+// the pipeline could not be set up.
+int command_pipeline(const char* line, int who, command_t** failed);
+
+// Usage lines of the commands open to `who`, in the order they were added
+void command_help(int who, uint8_t color);
+
+// Calls and latency histogram of every command used so far
+void command_stats(uint8_t color);
+
+#endif
@@ -0,0 +1,271 @@
+#include "console.h"
+#include <stdint.h>
+#include "graphics.h"
+#include "textgrid.h"
+#include "sync.h"
+#include "serial.h"
+
+// One line of console text; each cell keeps its own color
+typedef struct {
+    char ch[CONSOLE_COLS];
+    uint8_t color[CONSOLE_COLS];
+    int len;
+    int wrapped;                  // Carries on from the line before, which was full
+} console_line_t;
+
+// Scrollback ring: `first_line` is the oldest line, the newest line is the one being written
+static console_line_t lines[CONSOLE_HISTORY];
+static int first_line = 0;
+static int line_count = 1;
+static int cur_col = 0;
+
+static int view_offset = 0;   // Lines scrolled back from the bottom
+static int top_row = 0;
+static int rows = 0;
+static int cols = 0;
+static uint8_t con_bg = VGA_BLUE;
+static int cursor_shown = 0;
+
+static console_line_t* line_at(int logical) {
+    return &lines[(first_line + logical) % CONSOLE_HISTORY];
+}
+
+// Screen row of a logical line, or -1 if it is not visible
+static int row_of(int logical) {
+    int top_visible = line_count - view_offset - rows;
+    if (top_visible < 0) top_visible = 0;
+
+    int row = logical - top_visible;
+    if (row < 0 || row >= rows) return -1;
+    return row;
+}
+
+static void put_cell(int row, int col, char c, uint8_t color) {
+    grid_put(col, top_row + row, c, color, con_bg);
+}
+
+static void hide_cursor() {
+    if (!cursor_shown) return;
+    cursor_shown = 0;
+    int row = row_of(line_count - 1);
+    if (row >= 0 && cur_col < cols) {
+        put_cell(row, cur_col, ' ', con_bg);
+    }
+}
+
+// Lay out the visible window into the grid; unchanged cells cost nothing on flush
+static void layout() {
+    int top_visible = line_count - view_offset - rows;
+    if (top_visible < 0) top_visible = 0;
+
+    for (int row = 0; row < rows; row++) {
+        int logical = top_visible + row;
+        console_line_t* line = (logical < line_count) ? line_at(logical) : 0;
+        for (int col = 0; col < cols; col++) {
+            if (line && col < line->len) {
+                put_cell(row, col, line->ch[col], line->color[col]);
+            } else {
+                put_cell(row, col, ' ', con_bg);
+            }
+        }
+    }
+    cursor_shown = 0;
+}
+
+static void snap_to_bottom() {
+    if (view_offset != 0) {
+        view_offset = 0;
+        layout();
+    }
+}
+
+static void new_line() {
+    if (line_count == CONSOLE_HISTORY) {
+        // Ring is full: the oldest line is dropped, no copying needed
+        first_line = (first_line + 1) % CONSOLE_HISTORY;
+    } else {
+        line_count++;
+    }
+    line_at(line_count - 1)->len = 0;
+    line_at(line_count - 1)->wrapped = 0;
+    cur_col = 0;
+
+    if (line_count > rows) {
+        grid_scroll_up(top_row, rows, con_bg);
+    } else {
+        grid_fill(0, top_row + line_count - 1, cols, 1, ' ', con_bg, con_bg);
+    }
+}
+
+static void put_char(char c, uint8_t color) {
+    if (c == '\n') {
+        new_line();
+        return;
+    }
+    if (cur_col >= cols) {
+        new_line();
+        line_at(line_count - 1)->wrapped = 1;
+    }
+
+    console_line_t* line = line_at(line_count - 1);
+    line->ch[cur_col] = c;
+    line->color[cur_col] = color;
+    put_cell(row_of(line_count - 1), cur_col, c, color);
+    cur_col++;
+    line->len = cur_col;
+}
+
+// Everything written to the console is mirrored to the serial line for
+// headless runs
+static void mirror(char c) {
+    if (c == '\n') serial_putc('\r');
+    serial_putc(c);
+}
+
+// Serializes the console and the grid underneath it between threads.
+// Zero-initialized static storage is an unlocked mutex.
+static mutex_t console_mutex;
+static int panicking = 0;
+
+void console_lock() {
+    if (!panicking) mutex_lock(&console_mutex);
+}
+
+void console_unlock() {
+    if (!panicking) mutex_unlock(&console_mutex);
+}
+
+// The CPU is about to halt: write without waiting on whoever holds the lock
+void console_panic() {
+    panicking = 1;
+    serial_panic();
+}
+
+void console_init(int top, uint8_t bg) {
+    console_lock();
+    top_row = top / GRID_CELL_SIZE;
+    rows = grid_rows() - top_row;
+    cols = grid_cols() < CONSOLE_COLS ? grid_cols() : CONSOLE_COLS;
+    con_bg = bg;
+    first_line = 0;
+    line_count = 1;
+    lines[0].len = 0;
+    lines[0].wrapped = 0;
+    cur_col = 0;
+    view_offset = 0;
+    layout();
+    console_unlock();
+}
+
+void console_set_background(uint8_t bg) {
+    console_lock();
+    con_bg = bg;
+    console_unlock();
+}
+
+void console_putc(char c, uint8_t color) {
+    console_lock();
+    snap_to_bottom();
+    hide_cursor();
+    put_char(c, color);
+    mirror(c);
+    grid_flush();
+    console_unlock();
+}
+
+void console_write(const char* str, uint8_t color) {
+    console_lock();
+    snap_to_bottom();
+    hide_cursor();
+    while (*str) {
+        mirror(*str);
+        put_char(*str++, color);
+    }
+    grid_flush();
+    console_unlock();
+}
+
+void console_backspace() {
+    console_lock();
+    snap_to_bottom();
+    hide_cursor();
+
+    // Back over a wrap onto the end of the line it carries on from
+    if (cur_col == 0 && line_count > 1 && line_at(line_count - 1)->wrapped) {
+        line_count--;
+        cur_col = line_at(line_count - 1)->len;
+        layout();
+    }
+    if (cur_col > 0) {
+        cur_col--;
+        line_at(line_count - 1)->len = cur_col;
+        put_cell(row_of(line_count - 1), cur_col, ' ', con_bg);
+        serial_write("\b \b");
+    }
+    grid_flush();
+    console_unlock();
+}
+
+void console_draw_cursor(uint8_t color) {
+    console_lock();
+    int row = row_of(line_count - 1);
+    if (row < 0 || cur_col >= cols) {
+        console_unlock();
+        return;
+    }
+    put_cell(row, cur_col, '_', color);
+    cursor_shown = 1;
+    grid_flush();
+    console_unlock();
+}
+
+void console_page_up() {
+    console_lock();
+    int max_offset = line_count - rows;
+    if (max_offset <= 0) {
+        console_unlock();
+        return;
+    }
+
+    view_offset += rows - 1;
+    if (view_offset > max_offset) view_offset = max_offset;
+    layout();
+    grid_flush();
+    console_unlock();
+}
+
+void console_page_down() {
+    console_lock();
+    if (view_offset == 0) {
+        console_unlock();
+        return;
+    }
+
+    view_offset -= rows - 1;
+    if (view_offset < 0) view_offset = 0;
+    layout();
+    grid_flush();
+    console_unlock();
+}
+
+// Repaint everything, for when the screen was overwritten behind the console's back
+void console_redraw() {
+    console_lock();
+    grid_invalidate();
+    layout();
+    grid_flush();
+    console_unlock();
+}
+
+void console_clear() {
+    console_lock();
+    first_line = 0;
+    line_count = 1;
+    lines[0].len = 0;
+    lines[0].wrapped = 0;
+    cur_col = 0;
+    view_offset = 0;
+    layout();
+    grid_flush();
+    console_unlock();
+}
@@ -0,0 +1,27 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+#define CONSOLE_COLS 80        // Upper bound; the visible width comes from the text grid
+#define CONSOLE_HISTORY 256
+#define CONSOLE_LINE_HEIGHT 8
+
+void console_init(int top, uint8_t bg);
+void console_set_background(uint8_t bg);
+void console_putc(char c, uint8_t color);
+void console_write(const char* str, uint8_t color);
+void console_backspace();
+void console_draw_cursor(uint8_t color);
+void console_page_up();
+void console_page_down();
+void console_redraw();
+void console_clear();
+
+// Hold across several console or grid calls that must not interleave with
+// another thread's output; the lock nests
+void console_lock();
+void console_unlock();
+void console_panic();
+
+#endif
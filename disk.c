@@ -2,25 +2,17 @@
 #include <stdint.h>
 #include "string.h"
 #include "graphics.h"
+#include "console.h"
+#include "sync.h"
+#include "spinlock.h"
 
 extern void puts(const char*);
-extern int cursor_y;
 
 #define SECTOR_SIZE 512
 #define MAX_FILES 64
 #define FILENAME_SIZE 32
 
-// Add inline functions at the top
-static inline void outb(uint16_t port, uint8_t val) {
-    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
-}
-
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
-
+// Word-sized port I/O for the ATA data register; outb/inb come from io.h
 static inline uint16_t inw(uint16_t port) {
     uint16_t ret;
     __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
@@ -38,10 +30,62 @@ typedef struct {
     uint8_t used;
 } file_entry_t;
 
-// File allocation table stored in sector 0
+// File allocation table stored in sector 0. Lookups from any CPU copy
+// entries out under table_lock; no disk I/O happens while it is held.
+// Only the first TABLE_SLOTS entries fit in the sector and survive a reboot.
+#define TABLE_SLOTS (SECTOR_SIZE / sizeof(file_entry_t))
+
 static file_entry_t file_table[MAX_FILES];
+static ticket_lock_t table_lock;
 
-void init_filesystem() {
+static int find_file(const char* name) {
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (file_table[i].used && strcmp(name, file_table[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int lookup_file(const char* name, file_entry_t* entry) {
+    uint32_t flags = ticket_lock_irqsave(&table_lock);
+    int index = find_file(name);
+    if (index >= 0) *entry = file_table[index];
+    ticket_unlock_irqrestore(&table_lock, flags);
+    return index;
+}
+
+// The entry `name` has, or the free one it would get; -1 if the table is full
+static int slot_for(const char* name) {
+    int index = find_file(name);
+    for (int i = 0; i < MAX_FILES && index == -1; i++) {
+        if (!file_table[i].used) index = i;
+    }
+    return index;
+}
+
+static int entry_at(int index, file_entry_t* entry) {
+    uint32_t flags = ticket_lock_irqsave(&table_lock);
+    *entry = file_table[index];
+    ticket_unlock_irqrestore(&table_lock, flags);
+    return entry->used;
+}
+
+// Sector 0 holds as much of the table as fits
+static void flush_table() {
+    uint8_t sector[SECTOR_SIZE];
+    uint32_t flags = ticket_lock_irqsave(&table_lock);
+    memcpy(sector, file_table, SECTOR_SIZE);
+    ticket_unlock_irqrestore(&table_lock, flags);
+    write_sector(0, sector);
+}
+
+// The table is read on first use, or earlier by the background loader
+// kmain starts, so nothing before the first prompt waits on the disk
+static mutex_t load_mutex;
+static volatile int table_loaded = 0;
+
+static void load_table() {
     // Try to read file table from disk sector 0
     read_sector(0, (uint8_t*)file_table);
     
@@ -78,56 +122,107 @@ void init_filesystem() {
     }
 }
 
+void init_filesystem() {
+    if (table_loaded) return;
+    mutex_lock(&load_mutex);
+    if (!table_loaded) {
+        load_table();
+        table_loaded = 1;
+    }
+    mutex_unlock(&load_mutex);
+}
+
 int read_file(const char* name, char* out, int max_size) {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (file_table[i].used && strcmp(name, file_table[i].name) == 0) {
-            uint32_t sectors_to_read = (file_table[i].size + SECTOR_SIZE - 1) / SECTOR_SIZE;
-            uint8_t sector_buffer[SECTOR_SIZE];
-            int bytes_read = 0;
-            
-            for (uint32_t j = 0; j < sectors_to_read && bytes_read < max_size; j++) {
-                read_sector(file_table[i].start_sector + j, sector_buffer);
-                
-                int copy_size = file_table[i].size - bytes_read;
-                if (copy_size > SECTOR_SIZE) copy_size = SECTOR_SIZE;
-                if (copy_size > max_size - bytes_read) copy_size = max_size - bytes_read;
-                
-                for (int k = 0; k < copy_size; k++) {
-                    out[bytes_read + k] = sector_buffer[k];
-                }
-                bytes_read += copy_size;
-            }
-            return bytes_read;
+    init_filesystem();
+    file_entry_t file;
+    if (lookup_file(name, &file) < 0) return -1;
+
+    uint32_t sectors_to_read = (file.size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint8_t sector_buffer[SECTOR_SIZE];
+    int bytes_read = 0;
+
+    for (uint32_t j = 0; j < sectors_to_read && bytes_read < max_size; j++) {
+        read_sector(file.start_sector + j, sector_buffer);
+
+        int copy_size = file.size - bytes_read;
+        if (copy_size > SECTOR_SIZE) copy_size = SECTOR_SIZE;
+        if (copy_size > max_size - bytes_read) copy_size = max_size - bytes_read;
+
+        for (int k = 0; k < copy_size; k++) {
+            out[bytes_read + k] = sector_buffer[k];
         }
+        bytes_read += copy_size;
     }
-    return -1;
+    return bytes_read;
 }
 
-int write_file(const char* name, const char* data, int size) {
-    // Find existing file or create new one
-    int file_index = -1;
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (file_table[i].used && strcmp(name, file_table[i].name) == 0) {
-            file_index = i;
-            break;
+int file_size(const char* name) {
+    init_filesystem();
+    file_entry_t file;
+    if (lookup_file(name, &file) < 0) return -1;
+    return file.size;
+}
+
+// Read up to `max_size` bytes starting at byte `offset`, touching only the sectors needed
+int read_file_at(const char* name, int offset, char* out, int max_size) {
+    init_filesystem();
+    file_entry_t file;
+    if (lookup_file(name, &file) < 0) return -1;
+
+    int size = file.size;
+    if (offset >= size) return 0;
+    if (max_size > size - offset) max_size = size - offset;
+
+    uint8_t sector_buffer[SECTOR_SIZE];
+    int bytes_read = 0;
+    while (bytes_read < max_size) {
+        int pos = offset + bytes_read;
+        read_sector(file.start_sector + pos / SECTOR_SIZE, sector_buffer);
+
+        int skip = pos % SECTOR_SIZE;
+        int copy_size = SECTOR_SIZE - skip;
+        if (copy_size > max_size - bytes_read) copy_size = max_size - bytes_read;
+
+        for (int k = 0; k < copy_size; k++) {
+            out[bytes_read + k] = sector_buffer[skip + k];
         }
+        bytes_read += copy_size;
     }
+    return bytes_read;
+}
+
+// Streaming writer: data arrives in arbitrary chunks and goes to disk a sector at a
+// time. One writer at a time; writer_mutex is held from begin to end.
+static mutex_t writer_mutex;
+static int write_index = -1;
+static uint32_t write_start = 0;
+static uint32_t write_size = 0;
+static uint32_t write_room = 0;        // Sectors of the old copy being rewritten, or 0
+static int write_fill = 0;
+static uint8_t write_buffer[SECTOR_SIZE];
+
+int file_persists(const char* name) {
+    init_filesystem();
+    uint32_t flags = ticket_lock_irqsave(&table_lock);
+    int index = slot_for(name);
+    ticket_unlock_irqrestore(&table_lock, flags);
+    return index >= 0 && index < (int)TABLE_SLOTS;
+}
+
+int file_write_begin(const char* name, int size) {
+    init_filesystem();
+    mutex_lock(&writer_mutex);
+    uint32_t flags = ticket_lock_irqsave(&table_lock);
+
+    // Find existing file or create new one
+    int file_index = slot_for(name);
     
-    // If not found, find free slot
-    if (file_index == -1) {
-        for (int i = 0; i < MAX_FILES; i++) {
-            if (!file_table[i].used) {
-                file_index = i;
-                break;
-            }
-        }
+    if (file_index == -1) { // No free slots
+        ticket_unlock_irqrestore(&table_lock, flags);
+        mutex_unlock(&writer_mutex);
+        return -1;
     }
     
-    if (file_index == -1) return -1; // No free slots
-    
-    // Calculate sectors needed
-    uint32_t sectors_needed = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
-    
     // Find free sectors (simple allocation starting from sector 1)
     uint32_t start_sector = 1; // Sector 0 is for file table
     for (int i = 0; i < MAX_FILES; i++) {
@@ -137,51 +232,92 @@ int write_file(const char* name, const char* data, int size) {
         }
     }
     
-    // Update file table entry
+    // A new version no bigger than the old one is written over it
+    write_room = 0;
+    uint32_t old_sectors = (file_table[file_index].size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (file_table[file_index].used && (uint32_t)(size + SECTOR_SIZE - 1) / SECTOR_SIZE <= old_sectors) {
+        start_sector = file_table[file_index].start_sector;
+        write_room = old_sectors;
+    }
+
     strcpy(file_table[file_index].name, name);
-    file_table[file_index].start_sector = start_sector;
-    file_table[file_index].size = size;
-    file_table[file_index].used = 1;
-    
-    // Write file data to sectors
-    uint8_t sector_buffer[SECTOR_SIZE];
-    for (uint32_t i = 0; i < sectors_needed; i++) {
-        // Clear buffer
-        for (int j = 0; j < SECTOR_SIZE; j++) {
-            sector_buffer[j] = 0;
+    ticket_unlock_irqrestore(&table_lock, flags);
+    write_index = file_index;
+    write_start = start_sector;
+    write_size = 0;
+    write_fill = 0;
+    return 0;
+}
+
+int file_write_chunk(const char* data, int size) {
+    if (write_index < 0) return -1;
+
+    for (int i = 0; i < size; i++) {
+        // More than the size given would run into the next file's sectors
+        if (write_room && write_size / SECTOR_SIZE >= write_room) return -1;
+        write_buffer[write_fill++] = data[i];
+        if (write_fill == SECTOR_SIZE) {
+            write_sector(write_start + write_size / SECTOR_SIZE, write_buffer);
+            write_size += SECTOR_SIZE;
+            write_fill = 0;
         }
-        
-        // Copy data to buffer
-        int copy_size = (size > SECTOR_SIZE) ? SECTOR_SIZE : size;
-        for (int j = 0; j < copy_size; j++) {
-            sector_buffer[j] = data[j];
+    }
+    return size;
+}
+
+int file_write_end() {
+    if (write_index < 0) return -1;
+
+    // Flush the partial last sector, zero padded
+    if (write_fill > 0) {
+        for (int j = write_fill; j < SECTOR_SIZE; j++) {
+            write_buffer[j] = 0;
         }
-        
-        write_sector(start_sector + i, sector_buffer);
-        data += copy_size;
-        size -= copy_size;
+        write_sector(write_start + write_size / SECTOR_SIZE, write_buffer);
+        write_size += write_fill;
+        write_fill = 0;
     }
-    
+
+    // Update file table entry
+    uint32_t flags = ticket_lock_irqsave(&table_lock);
+    file_table[write_index].start_sector = write_start;
+    file_table[write_index].size = write_size;
+    file_table[write_index].used = 1;
+    ticket_unlock_irqrestore(&table_lock, flags);
+
     // Write updated file table back to sector 0
-    write_sector(0, (uint8_t*)file_table);
-    
-    return file_table[file_index].size;
+    flush_table();
+
+    int size = write_size;
+    write_index = -1;
+    mutex_unlock(&writer_mutex);
+    return size;
+}
+
+int write_file(const char* name, const char* data, int size) {
+    if (file_write_begin(name, size) < 0) return -1;
+    file_write_chunk(data, size);
+    return file_write_end();
 }
 
 void list_files() {
+    init_filesystem();
+    file_entry_t file;
     for (int i = 0; i < MAX_FILES; i++) {
-        if (file_table[i].used) {
-            draw_string(10, cursor_y, file_table[i].name, VGA_WHITE);
-            cursor_y += 16;
+        if (entry_at(i, &file)) {
+            console_write(file.name, VGA_WHITE);
+            console_putc('\n', VGA_WHITE);
         }
     }
 }
 
 int get_file_name(int index, char* name) {
-    if (index >= 0 && index < MAX_FILES && file_table[index].used) {
+    init_filesystem();
+    file_entry_t file;
+    if (index >= 0 && index < MAX_FILES && entry_at(index, &file)) {
         int i = 0;
-        while (file_table[index].name[i] && i < FILENAME_SIZE - 1) {
-            name[i] = file_table[index].name[i];
+        while (file.name[i] && i < FILENAME_SIZE - 1) {
+            name[i] = file.name[i];
             i++;
         }
         name[i] = 0;
@@ -190,7 +326,12 @@ int get_file_name(int index, char* name) {
     return 0;
 }
 
+// The ATA register sequence must not interleave between threads
+static mutex_t ata_mutex;
+
 void write_sector(uint32_t lba, uint8_t* buffer) {
+    mutex_lock(&ata_mutex);
+
     // Wait for drive to be ready
     while (inb(0x1F7) & 0x80);
     
@@ -209,9 +350,12 @@ void write_sector(uint32_t lba, uint8_t* buffer) {
     for (int i = 0; i < 256; i++) {
         outw(0x1F0, ((uint16_t*)buffer)[i]);
     }
+    mutex_unlock(&ata_mutex);
 }
 
 void read_sector(uint32_t lba, uint8_t* buffer) {
+    mutex_lock(&ata_mutex);
+
     // Wait for drive to be ready
     while (inb(0x1F7) & 0x80);
     
@@ -230,4 +374,5 @@ void read_sector(uint32_t lba, uint8_t* buffer) {
     for (int i = 0; i < 256; i++) {
         ((uint16_t*)buffer)[i] = inw(0x1F0);
     }
+    mutex_unlock(&ata_mutex);
 }
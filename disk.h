@@ -5,8 +5,18 @@
 
 int read_file(const char* name, char* out, int max_size);
 int write_file(const char* name, const char* data, int size);
+int file_size(const char* name);
+int read_file_at(const char* name, int offset, char* out, int max_size);
+// Streaming writer; `size` is the whole file's, so a file rewritten no
+// bigger than before keeps its sectors instead of taking new ones
+int file_write_begin(const char* name, int size);
+int file_write_chunk(const char* data, int size);
+int file_write_end();
+// Whether `name` has, or would get, a table entry that survives a reboot
+int file_persists(const char* name);
 void list_files();
 int get_file_name(int index, char* name);
+// Loads the file table once; every other entry point calls it first
 void init_filesystem();
 void read_sector(uint32_t lba, uint8_t* buffer);
 void write_sector(uint32_t lba, uint8_t* buffer);
@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "dlist.h"
+#include "graphics.h"
+#include "thread.h"
+#include "spinlock.h"
+#include "profile.h"
+#include "string.h"
+
+#define DLIST_MAX 1024             // Records before a flush is forced
+#define DLIST_ROWS 240             // The tallest mode, mode X
+#define DLIST_COLS 320
+
+// Clipped to the screen when recorded; ends are exclusive
+typedef struct {
+    int16_t x1, y1, x2, y2;
+    uint8_t color;
+} dlist_rect_t;
+
+static dlist_rect_t rects[DLIST_MAX];
+static int count;
+static thread_t* owner;
+static spinlock_t owner_lock;
+
+// Scratch for the flush: rects by first row, the ones on the current row
+// in the order they were recorded, and the row being built
+static uint16_t row_first[DLIST_ROWS];
+static uint16_t row_next[DLIST_MAX];
+static uint16_t active[DLIST_MAX];
+static uint8_t row[DLIST_COLS];
+static uint8_t covered[DLIST_COLS];
+
+// First come: a script that starts while another holds the list draws
+// straight away instead
+void dlist_begin() {
+    uint32_t flags = spin_lock_irqsave(&owner_lock);
+    if (!owner) {
+        owner = thread_current();
+        count = 0;
+    }
+    spin_unlock_irqrestore(&owner_lock, flags);
+}
+
+void dlist_end() {
+    if (owner != thread_current()) return;
+    dlist_flush();
+    owner = 0;
+}
+
+// Each row is built in memory, front to back so every pixel is settled by
+// the first rect that covers it, and only the covered runs are written out
+void dlist_flush() {
+    if (!count || owner != thread_current()) return;
+    uint64_t start = profile_start();
+    int w = graphics_width();
+    int h = graphics_height();
+
+    memset(row_first, 0, sizeof(row_first));
+    for (int i = count - 1; i >= 0; i--) {
+        if (rects[i].y1 >= h) continue;          // Recorded before a mode change
+        row_next[i] = row_first[rects[i].y1];
+        row_first[rects[i].y1] = i + 1;
+    }
+
+    int active_count = 0;
+    for (int y = 0; y < h; y++) {
+        int kept = 0;
+        for (int a = 0; a < active_count; a++) {
+            if (rects[active[a]].y2 > y) active[kept++] = active[a];
+        }
+        active_count = kept;
+        for (int i = row_first[y]; i; i = row_next[i - 1]) {
+            int a = active_count++;
+            while (a > 0 && active[a - 1] > i - 1) {
+                active[a] = active[a - 1];
+                a--;
+            }
+            active[a] = i - 1;
+        }
+        if (!active_count) continue;
+
+        memset(covered, 0, w);
+        int left = w;
+        for (int a = active_count - 1; a >= 0 && left > 0; a--) {
+            dlist_rect_t* r = &rects[active[a]];
+            int x2 = r->x2 < w ? r->x2 : w;
+            for (int x = r->x1; x < x2; x++) {
+                if (!covered[x]) {
+                    covered[x] = 1;
+                    row[x] = r->color;
+                    left--;
+                }
+            }
+        }
+        for (int x = 0; x < w; ) {
+            if (!covered[x]) {
+                x++;
+                continue;
+            }
+            int run = x;
+            while (x < w && covered[x]) x++;
+            gfx_write_span(run, y, row + run, x - run);
+        }
+    }
+    count = 0;
+    profile_stop(PROF_DRAW, start);
+}
+
+// A rect the same color as the one recorded just before it, inside it,
+// around it or lined up with it, only grows that one to their union
+static int merge(dlist_rect_t* r, int x1, int y1, int x2, int y2, uint8_t color) {
+    if (r->color != color) return 0;
+    int inside = x1 >= r->x1 && x2 <= r->x2 && y1 >= r->y1 && y2 <= r->y2;
+    int around = x1 <= r->x1 && x2 >= r->x2 && y1 <= r->y1 && y2 >= r->y2;
+    int column = x1 == r->x1 && x2 == r->x2 && y1 <= r->y2 && y2 >= r->y1;
+    int band = y1 == r->y1 && y2 == r->y2 && x1 <= r->x2 && x2 >= r->x1;
+    if (!inside && !around && !column && !band) return 0;
+    if (x1 < r->x1) r->x1 = x1;
+    if (y1 < r->y1) r->y1 = y1;
+    if (x2 > r->x2) r->x2 = x2;
+    if (y2 > r->y2) r->y2 = y2;
+    return 1;
+}
+
+void dlist_rect(int x, int y, int width, int height, uint8_t color) {
+    if (!owner || owner != thread_current()) {
+        fill_rect(x, y, width, height, color);
+        return;
+    }
+
+    // Off-screen parts are culled here, so the flush never clips
+    int w = graphics_width();
+    int h = graphics_height();
+    int x1 = x < 0 ? 0 : x;
+    int y1 = y < 0 ? 0 : y;
+    int x2 = x + width > w ? w : x + width;
+    int y2 = y + height > h ? h : y + height;
+    if (x1 >= x2 || y1 >= y2) return;
+
+    // Nothing recorded so far would show through a full-screen fill
+    if (x1 == 0 && y1 == 0 && x2 == w && y2 == h) count = 0;
+    if (count && merge(&rects[count - 1], x1, y1, x2, y2, color)) return;
+    if (count == DLIST_MAX) dlist_flush();
+    dlist_rect_t* r = &rects[count++];
+    r->x1 = x1;
+    r->y1 = y1;
+    r->x2 = x2;
+    r->y2 = y2;
+    r->color = color;
+}
+
+// A box seen from above and to the right: front face, shaded right side
+// and highlighted top, each side `width / 4` deep
+void dlist_cube(int x, int y, int width, int height, uint8_t color, uint8_t dark, uint8_t bright) {
+    int depth = width / 4;
+    dlist_rect(x, y, width, height, color);
+
+    for (int i = 0; i < depth; i++) {
+        dlist_rect(x + width + i, y - i, 1, height, dark);
+    }
+    dlist_rect(x + width, y - depth, depth, height, dark);
+
+    for (int i = 0; i < depth; i++) {
+        dlist_rect(x + depth - i, y + i - depth, width, 1, bright);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef DLIST_H
+#define DLIST_H
+
+#include <stdint.h>
+
+// Display list for scripts. While a thread has one open, its rects and
+// cubes are recorded rather than drawn, and dlist_flush() draws them all
+// in one pass down the screen. Everyone else still draws straight away.
+
+void dlist_begin();
+void dlist_end();                  // Flushes what is left
+
+// Draw what has been recorded; nothing unless called by the list's thread
+void dlist_flush();
+
+void dlist_rect(int x, int y, int width, int height, uint8_t color);
+void dlist_cube(int x, int y, int width, int height, uint8_t color, uint8_t dark, uint8_t bright);
+
+#endif
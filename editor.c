@@ -0,0 +1,355 @@
+#include "editor.h"
+#include <stdint.h>
+#include "disk.h"
+#include "graphics.h"
+#include "textgrid.h"
+#include "keyboard.h"
+#include "gapbuf.h"
+#include "arena.h"
+#include "string.h"
+
+extern int fg_color;
+extern int bg_color;
+
+#define EDITOR_TEXT_ROW 3      // First grid row used for file text
+#define EDITOR_TEXT_COL 1
+#define EDITOR_CHUNK 512       // Load and save granularity, one disk sector
+#define EDITOR_SLACK 1024      // Initial gap so the first edits don't grow the buffer
+
+// Length of every line including its newline, kept as a gap array so that
+// splitting or joining lines at the cursor is O(1)
+typedef struct {
+    int* lens;
+    int capacity;
+    int gap_start;
+    int gap_end;
+    arena_t* arena;
+} line_index_t;
+
+// Everything a session allocates comes from `arena` and goes away with it
+typedef struct {
+    arena_t arena;
+    gap_buffer_t text;
+    line_index_t lines;
+    int cursor;         // Offset of the cursor in the text
+    int cur_line;
+    int cur_col;
+    int line_start;     // Offset of the first character of cur_line
+    int top_line;       // First line shown in the viewport
+    int top_start;
+    int view_rows;
+} editor_t;
+
+static int li_init(line_index_t* li, int capacity, arena_t* arena) {
+    if (capacity < 64) capacity = 64;
+    li->arena = arena;
+    li->lens = (int*)arena_alloc(arena, capacity * sizeof(int));
+    if (!li->lens) return 0;
+    li->capacity = capacity;
+    li->gap_start = 0;
+    li->gap_end = capacity;
+    return 1;
+}
+
+static int li_count(const line_index_t* li) {
+    return li->capacity - (li->gap_end - li->gap_start);
+}
+
+static int* li_slot(line_index_t* li, int line) {
+    if (line < li->gap_start) return &li->lens[line];
+    return &li->lens[line + (li->gap_end - li->gap_start)];
+}
+
+static void li_move_gap(line_index_t* li, int line) {
+    while (li->gap_start > line) {
+        li->lens[--li->gap_end] = li->lens[--li->gap_start];
+    }
+    while (li->gap_start < line) {
+        li->lens[li->gap_start++] = li->lens[li->gap_end++];
+    }
+}
+
+static int li_insert(line_index_t* li, int line, int len) {
+    if (li->gap_start == li->gap_end) {
+        int new_capacity = li->capacity * 2;
+        int* lens = (int*)arena_alloc(li->arena, new_capacity * sizeof(int));
+        if (!lens) return 0;
+        int tail = li->capacity - li->gap_end;
+        memcpy(lens, li->lens, li->gap_start * sizeof(int));
+        memcpy(lens + new_capacity - tail, li->lens + li->gap_end, tail * sizeof(int));
+        li->lens = lens;
+        li->gap_end = new_capacity - tail;
+        li->capacity = new_capacity;
+    }
+    li_move_gap(li, line);
+    li->lens[li->gap_start++] = len;
+    return 1;
+}
+
+static void li_remove(line_index_t* li, int line) {
+    li_move_gap(li, line);
+    li->gap_end++;
+}
+
+// Characters on a line, not counting its newline
+static int content_len(editor_t* ed, int line) {
+    int len = *li_slot(&ed->lines, line);
+    return line < li_count(&ed->lines) - 1 ? len - 1 : len;
+}
+
+static int editor_load(editor_t* ed, const char* fname) {
+    int size = file_size(fname);
+    if (size < 0) size = 0;
+
+    arena_init(&ed->arena, "editor");
+    if (!gb_init(&ed->text, size + EDITOR_SLACK, &ed->arena)) return 0;
+
+    // Stream the file straight into the front of the buffer a sector at a time
+    for (int offset = 0; offset < size; offset += EDITOR_CHUNK) {
+        int chunk = size - offset < EDITOR_CHUNK ? size - offset : EDITOR_CHUNK;
+        if (read_file_at(fname, offset, ed->text.data + offset, chunk) < chunk) {
+            size = offset;
+            break;
+        }
+    }
+    ed->text.gap_start = size;
+
+    // Build the line index once; after this it is maintained by every edit
+    if (!li_init(&ed->lines, size / 16, &ed->arena)) {
+        arena_release(&ed->arena);
+        return 0;
+    }
+    int len = 0;
+    for (int i = 0; i < size; i++) {
+        len++;
+        if (ed->text.data[i] == '\n') {
+            li_insert(&ed->lines, li_count(&ed->lines), len);
+            len = 0;
+        }
+    }
+    li_insert(&ed->lines, li_count(&ed->lines), len);
+
+    ed->cursor = 0;
+    ed->cur_line = 0;
+    ed->cur_col = 0;
+    ed->line_start = 0;
+    ed->top_line = 0;
+    ed->top_start = 0;
+    ed->view_rows = grid_rows() - EDITOR_TEXT_ROW;
+    return 1;
+}
+
+// Save the two halves around the gap through the chunked writer
+static int editor_save(editor_t* ed, const char* fname) {
+    gap_buffer_t* gb = &ed->text;
+    int size = gb->gap_start + gb->capacity - gb->gap_end;
+    if (file_write_begin(fname, size) < 0) return -1;
+    file_write_chunk(gb->data, gb->gap_start);
+    file_write_chunk(gb->data + gb->gap_end, gb->capacity - gb->gap_end);
+    return file_write_end();
+}
+
+static void editor_free(editor_t* ed) {
+    arena_release(&ed->arena);
+}
+
+// Lay one line out into its viewport row and blank the rest of the row
+static void layout_line(editor_t* ed, int line, int start) {
+    int row = EDITOR_TEXT_ROW + line - ed->top_line;
+    int len = content_len(ed, line);
+    int col = EDITOR_TEXT_COL;
+    for (int i = 0; i < len && col < grid_cols(); i++) {
+        grid_put(col++, row, gb_char_at(&ed->text, start + i), fg_color, bg_color);
+    }
+    grid_fill(col, row, grid_cols() - col, 1, ' ', fg_color, bg_color);
+}
+
+// Redraw from `line` (starting at offset `start`) down to the bottom of the viewport
+static void layout_from(editor_t* ed, int line, int start) {
+    int count = li_count(&ed->lines);
+    for (; line < ed->top_line + ed->view_rows; line++) {
+        if (line < count) {
+            layout_line(ed, line, start);
+            start += *li_slot(&ed->lines, line);
+        } else {
+            grid_fill(0, EDITOR_TEXT_ROW + line - ed->top_line, grid_cols(), 1, ' ', fg_color, bg_color);
+        }
+    }
+}
+
+// The cursor is the cell under it drawn with inverted colors, so moving it touches two cells
+static void draw_cursor(editor_t* ed, int on) {
+    char c = ed->cur_col < content_len(ed, ed->cur_line) ? gb_char_at(&ed->text, ed->cursor) : ' ';
+    int row = EDITOR_TEXT_ROW + ed->cur_line - ed->top_line;
+    if (on) {
+        grid_put(EDITOR_TEXT_COL + ed->cur_col, row, c, bg_color, VGA_LIGHT_GREEN);
+    } else {
+        grid_put(EDITOR_TEXT_COL + ed->cur_col, row, c, fg_color, bg_color);
+    }
+}
+
+// Scroll the viewport so the cursor line is visible; returns 1 if it moved
+static int scroll_to_cursor(editor_t* ed) {
+    int moved = 0;
+    while (ed->cur_line < ed->top_line) {
+        ed->top_line--;
+        ed->top_start -= *li_slot(&ed->lines, ed->top_line);
+        moved = 1;
+    }
+    while (ed->cur_line >= ed->top_line + ed->view_rows) {
+        ed->top_start += *li_slot(&ed->lines, ed->top_line);
+        ed->top_line++;
+        moved = 1;
+    }
+    return moved;
+}
+
+void text_editor(const char* fname) {
+    editor_t ed;
+    if (!editor_load(&ed, fname)) return;
+
+    grid_fill(0, 0, grid_cols(), grid_rows(), ' ', fg_color, bg_color);
+    grid_write(1, 1, "Editor: ESC=save+exit arrows=move", fg_color, bg_color);
+    layout_from(&ed, 0, 0);
+    draw_cursor(&ed, 1);
+    grid_invalidate();
+    grid_flush();
+
+    while (1) {
+        char c = wait_for_key_press();
+
+        if (c == 27) {
+            int result = editor_save(&ed, fname);
+            if (result >= 0) {
+                clear_graphics(VGA_GREEN);
+                draw_string(10, 10, "File saved successfully!", fg_color);
+                get_key();
+            }
+            break;
+        }
+
+        // Damage is either the cursor line alone or everything from a line downwards
+        int damage_line = -1;
+        int damage_start = 0;
+        int damage_to_end = 0;
+        int line_total = *li_slot(&ed.lines, ed.cur_line);
+
+        draw_cursor(&ed, 0);
+
+        if ((uint8_t)c == KEY_UP) {
+            if (ed.cur_line > 0) {
+                ed.cur_line--;
+                ed.line_start -= *li_slot(&ed.lines, ed.cur_line);
+                int len = content_len(&ed, ed.cur_line);
+                if (ed.cur_col > len) ed.cur_col = len;
+                ed.cursor = ed.line_start + ed.cur_col;
+            }
+        }
+        else if ((uint8_t)c == KEY_DOWN) {
+            if (ed.cur_line < li_count(&ed.lines) - 1) {
+                ed.line_start += line_total;
+                ed.cur_line++;
+                int len = content_len(&ed, ed.cur_line);
+                if (ed.cur_col > len) ed.cur_col = len;
+                ed.cursor = ed.line_start + ed.cur_col;
+            }
+        }
+        else if ((uint8_t)c == KEY_LEFT) {
+            if (ed.cur_col > 0) {
+                ed.cur_col--;
+                ed.cursor--;
+            } else if (ed.cur_line > 0) {
+                ed.cur_line--;
+                ed.line_start -= *li_slot(&ed.lines, ed.cur_line);
+                ed.cur_col = content_len(&ed, ed.cur_line);
+                ed.cursor--;
+            }
+        }
+        else if ((uint8_t)c == KEY_RIGHT) {
+            if (ed.cur_col < content_len(&ed, ed.cur_line)) {
+                ed.cur_col++;
+                ed.cursor++;
+            } else if (ed.cur_line < li_count(&ed.lines) - 1) {
+                ed.cur_line++;
+                ed.cur_col = 0;
+                ed.cursor++;
+                ed.line_start = ed.cursor;
+            }
+        }
+        else if (c == '\n') {
+            if (gb_insert(&ed.text, ed.cursor, '\n') && li_insert(&ed.lines, ed.cur_line + 1, line_total - ed.cur_col)) {
+                // Splitting a line shifts every line below it
+                *li_slot(&ed.lines, ed.cur_line) = ed.cur_col + 1;
+                damage_line = ed.cur_line;
+                damage_start = ed.line_start;
+                damage_to_end = 1;
+
+                ed.cursor++;
+                ed.cur_line++;
+                ed.cur_col = 0;
+                ed.line_start = ed.cursor;
+            }
+        }
+        else if (c == '\b') {
+            if (ed.cur_col > 0 && ctrl_pressed) {
+                // Ctrl+Backspace: delete back to the previous space; never crosses a newline
+                int count = 0;
+                if (gb_char_at(&ed.text, ed.cursor - 1) == ' ') count++;
+                while (count < ed.cur_col && gb_char_at(&ed.text, ed.cursor - count - 1) != ' ') count++;
+
+                gb_delete(&ed.text, ed.cursor - count, count);
+                *li_slot(&ed.lines, ed.cur_line) -= count;
+                ed.cursor -= count;
+                ed.cur_col -= count;
+                damage_line = ed.cur_line;
+                damage_start = ed.line_start;
+            }
+            else if (ed.cur_col > 0) {
+                gb_delete(&ed.text, ed.cursor - 1, 1);
+                *li_slot(&ed.lines, ed.cur_line) -= 1;
+                ed.cursor--;
+                ed.cur_col--;
+                damage_line = ed.cur_line;
+                damage_start = ed.line_start;
+            }
+            else if (ed.cur_line > 0) {
+                // Joining two lines shifts every line below them up
+                int prev_total = *li_slot(&ed.lines, ed.cur_line - 1);
+                gb_delete(&ed.text, ed.cursor - 1, 1);
+                li_remove(&ed.lines, ed.cur_line);
+                ed.cur_line--;
+                *li_slot(&ed.lines, ed.cur_line) = prev_total - 1 + line_total;
+                ed.line_start -= prev_total;
+                ed.cur_col = prev_total - 1;
+                ed.cursor--;
+                damage_line = ed.cur_line;
+                damage_start = ed.line_start;
+                damage_to_end = 1;
+            }
+        }
+        else if (c >= 32 && c <= 126) {
+            if (gb_insert(&ed.text, ed.cursor, c)) {
+                *li_slot(&ed.lines, ed.cur_line) += 1;
+                damage_line = ed.cur_line;
+                damage_start = ed.line_start;
+                ed.cursor++;
+                ed.cur_col++;
+            }
+        }
+
+        // Re-lay out only what changed; the grid repaints only the cells that differ
+        if (scroll_to_cursor(&ed)) {
+            layout_from(&ed, ed.top_line, ed.top_start);
+        } else if (damage_line >= 0) {
+            if (damage_to_end) {
+                layout_from(&ed, damage_line, damage_start);
+            } else {
+                layout_line(&ed, damage_line, damage_start);
+            }
+        }
+        draw_cursor(&ed, 1);
+        grid_flush();
+    }
+
+    editor_free(&ed);
+}
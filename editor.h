@@ -0,0 +1,6 @@
+#ifndef EDITOR_H
+#define EDITOR_H
+
+void text_editor(const char* fname);
+
+#endif
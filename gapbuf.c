@@ -0,0 +1,86 @@
+#include "gapbuf.h"
+#include "heap.h"
+#include "string.h"
+
+#define GAP_MIN_GROWTH 256
+
+static char* gb_alloc(gap_buffer_t* gb, int size) {
+    if (gb->arena) return (char*)arena_alloc(gb->arena, size);
+    return (char*)kmalloc(size);
+}
+
+int gb_init(gap_buffer_t* gb, int capacity, arena_t* arena) {
+    if (capacity < GAP_MIN_GROWTH) capacity = GAP_MIN_GROWTH;
+    gb->arena = arena;
+    gb->data = gb_alloc(gb, capacity);
+    if (!gb->data) return 0;
+    gb->capacity = capacity;
+    gb->gap_start = 0;
+    gb->gap_end = capacity;
+    return 1;
+}
+
+// Arena-backed buffers are released with their arena
+void gb_free(gap_buffer_t* gb) {
+    if (!gb->arena) kfree(gb->data);
+    gb->data = 0;
+    gb->capacity = gb->gap_start = gb->gap_end = 0;
+}
+
+int gb_length(const gap_buffer_t* gb) {
+    return gb->capacity - (gb->gap_end - gb->gap_start);
+}
+
+char gb_char_at(const gap_buffer_t* gb, int pos) {
+    if (pos < gb->gap_start) return gb->data[pos];
+    return gb->data[pos + (gb->gap_end - gb->gap_start)];
+}
+
+void gb_move_gap(gap_buffer_t* gb, int pos) {
+    if (pos < gb->gap_start) {
+        int count = gb->gap_start - pos;
+        memmove(gb->data + gb->gap_end - count, gb->data + pos, count);
+        gb->gap_start -= count;
+        gb->gap_end -= count;
+    } else if (pos > gb->gap_start) {
+        int count = pos - gb->gap_start;
+        memmove(gb->data + gb->gap_start, gb->data + gb->gap_end, count);
+        gb->gap_start += count;
+        gb->gap_end += count;
+    }
+}
+
+// Make sure the gap can take `extra` more characters, doubling the buffer if not
+int gb_reserve(gap_buffer_t* gb, int extra) {
+    if (gb->gap_end - gb->gap_start >= extra) return 1;
+
+    int new_capacity = gb->capacity * 2;
+    if (new_capacity < gb->capacity + extra + GAP_MIN_GROWTH) {
+        new_capacity = gb->capacity + extra + GAP_MIN_GROWTH;
+    }
+    char* data = gb_alloc(gb, new_capacity);
+    if (!data) return 0;
+
+    int tail = gb->capacity - gb->gap_end;
+    memcpy(data, gb->data, gb->gap_start);
+    memcpy(data + new_capacity - tail, gb->data + gb->gap_end, tail);
+    if (!gb->arena) kfree(gb->data);
+
+    gb->data = data;
+    gb->gap_end = new_capacity - tail;
+    gb->capacity = new_capacity;
+    return 1;
+}
+
+int gb_insert(gap_buffer_t* gb, int pos, char c) {
+    if (!gb_reserve(gb, 1)) return 0;
+    gb_move_gap(gb, pos);
+    gb->data[gb->gap_start++] = c;
+    return 1;
+}
+
+// Delete `count` characters starting at `pos`
+void gb_delete(gap_buffer_t* gb, int pos, int count) {
+    gb_move_gap(gb, pos);
+    gb->gap_end += count;
+}
@@ -0,0 +1,25 @@
+#ifndef GAPBUF_H
+#define GAPBUF_H
+
+#include "arena.h"
+
+// Text buffer with a movable gap at the edit point: inserting or deleting
+// at the gap is O(1), moving the gap costs the distance moved.
+typedef struct {
+    char* data;
+    int capacity;
+    int gap_start;
+    int gap_end;
+    arena_t* arena;             // Owner of `data`, or 0 for the kernel heap
+} gap_buffer_t;
+
+int gb_init(gap_buffer_t* gb, int capacity, arena_t* arena);
+void gb_free(gap_buffer_t* gb);
+int gb_length(const gap_buffer_t* gb);
+char gb_char_at(const gap_buffer_t* gb, int pos);
+void gb_move_gap(gap_buffer_t* gb, int pos);
+int gb_reserve(gap_buffer_t* gb, int extra);
+int gb_insert(gap_buffer_t* gb, int pos, char c);
+void gb_delete(gap_buffer_t* gb, int pos, int count);
+
+#endif
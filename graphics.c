@@ -1,9 +1,26 @@
 #include "graphics.h"
 #include <stdint.h>
+#include "string.h"
+#include "timer.h"
 
 #define VGA_MEMORY ((volatile uint8_t*)0xA0000)
-#define SCREEN_WIDTH 320
-#define SCREEN_HEIGHT 200
+#define MODEX_WIDTH 320
+#define MODEX_HEIGHT 240
+#define MODEX_STRIDE (MODEX_WIDTH / 4)              // Bytes per scanline in each plane
+#define MODEX_PAGE_SIZE (MODEX_STRIDE * MODEX_HEIGHT)
+#define MODEX_PAGES 3                               // 3 * 19200 bytes fit in the 64K window
+
+// Current video mode state. In mode X, drawing goes to `draw_page` while
+// `visible_page` is scanned out; gfx_present() swaps them on vertical retrace.
+static int mode_x = 0;
+static int screen_w = SCREEN_WIDTH;
+static int screen_h = SCREEN_HEIGHT;
+static int refresh_hz = 70;
+static int frame_rate = GFX_DEFAULT_FPS;
+static uint64_t next_frame_ns = 0;
+static int visible_page = 0;
+static int draw_page = 1;
+static uint32_t draw_offset = 0;
 
 static inline uint8_t inb(uint16_t port) {
     uint8_t ret;
@@ -15,12 +32,44 @@ static inline void outb(uint16_t port, uint8_t val) {
     __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
 
+// VGA memory is mapped write-combining; a locked operation drains the
+// combining buffers (no SSE needed) so a frame is complete before it is shown
+static inline void wc_flush() {
+    __asm__ volatile ("lock; addl $0, (%%esp)" : : : "memory", "cc");
+}
+
 void init_graphics() {
     switch_to_graphics();
     // Don't clear here, let caller decide
 }
 
+static void set_start_address(uint32_t offset) {
+    outb(0x3D4, 0x0C); outb(0x3D5, (offset >> 8) & 0xFF);
+    outb(0x3D4, 0x0D); outb(0x3D5, offset & 0xFF);
+}
+
+static void set_map_mask(uint8_t mask) {
+    outb(0x3C4, 0x02); outb(0x3C5, mask);
+}
+
 void switch_to_graphics() {
+    if (mode_x) {
+        // Undo the registers mode X changed before programming mode 13h
+        outb(0x3C4, 0x00); outb(0x3C5, 0x01);   // Synchronous reset
+        outb(0x3C2, 0x63);
+        outb(0x3C4, 0x00); outb(0x3C5, 0x03);
+        outb(0x3D4, 0x11); outb(0x3D5, 0x00);
+        outb(0x3D4, 0x10); outb(0x3D5, 0x9C);
+        outb(0x3D4, 0x14); outb(0x3D5, 0x40);
+        outb(0x3D4, 0x16); outb(0x3D5, 0xB9);
+        set_start_address(0);
+        mode_x = 0;
+    }
+    screen_w = SCREEN_WIDTH;
+    screen_h = SCREEN_HEIGHT;
+    refresh_hz = 70;
+    draw_offset = 0;
+
     // Set VGA mode 13h (320x200x8) using BIOS-style register setup
     outb(0x3C2, 0x63);  // Miscellaneous Output Register
     
@@ -49,6 +98,93 @@ void switch_to_graphics() {
     outb(0x3D4, 0x17); outb(0x3D5, 0xA3);
 }
 
+// Unchained 320x240 "mode X": four planes, three video pages, 60 Hz
+void switch_to_modex() {
+    switch_to_graphics();
+
+    outb(0x3C4, 0x04); outb(0x3C5, 0x06);   // Chain-4 off, odd/even off
+    outb(0x3C4, 0x00); outb(0x3C5, 0x01);   // Synchronous reset
+    outb(0x3C2, 0xE3);                       // 25 MHz dot clock, 480 line timing
+    outb(0x3C4, 0x00); outb(0x3C5, 0x03);   // Restart sequencer
+
+    outb(0x3D4, 0x11); outb(0x3D5, 0x00);   // Unprotect CRTC 0-7
+    outb(0x3D4, 0x06); outb(0x3D5, 0x0D);   // Vertical total
+    outb(0x3D4, 0x07); outb(0x3D5, 0x3E);   // Overflow
+    outb(0x3D4, 0x09); outb(0x3D5, 0x41);   // Double scan
+    outb(0x3D4, 0x10); outb(0x3D5, 0xEA);   // Vertical sync start
+    outb(0x3D4, 0x11); outb(0x3D5, 0xAC);   // Vertical sync end
+    outb(0x3D4, 0x12); outb(0x3D5, 0xDF);   // Vertical display end
+    outb(0x3D4, 0x14); outb(0x3D5, 0x00);   // Dword mode off
+    outb(0x3D4, 0x15); outb(0x3D5, 0xE7);   // Vertical blank start
+    outb(0x3D4, 0x16); outb(0x3D5, 0x06);   // Vertical blank end
+    outb(0x3D4, 0x17); outb(0x3D5, 0xE3);   // Byte mode
+
+    mode_x = 1;
+    screen_w = MODEX_WIDTH;
+    screen_h = MODEX_HEIGHT;
+    refresh_hz = 60;
+
+    // Clear every page in all four planes at once
+    set_map_mask(0x0F);
+    memset((uint8_t*)VGA_MEMORY, 0, MODEX_PAGE_SIZE * MODEX_PAGES);
+
+    visible_page = 0;
+    draw_page = 1;
+    draw_offset = draw_page * MODEX_PAGE_SIZE;
+    set_start_address(0);
+}
+
+int graphics_is_modex() {
+    return mode_x;
+}
+
+int graphics_width() {
+    return screen_w;
+}
+
+int graphics_height() {
+    return screen_h;
+}
+
+void gfx_set_frame_rate(int fps) {
+    if (fps < 1) fps = 1;
+    if (fps > refresh_hz) fps = refresh_hz;
+    frame_rate = fps;
+}
+
+// Block until the next vertical retrace begins
+void gfx_wait_retrace() {
+    while (inb(0x3DA) & 0x08);     // Let a retrace in progress finish
+    while (!(inb(0x3DA) & 0x08));  // Then wait for the next one to start
+}
+
+// End a frame: sleep until the frame's deadline on the timer, then (in
+// mode X) show the page just drawn. The new start address is latched at
+// the retrace, so the flip never tears.
+void gfx_present() {
+    uint32_t frame_ns = 1000000000u / frame_rate;
+    uint64_t now = now_ns();
+    if (next_frame_ns < now || next_frame_ns > now + frame_ns) {
+        next_frame_ns = now;    // First frame, or we fell behind: don't try to catch up
+    }
+    next_frame_ns += frame_ns;
+    sleep_until_ns(next_frame_ns - frame_ns / 4);   // Leave time to catch the retrace
+    wc_flush();
+
+    if (!mode_x) {
+        gfx_wait_retrace();
+        return;
+    }
+
+    while (inb(0x3DA) & 0x01);     // Change the address during active display
+    set_start_address(draw_page * MODEX_PAGE_SIZE);
+    gfx_wait_retrace();
+
+    visible_page = draw_page;
+    draw_page = (draw_page + 1) % MODEX_PAGES;
+    draw_offset = draw_page * MODEX_PAGE_SIZE;
+}
+
 void switch_to_text() {
     // Reset to standard VGA text mode 3
     outb(0x3C2, 0x67);  // Miscellaneous Output Register
@@ -117,19 +253,42 @@ void switch_to_text() {
 }
 
 void set_pixel(int x, int y, uint8_t color) {
-    if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT) {
-        VGA_MEMORY[y * SCREEN_WIDTH + x] = color;
+    if (x >= 0 && x < screen_w && y >= 0 && y < screen_h) {
+        if (mode_x) {
+            set_map_mask(1 << (x & 3));
+            VGA_MEMORY[draw_offset + y * MODEX_STRIDE + (x >> 2)] = color;
+        } else {
+            VGA_MEMORY[y * SCREEN_WIDTH + x] = color;
+        }
     }
 }
 
 uint8_t get_pixel(int x, int y) {
-    if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT) {
+    if (x >= 0 && x < screen_w && y >= 0 && y < screen_h) {
+        if (mode_x) {
+            outb(0x3CE, 0x04); outb(0x3CF, x & 3);   // Read map select
+            return VGA_MEMORY[draw_offset + y * MODEX_STRIDE + (x >> 2)];
+        }
         return VGA_MEMORY[y * SCREEN_WIDTH + x];
     }
     return 0;
 }
 
+// Copies the page being drawn, graphics_width() * graphics_height() bytes
+void gfx_capture(uint8_t* buf) {
+    for (int y = 0; y < screen_h; y++) {
+        for (int x = 0; x < screen_w; x++) {
+            *buf++ = get_pixel(x, y);
+        }
+    }
+}
+
 void clear_graphics(uint8_t color) {
+    if (mode_x) {
+        set_map_mask(0x0F);
+        memset((uint8_t*)VGA_MEMORY + draw_offset, color, MODEX_PAGE_SIZE);
+        return;
+    }
     for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
         VGA_MEMORY[i] = color;
     }
@@ -166,10 +325,59 @@ void draw_rect(int x, int y, int width, int height, uint8_t color) {
     }
 }
 
+// Fill one clipped span in mode X: partial bytes at the edges use a plane
+// mask, the middle writes all four planes per byte
+static void modex_span(int x1, int x2, int y, uint8_t color) {
+    volatile uint8_t* row = VGA_MEMORY + draw_offset + y * MODEX_STRIDE;
+    int first = x1 >> 2;
+    int last = x2 >> 2;
+    uint8_t left_mask = 0x0F & (0x0F << (x1 & 3));
+    uint8_t right_mask = 0x0F >> (3 - (x2 & 3));
+
+    if (first == last) {
+        set_map_mask(left_mask & right_mask);
+        row[first] = color;
+        return;
+    }
+    set_map_mask(left_mask);
+    row[first] = color;
+    if (last - first > 1) {
+        set_map_mask(0x0F);
+        memset((uint8_t*)row + first + 1, color, last - first - 1);
+    }
+    set_map_mask(right_mask);
+    row[last] = color;
+}
+
 void fill_rect(int x, int y, int width, int height, uint8_t color) {
-    for (int j = 0; j < height; j++) {
-        for (int i = 0; i < width; i++) {
-            set_pixel(x + i, y + j, color);
+    // Clip once up front instead of per pixel
+    int x1 = x < 0 ? 0 : x;
+    int y1 = y < 0 ? 0 : y;
+    int x2 = x + width > screen_w ? screen_w : x + width;
+    int y2 = y + height > screen_h ? screen_h : y + height;
+    if (x1 >= x2 || y1 >= y2) return;
+
+    for (int j = y1; j < y2; j++) {
+        if (mode_x) {
+            modex_span(x1, x2 - 1, j, color);
+        } else {
+            memset((uint8_t*)VGA_MEMORY + j * SCREEN_WIDTH + x1, color, x2 - x1);
+        }
+    }
+}
+
+// Copy `count` pixels into row `y` of the page being drawn, from `x` on;
+// the caller has clipped them. In mode X each plane takes every fourth one.
+void gfx_write_span(int x, int y, const uint8_t* pixels, int count) {
+    if (!mode_x) {
+        memcpy((uint8_t*)VGA_MEMORY + y * SCREEN_WIDTH + x, pixels, count);
+        return;
+    }
+    volatile uint8_t* line = VGA_MEMORY + draw_offset + y * MODEX_STRIDE;
+    for (int i = 0; i < 4 && i < count; i++) {
+        set_map_mask(1 << ((x + i) & 3));
+        for (int j = i; j < count; j += 4) {
+            line[(x + j) >> 2] = pixels[j];
         }
     }
 }
@@ -395,4 +603,41 @@ void draw_string(int x, int y, const char* str, uint8_t color) {
     }
 }
 
+// Draw a glyph with its background filled in, so the 8x8 cell is fully overwritten
+void draw_char_bg(int x, int y, char c, uint8_t color, uint8_t bg) {
+    const uint8_t* glyph = (c >= 32 && c <= 126) ? font_8x8[c - 32] : font_8x8[0];
+    for (int row = 0; row < 8; row++) {
+        if (y + row < 0 || y + row >= screen_h) continue;
+        uint8_t line = glyph[row];
+        for (int col = 0; col < 8; col++) {
+            set_pixel(x + col, y + row, (line & (0x01 << col)) ? color : bg);
+        }
+    }
+}
+
+// Move the band [y, y + height) up by `lines` scanlines with one memmove and
+// fill the exposed rows at the bottom of the band
+void scroll_area_up(int y, int height, int lines, uint8_t fill) {
+    if (y < 0 || height <= 0 || y + height > screen_h) return;
+    if (lines >= height) {
+        fill_rect(0, y, screen_w, height, fill);
+        return;
+    }
+
+    if (mode_x) {
+        // Write mode 1 copies all four planes through the latches, one byte per 4 pixels
+        uint8_t* band = (uint8_t*)VGA_MEMORY + draw_offset + y * MODEX_STRIDE;
+        set_map_mask(0x0F);
+        outb(0x3CE, 0x05); outb(0x3CF, 0x41);
+        for (int i = 0; i < (height - lines) * MODEX_STRIDE; i++) {
+            ((volatile uint8_t*)band)[i] = ((volatile uint8_t*)band)[i + lines * MODEX_STRIDE];
+        }
+        outb(0x3CE, 0x05); outb(0x3CF, 0x40);
+        memset(band + (height - lines) * MODEX_STRIDE, fill, lines * MODEX_STRIDE);
+        return;
+    }
 
+    uint8_t* band = (uint8_t*)VGA_MEMORY + y * SCREEN_WIDTH;
+    memmove(band, band + lines * SCREEN_WIDTH, (height - lines) * SCREEN_WIDTH);
+    memset(band + (height - lines) * SCREEN_WIDTH, fill, lines * SCREEN_WIDTH);
+}
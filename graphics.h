@@ -20,6 +20,11 @@
 #define VGA_YELLOW 14
 #define VGA_WHITE 31
 
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 200
+#define GFX_DEFAULT_FPS 30
+#define GFX_CAPTURE_MAX (320 * 240)   // Bytes gfx_capture() may write, in mode X
+
 void init_graphics();
 void clear_graphics(uint8_t color);
 void draw_string(int x, int y, const char* str, uint8_t color);
@@ -27,9 +32,20 @@ void draw_char(int x, int y, char c, uint8_t color);
 void set_pixel(int x, int y, uint8_t color);
 void switch_to_graphics();
 void switch_to_text();
+void switch_to_modex();
+int graphics_is_modex();
+int graphics_width();
+int graphics_height();
+void gfx_set_frame_rate(int fps);
+void gfx_wait_retrace();
+void gfx_present();
+void gfx_capture(uint8_t* buf);
 void draw_line(int x1, int y1, int x2, int y2, uint8_t color);
 void draw_rect(int x, int y, int width, int height, uint8_t color);
 void fill_rect(int x, int y, int width, int height, uint8_t color);
+void gfx_write_span(int x, int y, const uint8_t* pixels, int count);
+void draw_char_bg(int x, int y, char c, uint8_t color, uint8_t bg);
+void scroll_area_up(int y, int height, int lines, uint8_t fill);
 
 #endif
 
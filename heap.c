@@ -0,0 +1,350 @@
+#include "heap.h"
+#include <stdint.h>
+#include "string.h"
+#include "pmm.h"
+#include "io.h"
+#include "spinlock.h"
+
+#define HEAP_ALIGN 8
+#define MIN_SPLIT 16   // Smallest leftover worth turning into its own free block
+
+// Every allocation is preceded by a header; blocks form one address-ordered list
+typedef struct heap_block {
+    uint32_t size;              // Payload size in bytes
+    uint32_t free;
+    struct heap_block* next;
+    struct heap_block* prev;
+} heap_block_t;
+
+static spinlock_t heap_lock;
+static heap_block_t* heap_head = 0;
+static uint32_t heap_bytes = 0;
+static uint32_t block_allocs = 0;
+static uint32_t block_frees = 0;
+static uint32_t block_in_use = 0;
+
+// Slab pages start with this header; objects follow it
+typedef struct slab {
+    slab_cache_t* cache;
+    struct slab* next;
+    struct slab* prev;
+    void* free_list;            // Free objects link through their first word
+    uint32_t in_use;
+    uint32_t capacity;
+} slab_t;
+
+// kmalloc size classes, smallest first
+static slab_cache_t size_caches[SLAB_CLASSES];
+static const char* size_names[SLAB_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+};
+static slab_cache_t* cache_list = 0;
+static slab_cache_t cache_of_caches;
+
+// One byte per physical frame: 0 for non-slab memory, otherwise the slab's order + 1.
+// kfree uses it to tell slab objects from block allocations.
+static uint8_t* slab_frames = 0;
+static uint32_t slab_frame_count = 0;
+
+// True when `b` starts right where `a` ends, so the two may be merged
+static int adjacent(heap_block_t* a, heap_block_t* b) {
+    return (uint8_t*)(a + 1) + a->size == (uint8_t*)b;
+}
+
+// Merge `block` with the free block that follows it
+static void merge_next(heap_block_t* block) {
+    heap_block_t* next = block->next;
+    block->size += sizeof(heap_block_t) + next->size;
+    block->next = next->next;
+    if (next->next) next->next->prev = block;
+}
+
+// Hand a run of frames to the heap, keeping the block list address ordered
+static int heap_grow(uint32_t order) {
+    uint32_t base = pmm_alloc_pages(order);
+    if (!base) return 0;
+
+    heap_block_t* region = (heap_block_t*)base;
+    region->size = (PAGE_SIZE << order) - sizeof(heap_block_t);
+    region->free = 1;
+    heap_bytes += PAGE_SIZE << order;
+
+    heap_block_t* prev = 0;
+    heap_block_t* next = heap_head;
+    while (next && next < region) {
+        prev = next;
+        next = next->next;
+    }
+    region->prev = prev;
+    region->next = next;
+    if (next) next->prev = region;
+    if (prev) prev->next = region;
+    else heap_head = region;
+
+    if (next && next->free && adjacent(region, next)) merge_next(region);
+    if (prev && prev->free && adjacent(prev, region)) merge_next(prev);
+    return 1;
+}
+
+static void cache_setup(slab_cache_t* cache, const char* name, uint32_t size) {
+    cache->name = name;
+    cache->obj_size = (size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+    if (cache->obj_size < sizeof(void*)) cache->obj_size = sizeof(void*);
+
+    // Smallest slab that still holds SLAB_MIN_OBJECTS, so big classes don't waste a page each
+    cache->order = 0;
+    while (cache->order < PMM_MAX_ORDER &&
+           ((PAGE_SIZE << cache->order) - sizeof(slab_t)) / cache->obj_size < SLAB_MIN_OBJECTS) {
+        cache->order++;
+    }
+    cache->partial = cache->full = 0;
+    cache->pages = cache->in_use = cache->allocs = cache->frees = 0;
+    cache->next = cache_list;
+    cache_list = cache;
+}
+
+void heap_init() {
+    heap_head = 0;
+    heap_bytes = 0;
+    heap_grow(HEAP_INITIAL_ORDER);
+
+    slab_frame_count = pmm_highest_address() >> PAGE_SHIFT;
+    slab_frames = (uint8_t*)pmm_alloc_pages(pmm_order_for(slab_frame_count));
+    if (slab_frames) memset(slab_frames, 0, slab_frame_count);
+
+    cache_list = 0;
+    cache_setup(&cache_of_caches, "slab-cache", sizeof(slab_cache_t));
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        cache_setup(&size_caches[i], size_names[i], SLAB_MIN_SIZE << i);
+    }
+}
+
+uint32_t heap_size() {
+    return heap_bytes;
+}
+
+// First fit over the block list
+static void* heap_alloc_fit(uint32_t size) {
+    for (heap_block_t* block = heap_head; block; block = block->next) {
+        if (!block->free || block->size < size) continue;
+
+        if (block->size >= size + sizeof(heap_block_t) + MIN_SPLIT) {
+            heap_block_t* rest = (heap_block_t*)((uint8_t*)(block + 1) + size);
+            rest->size = block->size - size - sizeof(heap_block_t);
+            rest->free = 1;
+            rest->next = block->next;
+            rest->prev = block;
+            if (block->next) block->next->prev = rest;
+            block->next = rest;
+            block->size = size;
+        }
+        block->free = 0;
+        return block + 1;
+    }
+    return 0;
+}
+
+static void* block_alloc(uint32_t size) {
+    size = (size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+
+    void* ptr = heap_alloc_fit(size);
+    if (!ptr) {
+        // Out of room: pull at least HEAP_GROW_ORDER more pages from the frame allocator
+        uint32_t order = pmm_order_for(size + sizeof(heap_block_t));
+        if (order < HEAP_GROW_ORDER) order = HEAP_GROW_ORDER;
+        if (!heap_grow(order)) return 0;
+        ptr = heap_alloc_fit(size);
+        if (!ptr) return 0;
+    }
+    block_allocs++;
+    block_in_use += ((heap_block_t*)ptr - 1)->size;
+    return ptr;
+}
+
+static void list_unlink(slab_t** head, slab_t* slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static void list_push(slab_t** head, slab_t* slab) {
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+// Carve a fresh slab into a free list of objects
+static slab_t* slab_create(slab_cache_t* cache) {
+    uint32_t base = pmm_alloc_pages(cache->order);
+    if (!base) return 0;
+
+    uint32_t pages = 1u << cache->order;
+    uint32_t frame = base >> PAGE_SHIFT;
+    for (uint32_t i = 0; i < pages && frame + i < slab_frame_count; i++) {
+        slab_frames[frame + i] = cache->order + 1;
+    }
+
+    slab_t* slab = (slab_t*)base;
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->capacity = ((PAGE_SIZE << cache->order) - sizeof(slab_t)) / cache->obj_size;
+    slab->free_list = 0;
+    uint8_t* objects = (uint8_t*)(slab + 1);
+    for (int i = slab->capacity - 1; i >= 0; i--) {
+        void** obj = (void**)(objects + i * cache->obj_size);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+    cache->pages += pages;
+    return slab;
+}
+
+static void slab_destroy(slab_t* slab) {
+    slab_cache_t* cache = slab->cache;
+    uint32_t pages = 1u << cache->order;
+    uint32_t frame = (uint32_t)slab >> PAGE_SHIFT;
+    for (uint32_t i = 0; i < pages && frame + i < slab_frame_count; i++) {
+        slab_frames[frame + i] = 0;
+    }
+    cache->pages -= pages;
+    pmm_free_pages((uint32_t)slab);
+}
+
+// The *_locked helpers expect heap_lock held; the public entry points below
+// take it with interrupts off so every CPU and interrupt handler can share the heap
+static void* slab_alloc_locked(slab_cache_t* cache) {
+    if (!slab_frames) return 0;
+
+    slab_t* slab = cache->partial;
+    if (!slab) {
+        slab = slab_create(cache);
+        if (!slab) return 0;
+        list_push(&cache->partial, slab);
+    }
+
+    void** obj = (void**)slab->free_list;
+    slab->free_list = *obj;
+    slab->in_use++;
+    if (!slab->free_list) {
+        list_unlink(&cache->partial, slab);
+        list_push(&cache->full, slab);
+    }
+    cache->in_use++;
+    cache->allocs++;
+    return obj;
+}
+
+// Slab header for an object, found by rounding down to the slab's natural alignment
+static slab_t* slab_of(void* ptr) {
+    uint32_t frame = (uint32_t)ptr >> PAGE_SHIFT;
+    if (!slab_frames || frame >= slab_frame_count || !slab_frames[frame]) return 0;
+    uint32_t bytes = PAGE_SIZE << (slab_frames[frame] - 1);
+    return (slab_t*)((uint32_t)ptr & ~(bytes - 1));
+}
+
+static void slab_free_locked(slab_cache_t* cache, void* ptr) {
+    slab_t* slab = slab_of(ptr);
+    if (!slab || slab->cache != cache) return;
+
+    if (!slab->free_list) {
+        list_unlink(&cache->full, slab);
+        list_push(&cache->partial, slab);
+    }
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->in_use--;
+    cache->in_use--;
+    cache->frees++;
+
+    // Keep one empty slab around so an alloc/free pair does not thrash the frame allocator
+    if (slab->in_use == 0 && (slab->next || slab->prev)) {
+        list_unlink(&cache->partial, slab);
+        slab_destroy(slab);
+    }
+}
+
+static slab_cache_t* cache_for(uint32_t size) {
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        if (size <= size_caches[i].obj_size) return &size_caches[i];
+    }
+    return 0;
+}
+
+slab_cache_t* slab_cache_create(const char* name, uint32_t size) {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    slab_cache_t* cache = (slab_cache_t*)slab_alloc_locked(&cache_of_caches);
+    if (cache) cache_setup(cache, name, size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return cache;
+}
+
+void* slab_alloc(slab_cache_t* cache) {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = slab_alloc_locked(cache);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+void slab_free(slab_cache_t* cache, void* ptr) {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    slab_free_locked(cache, ptr);
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+void* kmalloc(uint32_t size) {
+    if (size == 0) return 0;
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = 0;
+    slab_cache_t* cache = cache_for(size);
+    if (cache) ptr = slab_alloc_locked(cache);
+    if (!ptr) ptr = block_alloc(size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+void kfree(void* ptr) {
+    if (!ptr) return;
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    slab_t* slab = slab_of(ptr);
+    if (slab) {
+        slab_free_locked(slab->cache, ptr);
+        spin_unlock_irqrestore(&heap_lock, flags);
+        return;
+    }
+
+    heap_block_t* block = (heap_block_t*)ptr - 1;
+    block_frees++;
+    block_in_use -= block->size;
+    block->free = 1;
+    if (block->next && block->next->free && adjacent(block, block->next)) merge_next(block);
+    if (block->prev && block->prev->free && adjacent(block->prev, block)) merge_next(block->prev);
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+void* krealloc(void* ptr, uint32_t size) {
+    if (!ptr) return kmalloc(size);
+
+    slab_t* slab = slab_of(ptr);
+    uint32_t old_size = slab ? slab->cache->obj_size : ((heap_block_t*)ptr - 1)->size;
+    if (old_size >= size) return ptr;
+
+    void* bigger = kmalloc(size);
+    if (!bigger) return 0;
+    memcpy(bigger, ptr, old_size);
+    kfree(ptr);
+    return bigger;
+}
+
+slab_cache_t* slab_cache_first() {
+    return cache_list;
+}
+
+void heap_block_stats(uint32_t* allocs, uint32_t* frees, uint32_t* in_use) {
+    *allocs = block_allocs;
+    *frees = block_frees;
+    *in_use = block_in_use;
+}
@@ -0,0 +1,41 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+
+#define HEAP_INITIAL_ORDER 9     // 2 MB taken from the frame allocator at boot
+#define HEAP_GROW_ORDER 8        // Grow by at least 1 MB when a request does not fit
+
+#define SLAB_MIN_SIZE 16          // kmalloc size classes run 16..1024 bytes
+#define SLAB_CLASSES 7
+#define SLAB_MIN_OBJECTS 8        // A slab grows past one page until it holds this many
+
+// Cache of equally sized objects carved out of slabs of 2^order pages
+typedef struct slab_cache {
+    const char* name;
+    uint32_t obj_size;
+    uint32_t order;
+    struct slab* partial;         // Slabs with at least one free object
+    struct slab* full;
+    uint32_t pages;
+    uint32_t in_use;
+    uint32_t allocs;
+    uint32_t frees;
+    struct slab_cache* next;
+} slab_cache_t;
+
+void heap_init();
+void* kmalloc(uint32_t size);
+void kfree(void* ptr);
+void* krealloc(void* ptr, uint32_t size);
+uint32_t heap_size();
+
+slab_cache_t* slab_cache_create(const char* name, uint32_t size);
+void* slab_alloc(slab_cache_t* cache);
+void slab_free(slab_cache_t* cache, void* ptr);
+
+// Statistics
+slab_cache_t* slab_cache_first();
+void heap_block_stats(uint32_t* allocs, uint32_t* frees, uint32_t* in_use);
+
+#endif
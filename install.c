@@ -55,9 +55,9 @@ void install_os_to_disk() {
     
     draw_string(10, 90, "Setting up filesystem...", VGA_CYAN);
     
-    // Initialize filesystem on the partition
-    file_entry_t empty_fat[MAX_FILES] = {0};
-    write_sector(2048, (uint8_t*)empty_fat);
+    // Initialize filesystem on the partition; only the first sector of the table is written
+    static uint8_t empty_fat[512];
+    write_sector(2048, empty_fat);
     
     draw_string(10, 110, "Graphics OS partition created!", VGA_GREEN);
     draw_string(10, 130, "Run: grub-install --target=i386-pc", VGA_WHITE);
@@ -0,0 +1,311 @@
+#include "interrupts.h"
+#include <stdint.h>
+#include "io.h"
+#include "console.h"
+#include "graphics.h"
+#include "paging.h"
+#include "pmm.h"
+#include "thread.h"
+#include "apic.h"
+#include "smp.h"
+#include "string.h"
+
+#define IDT_ENTRIES 256
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+#define KERNEL_CODE_SELECTOR 0x08
+#define KERNEL_DATA_SELECTOR 0x10
+#define KERNEL_TSS_SELECTOR 0x18
+#define FAULT_TSS_SELECTOR 0x20
+#define AP_TSS_SELECTOR 0x28        // One slot per application processor from here
+#define AP_FAULT_TSS_SELECTOR (AP_TSS_SELECTOR + (MAX_CPUS - 1) * 8)   // And their fault TSSes
+#define ISR_STUBS 51
+#define VECTOR_DOUBLE_FAULT 8
+#define VECTOR_PAGE_FAULT 14
+#define FAULT_STACK_SIZE 4096
+
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type_attr;
+    uint16_t offset_high;
+} __attribute__((packed)) idt_entry_t;
+
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) idt_pointer_t;
+
+// 32-bit task state segment. Only used so a double fault can switch to a
+// known-good stack: a kernel stack overflow cannot push an exception frame.
+// Each CPU needs its own, since loading one marks it busy; so does the
+// double fault task, or two CPUs faulting at once would share one.
+typedef struct {
+    uint32_t prev_task;
+    uint32_t esp0, ss0, esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs, ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+extern uint32_t isr_stub_table[];
+extern uint8_t isr_spurious[];
+extern uint64_t gdt_start[];
+
+static tss_t cpu_tss[MAX_CPUS];
+static tss_t fault_tss[MAX_CPUS];
+static uint8_t fault_stack[MAX_CPUS][FAULT_STACK_SIZE] __attribute__((aligned(16)));
+
+// The BSP's IDT; each application processor has a copy whose double fault
+// gate names its own fault TSS
+static idt_entry_t idt[IDT_ENTRIES];
+static idt_entry_t ap_idt[MAX_CPUS - 1][IDT_ENTRIES];
+static irq_handler_t irq_handlers[16];
+
+static const char* exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow", "Bound range",
+    "Invalid opcode", "Device not available", "Double fault", "Coprocessor overrun",
+    "Invalid TSS", "Segment not present", "Stack fault", "General protection",
+    "Page fault", "Reserved", "x87 error", "Alignment check", "Machine check",
+    "SIMD error", "Virtualization", "Control protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved", "Hypervisor injection",
+    "VMM communication", "Security", "Reserved"
+};
+
+static void idt_set_gate(int vector, uint32_t handler) {
+    idt[vector].offset_low = handler & 0xFFFF;
+    idt[vector].selector = KERNEL_CODE_SELECTOR;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = 0x8E;   // Present, ring 0, 32-bit interrupt gate
+    idt[vector].offset_high = (handler >> 16) & 0xFFFF;
+}
+
+static void gdt_set_tss(int selector, tss_t* tss) {
+    uint32_t base = (uint32_t)tss;
+    uint32_t limit = sizeof(tss_t) - 1;
+    gdt_start[selector >> 3] =
+        (uint64_t)(limit & 0xFFFF) |
+        ((uint64_t)(base & 0xFFFFFF) << 16) |
+        ((uint64_t)0x89 << 40) |                  // Present, ring 0, available 32-bit TSS
+        ((uint64_t)((limit >> 16) & 0xF) << 48) |
+        ((uint64_t)(base >> 24) << 56);
+}
+
+static void hex_string(uint32_t value, char* out);
+
+static int tss_selector(int cpu) {
+    return cpu == 0 ? KERNEL_TSS_SELECTOR : AP_TSS_SELECTOR + (cpu - 1) * 8;
+}
+
+static int fault_tss_selector(int cpu) {
+    return cpu == 0 ? FAULT_TSS_SELECTOR : AP_FAULT_TSS_SELECTOR + (cpu - 1) * 8;
+}
+
+// Runs as the faulting CPU's own fault task, on its fault_stack; the
+// faulting state is in that CPU's TSS
+static void double_fault_task() {
+    char hex[11];
+    uint16_t task;
+    __asm__ volatile ("str %0" : "=r"(task));
+    tss_t* kernel_tss = &cpu_tss[0];
+    for (int i = 0; i < MAX_CPUS; i++) {
+        if (task == fault_tss_selector(i)) kernel_tss = &cpu_tss[i];
+    }
+    console_panic();
+    console_write("\nEXCEPTION: Double fault\n", VGA_LIGHT_RED);
+    if (paging_is_stack_guard(kernel_tss->esp) || paging_is_stack_guard(kernel_tss->esp - 4)) {
+        console_write(" kernel stack overflow\n", VGA_LIGHT_RED);
+    }
+    console_write(" eip ", VGA_LIGHT_RED);
+    hex_string(kernel_tss->eip, hex);
+    console_write(hex, VGA_LIGHT_RED);
+    console_write(" esp ", VGA_LIGHT_RED);
+    hex_string(kernel_tss->esp, hex);
+    console_write(hex, VGA_LIGHT_RED);
+    console_write("\nSystem halted.\n", VGA_LIGHT_RED);
+    while (1) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
+
+// Task gate: the CPU switches to its fault TSS instead of pushing onto the broken stack
+static void fault_tss_init(int cpu, idt_entry_t* table) {
+    uint32_t cr3;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+
+    tss_t* tss = &fault_tss[cpu];
+    tss->cr3 = cr3;
+    tss->eip = (uint32_t)double_fault_task;
+    tss->eflags = 0x2;                          // Interrupts off
+    tss->esp = (uint32_t)(fault_stack[cpu] + FAULT_STACK_SIZE);
+    tss->cs = KERNEL_CODE_SELECTOR;
+    tss->ds = tss->es = tss->fs = tss->gs = tss->ss = KERNEL_DATA_SELECTOR;
+    tss->iomap_base = sizeof(tss_t);
+    gdt_set_tss(fault_tss_selector(cpu), tss);
+
+    table[VECTOR_DOUBLE_FAULT].offset_low = 0;
+    table[VECTOR_DOUBLE_FAULT].selector = fault_tss_selector(cpu);
+    table[VECTOR_DOUBLE_FAULT].zero = 0;
+    table[VECTOR_DOUBLE_FAULT].type_attr = 0x85;
+    table[VECTOR_DOUBLE_FAULT].offset_high = 0;
+}
+
+static void tss_init() {
+    cpu_tss[0].iomap_base = sizeof(tss_t);
+    gdt_set_tss(KERNEL_TSS_SELECTOR, &cpu_tss[0]);
+    __asm__ volatile ("ltr %0" : : "r"((uint16_t)KERNEL_TSS_SELECTOR));
+    fault_tss_init(0, idt);
+}
+
+// Move the PICs off the CPU exception vectors and mask every line
+static void pic_remap() {
+    outb(PIC1_COMMAND, 0x11); io_wait();   // ICW1: init, expect ICW4
+    outb(PIC2_COMMAND, 0x11); io_wait();
+    outb(PIC1_DATA, IRQ_BASE); io_wait();       // ICW2: vector offsets
+    outb(PIC2_DATA, IRQ_BASE + 8); io_wait();
+    outb(PIC1_DATA, 0x04); io_wait();      // ICW3: slave on IRQ2
+    outb(PIC2_DATA, 0x02); io_wait();
+    outb(PIC1_DATA, 0x01); io_wait();      // ICW4: 8086 mode
+    outb(PIC2_DATA, 0x01); io_wait();
+
+    outb(PIC1_DATA, 0xFF & ~(1 << 2));     // Everything masked except the cascade
+    outb(PIC2_DATA, 0xFF);
+}
+
+static void load_idt(idt_entry_t* table) {
+    idt_pointer_t pointer;
+    pointer.limit = sizeof(idt) - 1;
+    pointer.base = (uint32_t)table;
+    __asm__ volatile ("lidt %0" : : "m"(pointer));
+}
+
+void interrupts_init() {
+    for (int i = 0; i < ISR_STUBS; i++) {
+        idt_set_gate(i, isr_stub_table[i]);
+    }
+    idt_set_gate(VECTOR_SPURIOUS, (uint32_t)isr_spurious);
+    tss_init();
+    load_idt(idt);
+    pic_remap();
+}
+
+// Every CPU has its own TSS and double fault task, so its own IDT too
+void interrupts_init_cpu(int cpu) {
+    idt_entry_t* table = ap_idt[cpu - 1];
+    memcpy(table, idt, sizeof(idt));
+    fault_tss_init(cpu, table);
+    load_idt(table);
+    cpu_tss[cpu].iomap_base = sizeof(tss_t);
+    gdt_set_tss(tss_selector(cpu), &cpu_tss[cpu]);
+    __asm__ volatile ("ltr %0" : : "r"((uint16_t)tss_selector(cpu)));
+}
+
+void irq_install_handler(int irq, irq_handler_t handler) {
+    irq_handlers[irq] = handler;
+    irq_unmask(irq);
+}
+
+void irq_unmask(int irq) {
+    if (apic_active()) {
+        ioapic_mask(irq, 0);
+        return;
+    }
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+void irq_mask(int irq) {
+    if (apic_active()) {
+        ioapic_mask(irq, 1);
+        return;
+    }
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+// IRQ 7 and 15 can fire spuriously; the PIC's in-service register tells
+static int irq_is_spurious(int irq) {
+    if (irq != 7 && irq != 15) return 0;
+    uint16_t port = irq == 7 ? PIC1_COMMAND : PIC2_COMMAND;
+    outb(port, 0x0B);   // Read ISR
+    if (inb(port) & 0x80) return 0;
+    if (irq == 15) outb(PIC1_COMMAND, PIC_EOI);   // The master still saw the cascade
+    return 1;
+}
+
+static void hex_string(uint32_t value, char* out) {
+    const char* digits = "0123456789ABCDEF";
+    out[0] = '0';
+    out[1] = 'x';
+    for (int i = 0; i < 8; i++) {
+        out[2 + i] = digits[(value >> (28 - i * 4)) & 0xF];
+    }
+    out[10] = '\0';
+}
+
+static void exception_panic(interrupt_frame_t* frame) {
+    char hex[11];
+    console_panic();
+    console_write("\nEXCEPTION: ", VGA_LIGHT_RED);
+    console_write(exception_names[frame->vector], VGA_LIGHT_RED);
+    console_write("\n eip ", VGA_LIGHT_RED);
+    hex_string(frame->eip, hex);
+    console_write(hex, VGA_LIGHT_RED);
+    console_write(" err ", VGA_LIGHT_RED);
+    hex_string(frame->error_code, hex);
+    console_write(hex, VGA_LIGHT_RED);
+    if (frame->vector == VECTOR_PAGE_FAULT) {
+        uint32_t cr2;
+        __asm__ volatile ("mov %%cr2, %0" : "=r"(cr2));
+        console_write(" addr ", VGA_LIGHT_RED);
+        hex_string(cr2, hex);
+        console_write(hex, VGA_LIGHT_RED);
+        if (paging_is_stack_guard(cr2)) console_write("\n kernel stack overflow", VGA_LIGHT_RED);
+        else if (cr2 < PAGE_SIZE) console_write("\n null pointer", VGA_LIGHT_RED);
+    }
+    console_write("\nSystem halted.\n", VGA_LIGHT_RED);
+    while (1) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
+
+void interrupt_dispatch(interrupt_frame_t* frame) {
+    if (frame->vector < IRQ_BASE) {
+        exception_panic(frame);
+    }
+
+    // Acknowledge first so a handler that switches stacks doesn't leave the line blocked
+    if (frame->vector == VECTOR_LAPIC_TIMER || frame->vector == VECTOR_RESCHEDULE) {
+        lapic_eoi();
+        if (frame->vector == VECTOR_LAPIC_TIMER) thread_cpu_tick();
+        else thread_reschedule_ipi();
+        thread_preempt_check();
+        return;
+    }
+    if (frame->vector == VECTOR_TLB_FLUSH) {
+        lapic_eoi();
+        paging_tlb_ipi();
+        return;
+    }
+
+    int irq = frame->vector - IRQ_BASE;
+    if (irq < 0 || irq >= 16) return;
+    if (apic_active()) {
+        lapic_eoi();
+    } else {
+        if (irq_is_spurious(irq)) return;
+        if (irq >= 8) outb(PIC2_COMMAND, PIC_EOI);
+        outb(PIC1_COMMAND, PIC_EOI);
+    }
+
+    if (irq_handlers[irq]) {
+        irq_handlers[irq](frame);
+    }
+    thread_preempt_check();
+}
@@ -0,0 +1,27 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+
+#include <stdint.h>
+
+#define IRQ_BASE 32        // PIC IRQs are remapped above the CPU exceptions
+#define IRQ_TIMER 0
+#define IRQ_KEYBOARD 1
+
+// Stack layout built by the stubs in kernel_entry.asm
+typedef struct {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;   // pusha
+    uint32_t vector;
+    uint32_t error_code;
+    uint32_t eip, cs, eflags;                          // Pushed by the CPU
+} interrupt_frame_t;
+
+typedef void (*irq_handler_t)(interrupt_frame_t* frame);
+
+void interrupts_init();
+void interrupts_init_cpu(int cpu);     // Per-CPU part, for application processors
+void irq_install_handler(int irq, irq_handler_t handler);
+void irq_unmask(int irq);
+void irq_mask(int irq);
+void interrupt_dispatch(interrupt_frame_t* frame);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// Short delay for old devices (e.g. the 8259) that need time between port writes
+static inline void io_wait() {
+    outb(0x80, 0);
+}
+
+static inline void interrupts_enable() {
+    __asm__ volatile ("sti");
+}
+
+static inline void interrupts_disable() {
+    __asm__ volatile ("cli");
+}
+
+// Disable interrupts and return the previous EFLAGS so they can be restored
+static inline uint32_t irq_save() {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    __asm__ volatile ("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif
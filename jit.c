@@ -0,0 +1,588 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "jit.h"
+#include "script.h"
+#include "vars.h"
+#include "arena.h"
+#include "graphics.h"
+#include "string.h"
+#include "thread.h"
+#include "dlist.h"
+
+// Template JIT for script loops. Each bytecode op becomes a fixed i386
+// sequence; the VM stack is the machine stack. The outermost loop keeps its
+// counter in EBX, its limit in ESI and its variable in EDI (callee-saved, so
+// they survive the calls into graphics), and stores them back on the way
+// out. Code goes in the script's arena: pages are identity mapped and
+// non-PAE paging has no no-execute bit.
+
+#define MAX_WRITTEN 16             // Distinct variables a compiled loop may assign
+
+enum { STATE_NEW, STATE_COMPILED, STATE_REJECTED };
+
+enum { EAX = 0, EBX = 3, ESI = 6, EDI = 7 };
+
+// What the compiled loop returns
+enum { NATIVE_FINISHED, NATIVE_STOPPED, NATIVE_DECLINED };
+
+typedef int (*native_loop_t)(void);
+
+typedef struct {
+    script_t* s;
+    uint8_t* out;                  // 0 while measuring
+    uint32_t len;
+    uint32_t first;                // Code offset of the loop's OP_ENTER
+    uint32_t* offsets;             // Machine code offset of each bytecode word, from measuring
+    int32_t counter;
+    int32_t limit;
+    int32_t var;
+    int32_t written[MAX_WRITTEN];
+    int written_count;
+    uint32_t top;                  // Labels, found while measuring
+    uint32_t exit;
+    uint32_t abort;
+    uint32_t skip;
+    uint32_t decline;
+    uint32_t out_label;
+} jit_t;
+
+static int mode = JIT_ON;
+static jit_stats_t stats;
+
+void jit_set_mode(int new_mode) {
+    mode = new_mode;
+}
+
+int jit_mode() {
+    return mode;
+}
+
+const jit_stats_t* jit_stats() {
+    return &stats;
+}
+
+static void byte(jit_t* j, uint8_t value) {
+    if (j->out) j->out[j->len] = value;
+    j->len++;
+}
+
+static void dword(jit_t* j, uint32_t value) {
+    for (int i = 0; i < 4; i++) byte(j, value >> (i * 8));
+}
+
+// rel32 to an offset inside the loop's code
+static void rel(jit_t* j, uint32_t target) {
+    dword(j, target - (j->len + 4));
+}
+
+static void call(jit_t* j, void* fn) {
+    byte(j, 0xE8);
+    dword(j, (uint32_t)fn - ((uint32_t)j->out + j->len + 4));
+}
+
+static void jump(jit_t* j, uint32_t target) {
+    byte(j, 0xE9);
+    rel(j, target);
+}
+
+// jcc rel32; `cc` is the low nibble of the 0F 8x opcode
+static void jump_if(jit_t* j, uint8_t cc, uint32_t target) {
+    byte(j, 0x0F);
+    byte(j, 0x80 | cc);
+    rel(j, target);
+}
+
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+#define CC_L 0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G 0xF
+
+static uint32_t value_addr(jit_t* j, int32_t slot) {
+    return (uint32_t)&j->s->vars[slot]->value;
+}
+
+static uint32_t type_addr(jit_t* j, int32_t slot) {
+    return (uint32_t)&j->s->vars[slot]->type;
+}
+
+static int reg_of(jit_t* j, int32_t slot) {
+    if (slot == j->counter) return EBX;
+    if (slot == j->limit) return ESI;
+    if (slot == j->var) return EDI;
+    return -1;
+}
+
+// mov [value], eax and mark the variable as an integer
+static void store_eax(jit_t* j, int32_t slot) {
+    int reg = reg_of(j, slot);
+    if (reg >= 0) {
+        byte(j, 0x89);                   // mov reg, eax
+        byte(j, 0xC0 | reg);
+        return;
+    }
+    byte(j, 0xA3);
+    dword(j, value_addr(j, slot));
+    byte(j, 0xC6);                       // mov byte [type], VAR_INT
+    byte(j, 0x05);
+    dword(j, type_addr(j, slot));
+    byte(j, VAR_INT);
+}
+
+static void load_eax(jit_t* j, int32_t slot) {
+    int reg = reg_of(j, slot);
+    if (reg >= 0) {
+        byte(j, 0x89);                   // mov eax, reg
+        byte(j, 0xC0 | (reg << 3));
+        return;
+    }
+    byte(j, 0xA1);
+    dword(j, value_addr(j, slot));
+}
+
+static void push_slot(jit_t* j, int32_t slot) {
+    int reg = reg_of(j, slot);
+    if (reg >= 0) {
+        byte(j, 0x50 + reg);
+        return;
+    }
+    byte(j, 0xFF);                       // push dword [value]
+    byte(j, 0x35);
+    dword(j, value_addr(j, slot));
+}
+
+// The arguments are on the stack first to last; cdecl wants them the other
+// way round, so push copies: the k-th from the top is at [esp + 8k] by then
+static void call_reversed(jit_t* j, void* fn, int count) {
+    for (int k = 0; k < count; k++) {
+        byte(j, 0xFF);                   // push dword [esp + 8k]
+        byte(j, 0x74);
+        byte(j, 0x24);
+        byte(j, 8 * k);
+    }
+    call(j, fn);
+}
+
+static void drop(jit_t* j, int words) {
+    byte(j, 0x83);                       // add esp, 4 * words
+    byte(j, 0xC4);
+    byte(j, 4 * words);
+}
+
+// The iteration check shared by every OP_NEXT and OP_FRAME: leave through
+// `abort` when the thread is being stopped
+static void check_stop(jit_t* j) {
+    byte(j, 0x68);                       // push script
+    dword(j, (uint32_t)j->s);
+    call(j, (void*)script_next_iteration);
+    drop(j, 1);
+    byte(j, 0x85);                       // test eax, eax
+    byte(j, 0xC0);
+    jump_if(j, CC_NE, j->abort);
+}
+
+// A while-loop's jump back only checks for Ctrl+C; it isn't a frame
+static void check_cancel(jit_t* j) {
+    call(j, (void*)thread_should_stop);
+    byte(j, 0x85);                       // test eax, eax
+    byte(j, 0xC0);
+    jump_if(j, CC_NE, j->abort);
+}
+
+// Pop the right operand into eax and compare the left one, at [esp], with it
+static void compare(jit_t* j, uint8_t cc) {
+    byte(j, 0x58);                       // pop eax
+    byte(j, 0x39);                       // cmp [esp], eax
+    byte(j, 0x04);
+    byte(j, 0x24);
+    byte(j, 0x0F);                       // setcc al
+    byte(j, 0x90 | cc);
+    byte(j, 0xC0);
+    byte(j, 0x0F);                       // movzx eax, al
+    byte(j, 0xB6);
+    byte(j, 0xC0);
+    byte(j, 0x89);                       // mov [esp], eax
+    byte(j, 0x04);
+    byte(j, 0x24);
+}
+
+// Division goes through the VM's helpers, which don't trap
+static void divide(jit_t* j, void* fn) {
+    call_reversed(j, fn, 2);
+    drop(j, 4);
+    byte(j, 0x50);                       // push eax
+}
+
+static int op_words(int32_t op) {
+    switch (op) {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_AND:
+    case OP_OR:
+    case OP_EQ:
+    case OP_NE:
+    case OP_LT:
+    case OP_GT:
+    case OP_LE:
+    case OP_GE:
+    case OP_NEG:
+    case OP_RECT:
+    case OP_CUBE:
+    case OP_FPS:
+    case OP_FRAME:
+        return 1;
+    case OP_PUSH:
+    case OP_LOAD:
+    case OP_STORE:
+    case OP_JUMP:
+    case OP_JUMP_FALSE:
+    case OP_LOOP:
+    case OP_ENTER:
+        return 2;
+    case OP_ADD_IMM:
+    case OP_COPY:
+    case OP_NEXT:
+        return 3;
+    case OP_LOOP_TEST:
+        return 4;
+    default:
+        return 0;                        // Text, printing, calls, mode switches, the line interpreter
+    }
+}
+
+static void emit_op(jit_t* j, int32_t* ip) {
+    switch (ip[0]) {
+    case OP_PUSH:
+        byte(j, 0x68);
+        dword(j, ip[1]);
+        break;
+    case OP_LOAD:
+        push_slot(j, ip[1]);
+        break;
+    case OP_STORE:
+        byte(j, 0x58);                   // pop eax
+        store_eax(j, ip[1]);
+        break;
+    case OP_ADD:
+    case OP_SUB:
+        byte(j, 0x58);                   // pop eax
+        byte(j, ip[0] == OP_ADD ? 0x01 : 0x29);   // add/sub [esp], eax
+        byte(j, 0x04);
+        byte(j, 0x24);
+        break;
+    case OP_MUL:
+        byte(j, 0x58);                   // pop eax
+        byte(j, 0x0F);                   // imul eax, [esp]
+        byte(j, 0xAF);
+        byte(j, 0x04);
+        byte(j, 0x24);
+        byte(j, 0x89);                   // mov [esp], eax
+        byte(j, 0x04);
+        byte(j, 0x24);
+        break;
+    case OP_DIV:
+        divide(j, (void*)script_div);
+        break;
+    case OP_MOD:
+        divide(j, (void*)script_mod);
+        break;
+    case OP_SHL:
+    case OP_SHR:
+        byte(j, 0x59);                   // pop ecx
+        byte(j, 0xD3);                   // shl/sar dword [esp], cl
+        byte(j, ip[0] == OP_SHL ? 0x24 : 0x3C);
+        byte(j, 0x24);
+        break;
+    case OP_AND:
+    case OP_OR:
+        byte(j, 0x58);                   // pop eax
+        byte(j, ip[0] == OP_AND ? 0x21 : 0x09);   // and/or [esp], eax
+        byte(j, 0x04);
+        byte(j, 0x24);
+        break;
+    case OP_EQ:
+        compare(j, CC_E);
+        break;
+    case OP_NE:
+        compare(j, CC_NE);
+        break;
+    case OP_LT:
+        compare(j, CC_L);
+        break;
+    case OP_GT:
+        compare(j, CC_G);
+        break;
+    case OP_LE:
+        compare(j, CC_LE);
+        break;
+    case OP_GE:
+        compare(j, CC_GE);
+        break;
+    case OP_NEG:
+        byte(j, 0xF7);                   // neg dword [esp]
+        byte(j, 0x1C);
+        byte(j, 0x24);
+        break;
+    case OP_JUMP:
+        jump(j, j->offsets[ip[1] - j->first]);
+        break;
+    case OP_JUMP_FALSE:
+        byte(j, 0x58);                   // pop eax
+        byte(j, 0x85);                   // test eax, eax
+        byte(j, 0xC0);
+        jump_if(j, CC_E, j->offsets[ip[1] - j->first]);
+        break;
+    case OP_LOOP:
+        check_cancel(j);
+        jump(j, j->offsets[ip[1] - j->first]);
+        break;
+    case OP_ADD_IMM:
+        if (reg_of(j, ip[1]) >= 0) {
+            byte(j, 0x81);               // add reg, imm32
+            byte(j, 0xC0 | reg_of(j, ip[1]));
+            dword(j, ip[2]);
+            return;
+        }
+        byte(j, 0x81);                   // add dword [value], imm32
+        byte(j, 0x05);
+        dword(j, value_addr(j, ip[1]));
+        dword(j, ip[2]);
+        byte(j, 0xC6);
+        byte(j, 0x05);
+        dword(j, type_addr(j, ip[1]));
+        byte(j, VAR_INT);
+        break;
+    case OP_COPY:
+        load_eax(j, ip[2]);
+        store_eax(j, ip[1]);
+        break;
+    case OP_ENTER:
+        break;                           // Inner loops are compiled along with this one
+    case OP_LOOP_TEST:
+        load_eax(j, ip[1]);
+        byte(j, 0x3B);                   // cmp eax, [limit]
+        byte(j, 0x05);
+        dword(j, value_addr(j, ip[2]));
+        jump_if(j, CC_G, j->offsets[ip[3] - j->first]);
+        break;
+    case OP_NEXT:
+        check_stop(j);
+        byte(j, 0xFF);                   // inc dword [counter]
+        byte(j, 0x05);
+        dword(j, value_addr(j, ip[1]));
+        jump(j, j->offsets[ip[2] - j->first]);
+        break;
+    case OP_RECT:
+        byte(j, 0x81);                   // cmp dword [esp], 0xFF
+        byte(j, 0x3C);
+        byte(j, 0x24);
+        dword(j, 0xFF);
+        byte(j, 0x0F);                   // ja past the call
+        byte(j, 0x80 | CC_A);
+        dword(j, 5 * 4 + 5 + 3);
+        call_reversed(j, (void*)dlist_rect, 5);
+        drop(j, 5);
+        drop(j, 5);
+        break;
+    case OP_CUBE:
+        byte(j, 0x81);                   // cmp dword [esp + 8], 0xFF (the face color)
+        byte(j, 0x7C);
+        byte(j, 0x24);
+        byte(j, 0x08);
+        dword(j, 0xFF);
+        byte(j, 0x0F);
+        byte(j, 0x80 | CC_A);
+        dword(j, 7 * 4 + 5 + 3);
+        call_reversed(j, (void*)dlist_cube, 7);
+        drop(j, 7);
+        drop(j, 7);
+        break;
+    case OP_FPS:
+        call(j, (void*)gfx_set_frame_rate);
+        drop(j, 1);
+        break;
+    case OP_FRAME:
+        check_stop(j);                   // Same as the end of an iteration
+        break;
+    }
+}
+
+// Check the loop only uses ops the JIT has templates for, and note the
+// variables it assigns outside the registers
+static int scan_loop(jit_t* j, script_loop_t* loop) {
+    int32_t* code = j->s->code;
+    int32_t* test = code + loop->enter + 2;
+    if (test[0] != OP_LOOP_TEST || test[4] != OP_COPY || test[6] != test[1]) return 0;
+    if (code[loop->exit - 3] != OP_NEXT) return 0;
+    j->counter = test[1];
+    j->limit = test[2];
+    j->var = test[5];
+
+    for (uint32_t pc = loop->enter + 6; pc < loop->exit - 3; ) {
+        int32_t* ip = code + pc;
+        int words = op_words(ip[0]);
+        if (!words) return 0;
+        if ((ip[0] == OP_JUMP || ip[0] == OP_JUMP_FALSE || ip[0] == OP_LOOP) &&
+            ((uint32_t)ip[1] < loop->enter + 6 || (uint32_t)ip[1] > loop->exit - 3)) {
+            return 0;                    // Only jumps within the body
+        }
+        if (ip[0] == OP_STORE || ip[0] == OP_ADD_IMM || ip[0] == OP_COPY) {
+            int known = reg_of(j, ip[1]) >= 0;
+            for (int i = 0; i < j->written_count; i++) {
+                if (j->written[i] == ip[1]) known = 1;
+            }
+            if (!known) {
+                if (j->written_count == MAX_WRITTEN) return 0;
+                j->written[j->written_count++] = ip[1];
+            }
+        }
+        pc += words;
+    }
+    return 1;
+}
+
+// Store the registers back; the loop variable is an integer from now on
+static void write_back(jit_t* j) {
+    byte(j, 0x89);                       // mov [counter], ebx
+    byte(j, 0x1D);
+    dword(j, value_addr(j, j->counter));
+    byte(j, 0x89);                       // mov [var], edi
+    byte(j, 0x3D);
+    dword(j, value_addr(j, j->var));
+    byte(j, 0xC6);
+    byte(j, 0x05);
+    dword(j, type_addr(j, j->var));
+    byte(j, VAR_INT);
+}
+
+static void return_value(jit_t* j, uint32_t value) {
+    byte(j, 0xB8);                       // mov eax, value
+    dword(j, value);
+    jump(j, j->out_label);
+}
+
+// int loop(void). Run twice: first to measure and place the labels, then
+// to write the code, with every jump target already known.
+static void emit_loop(jit_t* j, script_loop_t* loop) {
+    int32_t* code = j->s->code;
+    uint32_t next = loop->exit - 3;
+
+    byte(j, 0x53);                       // push ebx
+    byte(j, 0x56);                       // push esi
+    byte(j, 0x57);                       // push edi
+
+    // A variable holding a string has to go through var_set_int(); leave that to the VM
+    for (int i = -1; i < j->written_count; i++) {
+        byte(j, 0x80);                   // cmp byte [type], VAR_STRING
+        byte(j, 0x3D);
+        dword(j, type_addr(j, i < 0 ? j->var : j->written[i]));
+        byte(j, VAR_STRING);
+        jump_if(j, CC_E, j->decline);
+    }
+
+    byte(j, 0x8B);                       // mov ebx, [counter]
+    byte(j, 0x1D);
+    dword(j, value_addr(j, j->counter));
+    byte(j, 0x8B);                       // mov esi, [limit]
+    byte(j, 0x35);
+    dword(j, value_addr(j, j->limit));
+    byte(j, 0x8B);                       // mov edi, [var]
+    byte(j, 0x3D);
+    dword(j, value_addr(j, j->var));
+    byte(j, 0x39);                       // cmp ebx, esi
+    byte(j, 0xF3);
+    jump_if(j, CC_G, j->skip);           // No iterations: leave the variable alone
+
+    j->top = j->len;
+    j->offsets[2] = j->top;
+    byte(j, 0x39);                       // cmp ebx, esi
+    byte(j, 0xF3);
+    jump_if(j, CC_G, j->exit);
+
+    for (uint32_t pc = loop->enter + 6; pc < next; pc += op_words(code[pc])) {
+        j->offsets[pc - j->first] = j->len;
+        emit_op(j, code + pc);
+    }
+
+    j->offsets[next - j->first] = j->len;
+    check_stop(j);
+    byte(j, 0x43);                       // inc ebx
+    jump(j, j->top);
+
+    j->exit = j->len;
+    j->offsets[loop->exit - j->first] = j->exit;
+    write_back(j);
+    byte(j, 0x31);                       // xor eax, eax
+    byte(j, 0xC0);
+    j->out_label = j->len;
+    byte(j, 0x5F);                       // pop edi
+    byte(j, 0x5E);                       // pop esi
+    byte(j, 0x5B);                       // pop ebx
+    byte(j, 0xC3);                       // ret
+
+    j->abort = j->len;
+    write_back(j);
+    return_value(j, NATIVE_STOPPED);
+    j->skip = j->len;
+    return_value(j, NATIVE_FINISHED);
+    j->decline = j->len;
+    return_value(j, NATIVE_DECLINED);
+}
+
+static void compile_loop(script_t* s, script_loop_t* loop) {
+    jit_t j;
+    memset(&j, 0, sizeof(j));
+    j.s = s;
+    j.first = loop->enter;
+    loop->jit_state = STATE_REJECTED;
+    if (!scan_loop(&j, loop)) {
+        stats.rejected++;
+        return;
+    }
+
+    j.offsets = (uint32_t*)arena_alloc(s->arena, (loop->exit - loop->enter + 1) * sizeof(uint32_t));
+    if (!j.offsets) return;
+    emit_loop(&j, loop);
+    uint8_t* buf = (uint8_t*)arena_alloc(s->arena, j.len);
+    if (!buf) return;
+    j.out = buf;
+    j.len = 0;
+    emit_loop(&j, loop);
+
+    loop->native = buf;
+    loop->jit_state = STATE_COMPILED;
+    stats.compiled++;
+    stats.bytes += j.len;
+}
+
+int jit_run_loop(script_t* s, uint32_t index) {
+    if (mode == JIT_OFF) return JIT_INTERPRET;
+    script_loop_t* loop = &s->loops[index];
+    if (loop->jit_state == STATE_REJECTED) return JIT_INTERPRET;
+
+    if (loop->jit_state == STATE_NEW) {
+        int32_t* test = s->code + loop->enter + 2;
+        int64_t left = (int64_t)s->vars[test[2]]->value - s->vars[test[1]]->value;
+        if (mode == JIT_ON && left < JIT_THRESHOLD - 1) return JIT_INTERPRET;
+        compile_loop(s, loop);
+        if (loop->jit_state != STATE_COMPILED) return JIT_INTERPRET;
+    }
+
+    switch (((native_loop_t)loop->native)()) {
+    case NATIVE_FINISHED:
+        stats.runs++;
+        return JIT_FINISHED;
+    case NATIVE_STOPPED:
+        stats.runs++;
+        return JIT_STOPPED;
+    default:
+        return JIT_INTERPRET;
+    }
+}
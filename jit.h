@@ -0,0 +1,27 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include "script.h"
+
+#define JIT_THRESHOLD 32           // Iterations a loop must have ahead of it to be compiled
+
+enum { JIT_OFF, JIT_ON, JIT_ALL };              // JIT_ALL ignores the threshold, for testing
+enum { JIT_INTERPRET, JIT_FINISHED, JIT_STOPPED };
+
+typedef struct jit_stats {
+    uint32_t compiled;             // Loops turned into machine code
+    uint32_t rejected;             // Loops using something the JIT can't do
+    uint32_t runs;
+    uint32_t bytes;
+} jit_stats_t;
+
+void jit_set_mode(int mode);
+int jit_mode();
+const jit_stats_t* jit_stats();
+
+// Called at a loop's OP_ENTER with the counter and limit set. Runs the whole
+// loop natively if it can (JIT_FINISHED or JIT_STOPPED), else JIT_INTERPRET.
+int jit_run_loop(script_t* script, uint32_t loop);
+
+#endif
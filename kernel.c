@@ -3,6 +3,33 @@
 #include "disk.h"
 #include "string.h"
 #include "graphics.h"
+#include "console.h"
+#include "textgrid.h"
+#include "keyboard.h"
+#include "editor.h"
+#include "heap.h"
+#include "arena.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "pmm.h"
+#include "paging.h"
+#include "thread.h"
+#include "io.h"
+#include "multiboot.h"
+#include "acpi.h"
+#include "smp.h"
+#include "sync.h"
+#include "serial.h"
+#include "kprintf.h"
+#include "bootlog.h"
+#include "script.h"
+#include "vars.h"
+#include "jit.h"
+#include "cache.h"
+#include "profile.h"
+#include "command.h"
+#include "dlist.h"
+#include "pipe.h"
 
 #define VIDEO_MEMORY ((volatile char*)0xb8000)
 #define VGA_MEMORY ((volatile uint8_t*)0xA0000)
@@ -10,39 +37,14 @@
 #define MAX_COLS 80
 #define MAX_VAR_NAME 32
 #define MAX_VAR_VALUE 128
-#define MAX_VARIABLES 32
-#define KEY_REPEAT_DELAY 1400000    // Initial delay in ticks (adjust based on your timer frequency)
-#define KEY_REPEAT_RATE 150000     // Repeat rate in ticks
-static int ctrl_pressed = 0;
-// Add these variables at the top of your file with other globals
-static uint8_t last_key_pressed = 0;
-static uint32_t key_press_time = 0;
-static uint32_t key_repeat_time = 0;
-static uint8_t key_repeating = 0;
-static uint32_t system_tick = 0;
+#define SHELL_TOP 24               // Console starts below the shell banner
 int bg_color = 1; // Default background color
 int fg_color = 31; // Default background color
-// Simple timer increment function - call this from your timer interrupt
-void increment_system_tick() {
-    system_tick++;
-}
-
-typedef struct {
-    char name[MAX_VAR_NAME];
-    char value[MAX_VAR_VALUE];
-    int used;
-} variable_t;
 
-static variable_t variables[MAX_VARIABLES];
 static int cursor = 0;
-static int shift_pressed = 0;
-int cursor_y = 30;
 
 void putchar(char c);
 void puts(const char* str);
-static inline uint8_t inb(uint16_t port);
-char get_key();
-void wait_key_release();
 
 // String functions
 int strlen(const char* str) {
@@ -132,43 +134,6 @@ void itoa(int value, char* str) {
     }
 }
 
-// Variable management
-void set_variable(const char* name, const char* value) {
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (variables[i].used && strcmp(variables[i].name, name) == 0) {
-            strncpy(variables[i].value, value, MAX_VAR_VALUE - 1);
-            variables[i].value[MAX_VAR_VALUE - 1] = '\0';
-            return;
-        }
-    }
-    
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (!variables[i].used) {
-            strncpy(variables[i].name, name, MAX_VAR_NAME - 1);
-            variables[i].name[MAX_VAR_NAME - 1] = '\0';
-            strncpy(variables[i].value, value, MAX_VAR_VALUE - 1);
-            variables[i].value[MAX_VAR_VALUE - 1] = '\0';
-            variables[i].used = 1;
-            return;
-        }
-    }
-}
-
-const char* get_variable(const char* name) {
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (variables[i].used && strcmp(variables[i].name, name) == 0) {
-            return variables[i].value;
-        }
-    }
-    return NULL;
-}
-
-void clear_all_variables() {
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        variables[i].used = 0;
-    }
-}
-
 // Parse and execute commands
 int parse_let_command(const char* line) {
     if (strncmp(line, "let ", 4) != 0) {
@@ -194,12 +159,8 @@ int parse_let_command(const char* line) {
     }
     var_value[value_len] = '\0';
     
-    if (value_len == 0) {
-        set_variable(var_name, "0");
-    } else {
-        set_variable(var_name, var_value);
-    }
-    
+    var_t* var = var_intern(var_name, name_len);
+    if (var) var_set_text(var, value_len ? var_value : "0");
     return 1;
 }
 
@@ -218,55 +179,12 @@ int parse_assignment(const char* line) {
     // Skip any spaces after variable name
     while (*ptr == ' ' || *ptr == '\t') ptr++;
 
-    // Handle += operator
-    if (*ptr == '+' && *(ptr + 1) == '=') {
-        ptr += 2;
-        while (*ptr == ' ' || *ptr == '\t') ptr++;
-
-        int increment = atoi(ptr);
-        const char* current_val = get_variable(var_name);
-        int current = current_val ? atoi(current_val) : 0;
-
-        char new_val[32];
-        itoa(current + increment, new_val);
-        set_variable(var_name, new_val);
-        return 1;
-    }
-
-    // Handle -= operator
-    if (*ptr == '-' && *(ptr + 1) == '=') {
-        ptr += 2;
-        while (*ptr == ' ' || *ptr == '\t') ptr++;
-
-        int decrement = atoi(ptr);
-        const char* current_val = get_variable(var_name);
-        int current = current_val ? atoi(current_val) : 0;
-
-        char new_val[32];
-        itoa(current - decrement, new_val);
-        set_variable(var_name, new_val);
-        return 1;
-    }
-
-    // Handle ++ operator (both ++var and var++)
-    if (*ptr == '+' && *(ptr + 1) == '+') {
-        const char* current_val = get_variable(var_name);
-        int current = current_val ? atoi(current_val) : 0;
-
-        char new_val[32];
-        itoa(current + 1, new_val);
-        set_variable(var_name, new_val);
-        return 1;
-    }
-
-    // Handle -- operator (both --var and var--)
-    if (*ptr == '-' && *(ptr + 1) == '-') {
-        const char* current_val = get_variable(var_name);
-        int current = current_val ? atoi(current_val) : 0;
-
-        char new_val[32];
-        itoa(current - 1, new_val);
-        set_variable(var_name, new_val);
+    // +=, -=, ++ and -- (both ++var and var++) work on the integer value
+    if ((ptr[0] == '+' || ptr[0] == '-') && (ptr[1] == '=' || ptr[1] == ptr[0])) {
+        int delta = ptr[1] == '=' ? atoi(ptr + 2) : 1;
+        if (ptr[0] == '-') delta = -delta;
+        var_t* var = var_intern(var_name, name_len);
+        if (var) var_set_int(var, var->value + delta);
         return 1;
     }
 
@@ -282,7 +200,8 @@ int parse_assignment(const char* line) {
         }
         var_value[value_len] = '\0';
 
-        set_variable(var_name, var_value);
+        var_t* var = var_intern(var_name, name_len);
+        if (var) var_set_text(var, var_value);
         return 1;
     }
 
@@ -306,7 +225,10 @@ char* substitute_variables(const char* cmd, char* output, int max_len) {
             var_name[name_len] = '\0';
             
             if (name_len > 0) {
-                const char* var_value = get_variable(var_name);
+                // Integers are only turned into text here, when they are substituted
+                char number[12];
+                var_t* var = var_lookup(var_name, name_len);
+                const char* var_value = var ? var_text(var, number) : NULL;
                 if (var_value) {
                     int val_len = strlen(var_value);
                     if (out_pos + val_len < max_len - 1) {
@@ -350,7 +272,9 @@ char* substitute_variables(const char* cmd, char* output, int max_len) {
             if (*check_ptr == '/' && *(check_ptr+1) == '=') is_assignment = 1;  // /=
             if (*check_ptr == '=' && *(check_ptr+1) != '=') is_assignment = 1;  // = (but not ==)
 
-            const char* var_value = get_variable(var_name);
+            char number[12];
+            var_t* var = var_lookup(var_name, name_len);
+            const char* var_value = var ? var_text(var, number) : NULL;
             if (var_value && !is_assignment) {
                 // Substitute variable value only if not an assignment
                 int val_len = strlen(var_value);
@@ -375,110 +299,32 @@ char* substitute_variables(const char* cmd, char* output, int max_len) {
     output[out_pos] = '\0';
     return output;
 }
-int val_x = 10;
+// Lines the script compiler leaves as text: a command open to scripts, or
+// else an assignment
 int execute_single_command(const char* cmd) {
     char substituted_cmd[256];
+    uint64_t start = profile_start();
     substitute_variables(cmd, substituted_cmd, sizeof(substituted_cmd));
-    
-    if (parse_let_command(substituted_cmd)) {
-        return 1;
-    }
-    
-    if (parse_assignment(substituted_cmd)) {
-        return 1;
-    }
-    
-    // Handle print/echo command
-    if (strncmp(substituted_cmd, "print ", 6) == 0 || strncmp(substituted_cmd, "echo ", 5) == 0) {
-        const char* text_start = substituted_cmd;
-        if (strncmp(substituted_cmd, "print ", 6) == 0) {
-            text_start += 6;
-        } else {
-            text_start += 5;
-        }
-
-        // Skip leading spaces
-        while (*text_start == ' ' || *text_start == '\t') text_start++;
-        // Display the text - use a safe position that won't interfere with shell
-        draw_string(val_x, cursor_y, text_start, fg_color);
-        cursor_y += 8;
-        if (cursor_y > 150) {
-            cursor_y = 50;
-            val_x += 50;
-        }
-        if (val_x > 180) {
-            clear_graphics(bg_color);
-            val_x = 10;
-        }
-        return 1;
-    }
-
-
-
-    // Handle cube command
-    int x, y, width, height, color, darkcolor, brightcolor;
-    if (parse_cube_cmd(substituted_cmd, &x, &y, &width, &height, &color, &darkcolor, &brightcolor)) {
-        clear_graphics(VGA_BLACK);
-
-        int depth = width / 4;
-        fill_rect(x, y, width, height, color);
-
-        for (int i = 0; i < depth; i++) {
-            fill_rect(x + width + i, y - i, 1, height, darkcolor);
-        }
-        fill_rect(x + width, y - depth, depth, height, darkcolor);
-
-        for (int i = 0; i < depth; i++) {
-            fill_rect(x + depth - i, y + i - depth, width, 1, brightcolor);
-        }
-
-        // Remove the wait_key_release() and screen clearing here
+    profile_stop(PROF_SUBSTITUTE, start);
 
-        return 1;
-    }
-
-    return 0;
+    int result = command_pipeline(substituted_cmd, CMD_SCRIPT, 0);
+    if (result == CMD_UNKNOWN) result = command_run(substituted_cmd, CMD_SCRIPT);
+    if (result != CMD_UNKNOWN) return result == CMD_DONE;
+    return parse_assignment(substituted_cmd);
 }
-// Solution 1: Add a function to wait for any key press (not release)
-char wait_for_key_press() {
-    char c;
-    do {
-        c = get_key();
-        // Small delay to prevent consuming too much CPU
-        for (volatile int i = 0; i < 1000; i++);
-        increment_system_tick();
-    } while (c == 0);
-    return c;
-}
-
-// Solution 2: Reset key repeat state before waiting
-void reset_key_repeat_state() {
-    last_key_pressed = 0;
-    key_press_time = 0;
-    key_repeat_time = 0;
-    key_repeating = 0;
-}
-void execute_bash_file(const char* fname) {
-    // Clear all variables at the start of script execution
-    clear_all_variables();
+static arena_t script_arena;
 
-    char buffer[2048];
-    int size = read_file(fname, buffer, sizeof(buffer) - 1);
-    if (size < 0) {
-        draw_string(10, cursor_y, "File not found", fg_color);
-        cursor_y += 16;
-        return;
-    }
-    
-    buffer[size] = '\0';
-    
-    char* line_start = buffer;
+// The original line-at-a-time interpreter, kept as the baseline for `bench`.
+// Scripts run compiled (script.c); only the lines the compiler leaves as
+// text come back here, one at a time, through execute_single_command().
+static void interpret_script(const char* buffer, int paced) {
+    const char* line_start = buffer;
     char line[256];
     
-    while (*line_start) {
+    while (*line_start && !thread_should_stop()) {
         // Extract one line
         int line_len = 0;
-        char* line_end = line_start;
+        const char* line_end = line_start;
         while (*line_end && *line_end != '\n' && *line_end != '\r' && line_len < 255) {
             line[line_len++] = *line_end++;
         }
@@ -522,7 +368,7 @@ void execute_bash_file(const char* fname) {
                     line_end++; // Skip opening brace
                     
                     // Find closing brace and store body
-                    char* body_start = line_end;
+                    const char* body_start = line_end;
                     int brace_count = 1;
                     while (*line_end && brace_count > 0) {
                         if (*line_end == '{') brace_count++;
@@ -531,15 +377,14 @@ void execute_bash_file(const char* fname) {
                     }
                     
                     // Execute loop multiple times
-                    for (int loop_iter = start_val; loop_iter <= end_val; loop_iter++) {
-                        char val_str[32];
-                        itoa(loop_iter, val_str);
-                        set_variable(loop_var, val_str);
+                    var_t* loop_slot = var_intern(loop_var, var_len);
+                    for (int loop_iter = start_val; loop_iter <= end_val && !thread_should_stop(); loop_iter++) {
+                        if (loop_slot) var_set_int(loop_slot, loop_iter);
 
 
                         
                         // Execute body
-                        char* body_ptr = body_start;
+                        const char* body_ptr = body_start;
                         while (body_ptr < line_end) {
                             char body_line[256];
                             int line_len = 0;
@@ -560,16 +405,15 @@ void execute_bash_file(const char* fname) {
                                 execute_single_command(body_trimmed);
                             }
                         }
-                        // Add delay between iterations
-                        for (volatile int delay = 0; delay < 20000000; delay++);
+                        // Pace iterations on vertical retrace; in mode X this also flips pages
+                        if (paced) gfx_present();
                     }
                     
                     if (*line_end == '}') line_end++;
                     line_start = line_end;
                     continue;
                 } else {
-                    draw_string(10, cursor_y, "ERROR: No opening brace found!", VGA_RED);
-                    cursor_y += 16;
+                    console_write("ERROR: No opening brace found!\n", VGA_RED);
                 }
             } else {
                 execute_single_command(trimmed);
@@ -582,6 +426,50 @@ void execute_bash_file(const char* fname) {
     }
 }
 
+// Reads a script into `arena`; 0 (after saying why) if it can't
+static char* load_script(const char* fname, arena_t* arena) {
+    int size = file_size(fname);
+    if (size < 0) {
+        console_write("File not found\n", fg_color);
+        return 0;
+    }
+    arena_init(arena, "script");
+    char* buffer = (char*)arena_alloc(arena, size + 1);
+    if (!buffer) {
+        console_write("Script too large\n", VGA_RED);
+        arena_release(arena);
+        return 0;
+    }
+    size = read_file_at(fname, 0, buffer, size);
+    if (size < 0) size = 0;
+    buffer[size] = '\0';
+    return buffer;
+}
+
+void execute_bash_file(const char* fname, arena_t* arena) {
+    // Clear all variables at the start of script execution
+    var_clear_all();
+    gfx_set_frame_rate(GFX_DEFAULT_FPS);
+
+    // The script text, its code and anything else the run needs is freed in one go at the end
+    char* buffer = load_script(fname, arena);
+    if (!buffer) return;
+
+    // A compiled copy saved by an earlier run skips the compiler
+    script_t* script = cache_load(fname, buffer, arena);
+    if (!script) {
+        script = script_compile(buffer, arena);
+        if (script) cache_save(fname, script, buffer);
+    }
+    if (script) {
+        script_run(script, 0);
+    } else {
+        console_write("Script too large\n", VGA_RED);
+    }
+    arena_release(arena);
+    if (thread_should_stop()) console_write("Script stopped\n", VGA_YELLOW);
+}
+
 void clear_screen() {
     for (int i = 0; i < MAX_ROWS * MAX_COLS * 2; i += 2) {
         VIDEO_MEMORY[i] = ' ';
@@ -616,556 +504,832 @@ void puts(const char* str) {
     while (*str) putchar(*str++);
 }
 
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
+void render_text_at(int row, int col, const char* text) {
+    int pos = row * MAX_COLS + col;
+    while (*text && pos < MAX_ROWS * MAX_COLS) {
+        VIDEO_MEMORY[pos * 2] = *text++;
+        VIDEO_MEMORY[pos * 2 + 1] = 0x07;
+        pos++;
+    }
 }
 
-void wait_key_release() {
-    while (inb(0x60) & 0x80);
+void reset_screen() {
+    clear_screen();
+    cursor = 0;
 }
 
-char scancode_ascii[] = {
-    0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
-    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
-    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0,
-    '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0, '*', 0, ' ',
-    0, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
-    0, 0, 0, 0, 0, '-', 0, 0, 0, '+', 0, 0, 0, 0, 0, 0, 0, 0, 0x8A, 0x8B
-};
+// The grid is shared with the console, which a script thread may be writing to
+static void draw_shell_banner() {
+    console_lock();
+    grid_fill(0, 0, grid_cols(), SHELL_TOP / GRID_CELL_SIZE, ' ', fg_color, bg_color);
+    grid_write(1, 1, "Graphics OS Shell", fg_color, bg_color);
+    console_unlock();
+}
 
-char scancode_ascii_shifted[] = {
-    0, 27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
-    '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
-    0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~', 0,
-    '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0, '*', 0, ' ',
-    0, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
-    0, 0, 0, 0, 0, '_', 0, 0, 0, '+', 0, 0, 0, 0, 0, 0, 0, 0, 0x8A, 0x8B
-};
-char convert_scancode_to_char(uint8_t scancode) {
-    // Handle function keys
-    if (scancode == 0x3B) return 0x80; // F1
-    if (scancode == 0x3C) return 0x81; // F2
-    if (scancode == 0x3D) return 0x82; // F3
-    if (scancode == 0x3E) return 0x83; // F4
-    if (scancode == 0x3F) return 0x84; // F5
-    if (scancode == 0x40) return 0x85; // F6
-    if (scancode == 0x41) return 0x86; // F7
-    if (scancode == 0x42) return 0x87; // F8
-    if (scancode == 0x43) return 0x88; // F9
-    if (scancode == 0x44) return 0x89; // F10
-    if (scancode == 0x57) return 0x8A; // F11
-    if (scancode == 0x58) return 0x8B; // F12
-    
-    // Handle arrow keys
-    if (scancode == 0x48) return 0x90; // Up arrow
-    if (scancode == 0x50) return 0x91; // Down arrow
-    if (scancode == 0x4B) return 0x92; // Left arrow
-    if (scancode == 0x4D) return 0x93; // Right arrow
-    
-    // Handle regular keys
-    if (scancode < sizeof(scancode_ascii)) {
-        if (shift_pressed) {
-            return scancode_ascii_shifted[scancode];
-        } else {
-            return scancode_ascii[scancode];
-        }
+// Print "label N KB" using the console's current foreground color
+static void print_kb(const char* label, uint32_t kb) {
+    char num[12];
+    itoa((int)kb, num);
+    console_write(label, fg_color);
+    console_write(num, fg_color);
+    console_write(" KB\n", fg_color);
+}
+
+static void show_memory() {
+    print_kb("RAM total: ", pmm_total_pages() * (PAGE_SIZE / 1024));
+    print_kb("RAM free:  ", pmm_free_page_count() * (PAGE_SIZE / 1024));
+    print_kb("Heap:      ", heap_size() / 1024);
+    console_write(paging_has_wc() ? "VGA: write-combining\n" : "VGA: uncached (no PAT)\n", fg_color);
+
+    uint32_t allocs, frees, in_use;
+    heap_block_stats(&allocs, &frees, &in_use);
+    print_kb("Blocks:    ", in_use / 1024);
+    char count[12];
+    itoa((int)allocs, count);
+    console_write("Block allocs ", fg_color);
+    console_write(count, fg_color);
+    itoa((int)frees, count);
+    console_write(", frees ", fg_color);
+    console_write(count, fg_color);
+    console_putc('\n', fg_color);
+
+    // Free buddy blocks per order, smallest first
+    console_write("Free blocks:", fg_color);
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        char num[12];
+        itoa((int)pmm_free_blocks(order), num);
+        console_putc(' ', fg_color);
+        console_write(num, fg_color);
+    }
+    console_putc('\n', fg_color);
+
+    // Slab caches: live objects / pages held
+    for (slab_cache_t* cache = slab_cache_first(); cache; cache = cache->next) {
+        if (!cache->pages) continue;
+        char num[12];
+        console_write(cache->name, fg_color);
+        console_putc(' ', fg_color);
+        itoa((int)cache->in_use, num);
+        console_write(num, fg_color);
+        console_write(" objs ", fg_color);
+        itoa((int)cache->pages, num);
+        console_write(num, fg_color);
+        console_write(" pages\n", fg_color);
+    }
+
+    for (arena_t* arena = arena_first_live(); arena; arena = arena->next_live) {
+        console_write("arena ", fg_color);
+        console_write(arena->name, fg_color);
+        print_kb(" ", arena->used / 1024);
     }
-    
-    return 0;
 }
-char get_key() {
-    uint8_t scancode;
-    static uint8_t key_released = 1;  // Track if key was released
 
-    // Check for keyboard input
-    if (inb(0x64) & 1) {  // Check if keyboard data is available
-        scancode = inb(0x60);
-        
-        // Handle shift key press/release
-        if (scancode == 0x2A || scancode == 0x36) {
-            shift_pressed = 1;
-            return 0;  // Don't repeat modifier keys
-        }
-        if (scancode == 0xAA || scancode == 0xB6) {
-            shift_pressed = 0;
-            return 0;
-        }
-        // Handle ctrl key press/release  
-        if (scancode == 0x1D) {  // Left Ctrl
-            ctrl_pressed = 1;
-            return 0;
+// Repaint the whole shell after something else (editor, rect, cube) took over the screen
+static void restore_shell_screen() {
+    console_lock();
+    draw_shell_banner();
+    console_redraw();
+    console_unlock();
+}
+
+// Scripts run on their own thread so the shell keeps taking input; only
+// one at a time, and the shell stops it with Ctrl+C. script_mutex keeps
+// the thread alive while the shell cancels it from another CPU.
+static thread_t* script_thread = 0;
+static volatile int script_running = 0;
+static char script_name[64];
+static mutex_t script_mutex;
+
+// What the script thread does with its file
+enum { SCRIPT_RUN, SCRIPT_JIT_TEST, SCRIPT_PROFILE };
+static int script_mode;
+
+// One run for jit_test_file(): from a fresh shell screen with every
+// variable unset, ending with the screen and the slots copied out.
+// Returns the number of pixels captured.
+static int jit_test_run(script_t* script, int mode, uint8_t* screen, int32_t* values) {
+    switch_to_graphics();
+    console_clear();
+    restore_shell_screen();
+    var_reset_all();
+    gfx_set_frame_rate(GFX_DEFAULT_FPS);
+    jit_set_mode(mode);
+    script_run(script, SCRIPT_UNPACED);
+    gfx_capture(screen);
+    for (uint32_t i = 0; i < script->slot_count; i++) {
+        values[i * 2] = script->vars[i]->type;
+        values[i * 2 + 1] = script->vars[i]->value;
+    }
+    return graphics_width() * graphics_height();
+}
+
+// Runs a script through the VM alone and then with every loop compiled,
+// and checks both runs leave the same screen and variables behind
+static void jit_test_file(const char* fname) {
+    var_clear_all();
+    char* buffer = load_script(fname, &script_arena);
+    if (!buffer) return;
+
+    script_t* script = script_compile(buffer, &script_arena);
+    uint8_t* screens = (uint8_t*)arena_alloc(&script_arena, GFX_CAPTURE_MAX * 2);
+    int32_t* values = script ? (int32_t*)arena_alloc(&script_arena, (script->slot_count + 1) * 4 * sizeof(int32_t)) : 0;
+    if (!screens || !values) {
+        console_write("Script too large\n", VGA_RED);
+        arena_release(&script_arena);
+        return;
+    }
+    uint8_t* vm_screen = screens;
+    uint8_t* jit_screen = screens + GFX_CAPTURE_MAX;
+    int32_t* vm_values = values;
+    int32_t* jit_values = values + script->slot_count * 2;
+
+    int mode = jit_mode();
+    uint32_t compiled = jit_stats()->compiled;
+    int pixels = jit_test_run(script, JIT_OFF, vm_screen, vm_values);
+    int jit_pixels = 0;
+    if (!thread_should_stop()) {
+        jit_pixels = jit_test_run(script, JIT_ALL, jit_screen, jit_values);
+    }
+    jit_set_mode(mode);
+    switch_to_graphics();
+    restore_shell_screen();
+    if (thread_should_stop()) {
+        arena_release(&script_arena);
+        console_write("Script stopped\n", VGA_YELLOW);
+        return;
+    }
+
+    int bad_pixels = 0;
+    if (pixels != jit_pixels) {
+        bad_pixels = pixels;        // Ended in different video modes
+    } else {
+        for (int i = 0; i < pixels; i++) {
+            if (vm_screen[i] != jit_screen[i]) bad_pixels++;
         }
-        if (scancode == 0x9D) {  // Left Ctrl release
-            ctrl_pressed = 0;
-            return 0;
+    }
+    for (uint32_t i = 0; i < script->slot_count; i++) {
+        if (vm_values[i * 2] != jit_values[i * 2] || vm_values[i * 2 + 1] != jit_values[i * 2 + 1]) {
+            kprintf(VGA_RED, "jit: %s is %d, interpreter had %d\n",
+                    script->vars[i]->name, jit_values[i * 2 + 1], vm_values[i * 2 + 1]);
         }
-        // Key release (scancode has high bit set)
-        if (scancode & 0x80) {
-            uint8_t released_key = scancode & 0x7F;
-            if (released_key == last_key_pressed) {
-                key_released = 1;
-                key_repeating = 0;
-                last_key_pressed = 0;
-            }
-            return 0;
+    }
+    kprintf(bad_pixels ? VGA_RED : fg_color, "jit: %u of %u loops compiled, %d pixels differ\n",
+            jit_stats()->compiled - compiled, script->loop_count, bad_pixels);
+    arena_release(&script_arena);
+}
+
+// Runs a script once through the VM, unpaced and without the JIT so every
+// op is seen, and reports where the time went. It is compiled here rather
+// than taken from the cache, which has no line numbers.
+static void profile_file(const char* fname) {
+    var_clear_all();
+    gfx_set_frame_rate(GFX_DEFAULT_FPS);
+    char* buffer = load_script(fname, &script_arena);
+    if (!buffer) return;
+
+    script_t* script = script_compile(buffer, &script_arena);
+    if (!script || !profile_begin(&script_arena, buffer)) {
+        console_write("Script too large\n", VGA_RED);
+        arena_release(&script_arena);
+        return;
+    }
+    int mode = jit_mode();
+    jit_set_mode(JIT_OFF);
+    script_run(script, SCRIPT_UNPACED);
+    jit_set_mode(mode);
+    profile_end();
+    if (thread_should_stop()) console_write("Script stopped\n", VGA_YELLOW);
+    profile_report(fg_color);
+    arena_release(&script_arena);
+}
+
+static void script_worker(void* arg) {
+    if (script_mode == SCRIPT_JIT_TEST) {
+        jit_test_file((const char*)arg);
+    } else if (script_mode == SCRIPT_PROFILE) {
+        profile_file((const char*)arg);
+    } else {
+        execute_bash_file((const char*)arg, &script_arena);
+    }
+    mutex_lock(&script_mutex);
+    script_running = 0;
+    mutex_unlock(&script_mutex);
+}
+
+static void start_script(const char* fname, int mode) {
+    if (script_running) {
+        console_write("A script is already running (Ctrl+C stops it)\n", fg_color);
+        return;
+    }
+    script_mode = mode;
+    strncpy(script_name, fname, sizeof(script_name) - 1);
+    script_name[sizeof(script_name) - 1] = '\0';
+    script_running = 1;
+    script_thread = thread_create("script", script_worker, script_name, THREAD_PRIO_NORMAL);
+    if (!script_thread) {
+        script_running = 0;
+        console_write("Cannot start script: out of memory\n", VGA_RED);
+    }
+}
+
+// Background jobs: "bash FILE &" runs a script on a low-priority thread
+// of its own, with its own variables and memory, while the shell and any
+// foreground script carry on. job_mutex keeps a job's thread alive while
+// the shell cancels it.
+#define MAX_JOBS 4
+
+typedef struct {
+    int id;                        // 0 for a free slot
+    thread_t* thread;
+    char name[64];
+    arena_t arena;
+    var_store_t vars;
+} job_t;
+
+static job_t jobs[MAX_JOBS];
+static int next_job_id = 1;
+static mutex_t job_mutex;
+
+static void job_worker(void* arg) {
+    job_t* job = (job_t*)arg;
+    var_use_store(&job->vars);
+    execute_bash_file(job->name, &job->arena);
+    var_use_store(0);
+    var_store_free(&job->vars);
+    kprintf(fg_color, "[%d] done %s\n", job->id, job->name);
+    mutex_lock(&job_mutex);
+    job->id = 0;
+    mutex_unlock(&job_mutex);
+}
+
+static void start_job(const char* fname) {
+    mutex_lock(&job_mutex);
+    job_t* job = 0;
+    for (int i = 0; i < MAX_JOBS && !job; i++) {
+        if (!jobs[i].id) job = &jobs[i];
+    }
+    if (!job) {
+        mutex_unlock(&job_mutex);
+        console_write("Too many jobs (kill one first)\n", fg_color);
+        return;
+    }
+    job->id = next_job_id++;
+    strncpy(job->name, fname, sizeof(job->name) - 1);
+    job->name[sizeof(job->name) - 1] = '\0';
+    memset(&job->vars, 0, sizeof(job->vars));
+    job->thread = thread_create("job", job_worker, job, THREAD_PRIO_LOW);
+    if (job->thread) {
+        kprintf(fg_color, "[%d] %s\n", job->id, job->name);
+    } else {
+        job->id = 0;
+        console_write("Cannot start job: out of memory\n", VGA_RED);
+    }
+    mutex_unlock(&job_mutex);
+}
+
+static void show_threads() {
+    static const char* state_names[] = { "ready", "running", "blocked", "dead" };
+    static thread_info_t info[32];
+    int count = thread_snapshot(info, 32);
+    for (int i = 0; i < count; i++) {
+        kprintf(fg_color, "%u %s prio %d %s on cpu%d, %u ms\n",
+                info[i].id, info[i].name, info[i].priority, state_names[info[i].state],
+                info[i].cpu, (uint32_t)div64_32(info[i].run_ns, NS_PER_MS, 0));
+    }
+}
+
+static void show_cpus() {
+    for (int i = 0; i < cpu_count(); i++) {
+        cpu_t* cpu = cpu_get(i);
+        kprintf(fg_color, "cpu%d apic %u %s, queued %u, switches %u, steals %u\n",
+                i, cpu->apic_id, cpu->current == cpu->idle ? "idle" : "busy",
+                cpu->queued, cpu->switches, cpu->steals);
+    }
+}
+
+// The same 10k-iteration loop through the line interpreter and through
+// the compiled VM, without frame pacing, so only the interpreter is timed
+static const char bench_source[] =
+    "let x = 0\n"
+    "for i 1 10000\n"
+    "{\n"
+    "x += $i\n"
+    "y = $x\n"
+    "y -= 7\n"
+    "z++\n"
+    "}\n";
+
+static uint32_t bench_us(uint64_t start) {
+    return (uint32_t)div64_32(now_ns() - start, 1000, 0);
+}
+
+static void run_benchmark() {
+    if (script_running) {
+        console_write("bench: a script is running\n", fg_color);
+        return;
+    }
+    static arena_t bench_arena;
+    arena_init(&bench_arena, "bench");
+
+    var_clear_all();
+    uint64_t start = now_ns();
+    interpret_script(bench_source, 0);
+    uint32_t line_us = bench_us(start);
+    var_t* x = var_lookup("x", 1);
+    int line_x = x ? x->value : 0;
+
+    var_clear_all();
+    start = now_ns();
+    script_t* script = script_compile(bench_source, &bench_arena);
+    uint32_t compile_us = bench_us(start);
+    uint32_t vm_us = 0;
+    int vm_x = 0;
+    if (script) {
+        start = now_ns();
+        script_run(script, SCRIPT_UNPACED);
+        vm_us = bench_us(start);
+        x = var_lookup("x", 1);
+        vm_x = x ? x->value : 0;
+    }
+    arena_release(&bench_arena);
+    var_clear_all();
+
+    if (!script) {
+        console_write("bench: out of memory\n", VGA_RED);
+        return;
+    }
+    if (vm_us == 0) vm_us = 1;
+    kprintf(fg_color, "10000 iterations, x = %d / %d\n", line_x, vm_x);
+    kprintf(fg_color, "line interpreter: %u us\n", line_us);
+    kprintf(fg_color, "bytecode: %u us (+%u us compile), %u.%ux\n",
+            vm_us, compile_us, line_us / vm_us, (line_us * 10 / vm_us) % 10);
+}
+
+// Commands for the shell and for script lines, dispatched by command.c
+
+// Text goes on down the pipeline, or to the console at the end of one
+static int cmd_output(const command_args_t* args, const char* text, int len) {
+    if (args->out) return pipe_write(args->out, text, len);
+    char buf[128];
+    while (len > 0) {
+        int n = len < (int)sizeof(buf) - 1 ? len : (int)sizeof(buf) - 1;
+        memcpy(buf, text, n);
+        buf[n] = '\0';
+        console_write(buf, fg_color);
+        text += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static void cmd_print(const command_args_t* args) {
+    // Scripts print through the console so long output scrolls instead of being lost
+    const char* text = args->count ? args->text[0] : "";
+    if (args->out) {
+        if (pipe_write(args->out, text, strlen(text))) pipe_write(args->out, "\n", 1);
+        return;
+    }
+    dlist_flush();
+    console_write(text, fg_color);
+    console_putc('\n', fg_color);
+}
+
+static void cmd_let(const command_args_t* args) {
+    parse_let_command(args->line);
+}
+
+// Animation: "modex" switches to the paged 320x240 mode, "frame" shows
+// the finished page on the next retrace, "fps N" sets the frame pacing
+static void cmd_modex(const command_args_t* args) {
+    (void)args;
+    dlist_flush();
+    switch_to_modex();
+}
+
+static void cmd_frame(const command_args_t* args) {
+    (void)args;
+    dlist_flush();
+    gfx_present();
+}
+
+// Scripts draw into a display list that is drawn at each frame; "flush"
+// draws it sooner
+static void cmd_flush(const command_args_t* args) {
+    (void)args;
+    dlist_flush();
+}
+
+static void cmd_fps(const command_args_t* args) {
+    gfx_set_frame_rate(args->num[0]);
+}
+
+// Drawing: rect and cube draw over whatever is there
+static void cmd_rect(const command_args_t* args) {
+    const int* a = args->num;
+    dlist_rect(a[0], a[1], a[2], a[3], a[4]);
+}
+
+static void cmd_cube(const command_args_t* args) {
+    const int* a = args->num;
+    dlist_cube(a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+}
+
+static void cmd_edit(const command_args_t* args) {
+    text_editor(args->text[0]);
+    restore_shell_screen();
+}
+
+static void cmd_bash(const command_args_t* args) {
+    start_script(args->text[0], SCRIPT_RUN);
+}
+
+static void cmd_list(const command_args_t* args) {
+    (void)args;
+    console_write("Files:\n", fg_color);
+    list_files();
+}
+
+// Into a pipeline the file is read straight into the pipe's ring
+static void cmd_cat(const command_args_t* args) {
+    const char* name = args->text[0];
+    int size = file_size(name);
+    if (size < 0) {
+        console_write("cat: file not found\n", fg_color);
+        return;
+    }
+    char* space;
+    int n;
+    for (int offset = 0; offset < size; offset += n) {
+        if (args->out) {
+            if (!(n = pipe_write_space(args->out, &space))) return;
+            if ((n = read_file_at(name, offset, space, n)) <= 0) return;
+            pipe_write_commit(args->out, n);
+        } else {
+            char buf[512];
+            if ((n = read_file_at(name, offset, buf, sizeof(buf) - 1)) <= 0) break;
+            buf[n] = '\0';
+            console_write(buf, fg_color);
         }
-        
-        // Key press
-        if (!(scancode & 0x80)) {
-            // New key pressed
-            if (scancode != last_key_pressed || key_released) {
-                last_key_pressed = scancode;
-                key_press_time = system_tick;
-                key_repeat_time = 0;
-                key_repeating = 0;
-                key_released = 0;
-                
-                // Return the character for initial press
-                return convert_scancode_to_char(scancode);
-            }
+    }
+    if (!args->out) console_putc('\n', fg_color);
+}
+
+typedef struct {
+    const command_args_t* args;
+    const char* pattern;
+    int len;
+} grep_t;
+
+// A matching line goes from one pipe's ring straight into the next
+static void grep_line(const char* line, int len, void* ctx) {
+    grep_t* grep = (grep_t*)ctx;
+    for (int i = 0; i + grep->len <= len; i++) {
+        if (strncmp(line + i, grep->pattern, grep->len) == 0) {
+            if (cmd_output(grep->args, line, len)) cmd_output(grep->args, "\n", 1);
+            return;
         }
     }
-    
-    // Handle key repeat for held keys
-    if (last_key_pressed && !key_released) {
-        uint32_t current_time = system_tick;
-        
-        if (!key_repeating) {
-            // Check if initial delay has passed
-            if (current_time - key_press_time >= KEY_REPEAT_DELAY) {
-                key_repeating = 1;
-                key_repeat_time = current_time;
-                return convert_scancode_to_char(last_key_pressed);
-            }
-        } else {
-            // Check if repeat interval has passed
-            if (current_time - key_repeat_time >= KEY_REPEAT_RATE) {
-                key_repeat_time = current_time;
-                return convert_scancode_to_char(last_key_pressed);
-            }
+}
+
+static void cmd_grep(const command_args_t* args) {
+    if (!args->in) return;
+    grep_t grep = { args, args->text[0], strlen(args->text[0]) };
+    pipe_read_lines(args->in, grep_line, &grep);
+}
+
+static void cmd_count(const command_args_t* args) {
+    uint32_t lines = 0, words = 0, bytes = 0;
+    int in_word = 0;
+    const char* data;
+    int n;
+    while (args->in && (n = pipe_read_data(args->in, &data)) > 0) {
+        for (int i = 0; i < n; i++) {
+            char c = data[i];
+            int blank = c == ' ' || c == '\t' || c == '\n' || c == '\r';
+            if (c == '\n') lines++;
+            if (!blank && !in_word) words++;
+            in_word = !blank;
         }
+        bytes += n;
+        pipe_read_consume(args->in, n);
     }
-    
-    return 0;  // No key event
+    char text[64];
+    int len = ksnprintf(text, sizeof(text), "%u lines, %u words, %u bytes\n", lines, words, bytes);
+    cmd_output(args, text, len);
 }
 
-void render_text_at(int row, int col, const char* text) {
-    int pos = row * MAX_COLS + col;
-    while (*text && pos < MAX_ROWS * MAX_COLS) {
-        VIDEO_MEMORY[pos * 2] = *text++;
-        VIDEO_MEMORY[pos * 2 + 1] = 0x07;
-        pos++;
+static void cmd_mem(const command_args_t* args) {
+    (void)args;
+    show_memory();
+}
+
+static void cmd_threads(const command_args_t* args) {
+    (void)args;
+    show_threads();
+}
+
+static void cmd_cpus(const command_args_t* args) {
+    (void)args;
+    show_cpus();
+}
+
+static void cmd_boot(const command_args_t* args) {
+    (void)args;
+    boot_timeline_print(fg_color);
+}
+
+static void cmd_bench(const command_args_t* args) {
+    (void)args;
+    run_benchmark();
+}
+
+static void cmd_jit(const command_args_t* args) {
+    if (args->count == 0) {
+        const jit_stats_t* stats = jit_stats();
+        kprintf(fg_color, "jit %s: %u loops compiled (%u bytes), %u rejected, %u runs\n",
+                jit_mode() == JIT_OFF ? "off" : "on",
+                stats->compiled, stats->bytes, stats->rejected, stats->runs);
+    } else if (strcmp(args->text[0], "on") == 0) {
+        jit_set_mode(JIT_ON);
+    } else if (strcmp(args->text[0], "off") == 0) {
+        jit_set_mode(JIT_OFF);
+    } else if (strcmp(args->text[0], "test") == 0 && args->count == 2) {
+        start_script(args->text[1], SCRIPT_JIT_TEST);
+    } else {
+        console_write("usage: jit [on|off|test FILE]\n", fg_color);
     }
 }
 
-void reset_screen() {
-    clear_screen();
-    cursor = 0;
+static void cmd_jobs(const command_args_t* args) {
+    (void)args;
+    mutex_lock(&job_mutex);
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (!jobs[i].id) continue;
+        kprintf(fg_color, "[%d] %s%s\n", jobs[i].id, jobs[i].name,
+                jobs[i].thread->cancel ? " (stopping)" : "");
+    }
+    mutex_unlock(&job_mutex);
 }
 
-void text_editor(const char* fname) {
-    char buffer[512];
-    int size = read_file(fname, buffer, sizeof(buffer) - 1);
-    if (size < 0) {
-        buffer[0] = '\0';
-        size = 0;
+static void cmd_kill(const command_args_t* args) {
+    mutex_lock(&job_mutex);
+    job_t* job = 0;
+    for (int i = 0; i < MAX_JOBS && !job; i++) {
+        if (jobs[i].id && jobs[i].id == args->num[0]) job = &jobs[i];
+    }
+    if (job) {
+        thread_cancel(job->thread);
     } else {
-        buffer[size] = '\0';
+        console_write("kill: no such job\n", fg_color);
     }
+    mutex_unlock(&job_mutex);
+}
 
-    int buf_len = size;
-    int cursor_pos = buf_len;
-    int needs_redraw = 1;  // Flag to control when to redraw
+static void cmd_profile(const command_args_t* args) {
+    start_script(args->text[0], SCRIPT_PROFILE);
+}
 
-    while (1) {
-        char c = get_key();
-
-        // Process key input regardless of redraw state
-        if (c != 0) {
-            needs_redraw = 1;  // Set redraw flag when key is processed
-
-            if (c == 27) {
-                buffer[buf_len] = '\0';
-                int result = write_file(fname, buffer, buf_len);
-                if (result >= 0) {
-                    clear_graphics(VGA_GREEN);
-                    draw_string(10, 10, "File saved successfully!", fg_color);
-                    get_key();
-                }
-                break;
-            }
-            else if (c == 0x90) { // Up arrow
-                // Calculate current column position
-                int current_col = 0;
-                int temp_pos = cursor_pos;
-                
-                // Move back to find the start of current line
-                while (temp_pos > 0 && buffer[temp_pos - 1] != '\n') {
-                    temp_pos--;
-                    current_col++;
-                }
-                
-                // Move to previous line if possible
-                if (temp_pos > 0) {
-                    cursor_pos = temp_pos - 1; // Move to the newline
-                    
-                    // Find start of previous line
-                    while (cursor_pos > 0 && buffer[cursor_pos - 1] != '\n') {
-                        cursor_pos--;
-                    }
-                    
-                    // Try to maintain column position
-                    int new_col = 0;
-                    while (cursor_pos < buf_len && buffer[cursor_pos] != '\n' && new_col < current_col) {
-                        cursor_pos++;
-                        new_col++;
-                    }
-                }
-            }
-            else if (c == 0x91) { // Down arrow
-                // Calculate current column position
-                int current_col = 0;
-                int temp_pos = cursor_pos;
-                
-                // Move back to find the start of current line
-                while (temp_pos > 0 && buffer[temp_pos - 1] != '\n') {
-                    temp_pos--;
-                    current_col++;
-                }
-                
-                // Move to next line
-                while (cursor_pos < buf_len && buffer[cursor_pos] != '\n') {
-                    cursor_pos++;
-                }
-                if (cursor_pos < buf_len) cursor_pos++; // Skip newline
-                
-                // Try to maintain column position
-                int new_col = 0;
-                while (cursor_pos < buf_len && buffer[cursor_pos] != '\n' && new_col < current_col) {
-                    cursor_pos++;
-                    new_col++;
-                }
-            }
-            else if (c == 0x92) { // Left arrow
-                if (cursor_pos > 0) cursor_pos--;
-            }
-            else if (c == 0x93) { // Right arrow
-                if (cursor_pos < buf_len) cursor_pos++;
-            }
-            else if (c == '\n') {
-                if (buf_len < sizeof(buffer) - 1) {
-                    for (int i = buf_len; i > cursor_pos; i--) {
-                        buffer[i] = buffer[i - 1];
-                    }
-                    buffer[cursor_pos] = '\n';
-                    buf_len++;
-                    cursor_pos++;
-                }
-            }
-            else if (c == '\b') {
-                if (cursor_pos > 0) {
-                    if (ctrl_pressed) {
-                        // Ctrl+Backspace: delete until space, newline, or beginning
-                        int original_pos = cursor_pos;
-                        
-                        // If current character before cursor is a space, delete it first
-                        if (buffer[cursor_pos - 1] == ' ') {
-                            cursor_pos--;
-                        }
-                        
-                        // Then move backwards until we find a space, newline, or reach the beginning
-                        while (cursor_pos > 0 && buffer[cursor_pos - 1] != ' ' && buffer[cursor_pos - 1] != '\n') {
-                            cursor_pos--;
-                        }
-                        
-                        // Remove the deleted characters from buffer
-                        int chars_deleted = original_pos - cursor_pos;
-                        for (int i = cursor_pos; i < buf_len - chars_deleted; i++) {
-                            buffer[i] = buffer[i + chars_deleted];
-                        }
-                        for (int i = buf_len - chars_deleted; i < buf_len; i++) {
-                            buf_len--;
-                            buffer[i] = '\0';  // Clear the end of the buffer
-                        }
-                    } else {
-                        // Regular backspace: delete one character
-                        for (int i = cursor_pos - 1; i < buf_len - 1; i++) {
-                            buffer[i] = buffer[i + 1];
-                        }
-                        buf_len--;
-                        cursor_pos--;
-                        buffer[buf_len] = '\0';
-                    }
-                }
-            }
-            else if (c >= 32 && c <= 126) {
-                if (buf_len < sizeof(buffer) - 1) {
-                    for (int i = buf_len; i > cursor_pos; i--) {
-                        buffer[i] = buffer[i - 1];
-                    }
-                    buffer[cursor_pos] = c;
-                    buf_len++;
-                    cursor_pos++;
-                }
-            }
-        }
+static void cmd_stats(const command_args_t* args) {
+    (void)args;
+    command_stats(fg_color);
+}
 
-        // Redraw screen only when needed
-        if (needs_redraw) {
-            clear_graphics(bg_color);
-            draw_string(10, 10, "Simple Text Editor (ESC=save&exit, arrows=move)", fg_color);
-            draw_string(10, 30, buffer, fg_color);
-
-            // Calculate and draw cursor
-            int line = 0;
-            int col = 0;
-            for (int i = 0; i < cursor_pos; i++) {
-                if (buffer[i] == '\n') {
-                    line++;
-                    col = 0;
-                } else {
-                    col++;
-                }
-            }
-            
-            int cursor_x = 10 + col * 8;
-            int cursor_y = 30 + line * 8;
-            draw_char(cursor_x, cursor_y, '_', VGA_LIGHT_GREEN);
-            
-            needs_redraw = 0;
+static void cmd_clear(const command_args_t* args) {
+    (void)args;
+    console_clear();
+    restore_shell_screen();
+}
+
+static void cmd_help(const command_args_t* args) {
+    (void)args;
+    console_write("Commands:\n", fg_color);
+    command_help(CMD_SHELL, fg_color);
+    console_write("FILE.bash also runs a script (Ctrl+C stops it),\n"
+                  "FILE.bash & runs it in the background\n"
+                  "CMD | CMD passes one's output on to the next\n"
+                  "scripts: let, modex, frame, flush, fps N,\n"
+                  "if/else, while, function, local, return\n"
+                  "PgUp/PgDn scroll back through output\n", fg_color);
+}
+
+static void cmd_bg(const command_args_t* args) {
+    bg_color = args->num[0];
+    console_set_background(bg_color);
+    restore_shell_screen();
+}
+
+static void cmd_fg(const command_args_t* args) {
+    fg_color = args->num[0];
+    draw_shell_banner();
+    grid_flush();
+}
+
+static command_t commands[] = {
+    { "rect", "iiiic", CMD_BOTH | CMD_DRAWS, cmd_rect, "rect X Y WIDTH HEIGHT COLOR" },
+    { "cube", "iiiicii", CMD_BOTH | CMD_DRAWS, cmd_cube, "cube X Y WIDTH HEIGHT COLOR DARK BRIGHT" },
+    { "print", "?s", CMD_BOTH, cmd_print, "print TEXT" },
+    { "echo", "?s", CMD_BOTH, cmd_print, 0 },
+    { "let", "s", CMD_SCRIPT, cmd_let, "let NAME = VALUE" },
+    { "modex", "", CMD_SCRIPT, cmd_modex, "modex" },
+    { "frame", "", CMD_SCRIPT, cmd_frame, "frame" },
+    { "flush", "", CMD_SCRIPT, cmd_flush, "flush" },
+    { "fps", "i", CMD_SCRIPT, cmd_fps, "fps N" },
+    { "edit", "w", CMD_SHELL, cmd_edit, "edit FILE" },
+    { "bash", "w", CMD_SHELL, cmd_bash, "bash FILE [&]" },
+    { "jobs", "", CMD_SHELL, cmd_jobs, "jobs" },
+    { "kill", "i", CMD_SHELL, cmd_kill, "kill JOB" },
+    { "list", "", CMD_SHELL, cmd_list, "list" },
+    { "cat", "w", CMD_BOTH, cmd_cat, "cat FILE" },
+    { "grep", "w", CMD_BOTH, cmd_grep, "... | grep TEXT" },
+    { "count", "", CMD_BOTH, cmd_count, "... | count" },
+    { "clear", "", CMD_SHELL, cmd_clear, "clear" },
+    { "bg", "c", CMD_SHELL, cmd_bg, "bg COLOR" },
+    { "fg", "c", CMD_SHELL, cmd_fg, "fg COLOR" },
+    { "mem", "", CMD_SHELL, cmd_mem, "mem" },
+    { "threads", "", CMD_SHELL, cmd_threads, "threads" },
+    { "cpus", "", CMD_SHELL, cmd_cpus, "cpus" },
+    { "boot", "", CMD_SHELL, cmd_boot, "boot" },
+    { "bench", "", CMD_SHELL, cmd_bench, "bench" },
+    { "jit", "?ww", CMD_SHELL, cmd_jit, "jit [on|off|test FILE]" },
+    { "profile", "w", CMD_SHELL, cmd_profile, "profile FILE" },
+    { "stats", "", CMD_SHELL, cmd_stats, "stats" },
+    { "help", "", CMD_SHELL, cmd_help, "help" },
+    { "info", "", CMD_SHELL, cmd_help, 0 },
+    { "i", "", CMD_SHELL, cmd_help, 0 },
+};
+
+// "bash FILE &" or "FILE.bash &": the file name, or 0 if `cmd` is anything else
+static const char* job_file(const char* cmd, char* name, int size) {
+    int len = strlen(cmd);
+    if (!len || cmd[len - 1] != '&') return 0;
+    len--;
+    while (len > 0 && (cmd[len - 1] == ' ' || cmd[len - 1] == '\t')) len--;
+    if (len >= size) return 0;
+    memcpy(name, cmd, len);
+    name[len] = '\0';
+    if (strncmp(name, "bash ", 5) == 0) {
+        name += 5;
+        while (*name == ' ') name++;
+        return *name ? name : 0;
+    }
+    return len > 5 && strcmp(name + len - 5, ".bash") == 0 ? name : 0;
+}
+
+// One line typed at the prompt
+static void shell_command(const char* cmd) {
+    char line[80];
+    const char* job = job_file(cmd, line, sizeof(line));
+    if (job) {
+        start_job(job);
+        return;
+    }
+
+    command_t* command;
+    int result = command_pipeline(cmd, CMD_SHELL, &command);
+    if (result == CMD_BAD_ARGS && !command) console_write("pipeline: out of memory\n", fg_color);
+    if (result == CMD_BAD_ARGS && command) {
+        kprintf(fg_color, "usage: %s\n", command->usage ? command->usage : command->name);
+    }
+    if (result != CMD_UNKNOWN) return;
+
+    command = command_find(cmd);
+    if (!command || !(command->flags & CMD_SHELL)) {
+        // Check if command ends with .bash and execute as bash file
+        int cmd_len = strlen(cmd);
+        if (cmd_len > 5 && strcmp(cmd + cmd_len - 5, ".bash") == 0) {
+            start_script(cmd, SCRIPT_RUN);
+        }
+        else {
+            console_write("Unknown command\n", fg_color);
         }
+        return;
+    }
 
-        increment_system_tick();  // Increment system tick for key repeat logic
+    command_args_t args;
+    if (command_parse(command, cmd, &args) != CMD_DONE) {
+        kprintf(fg_color, "usage: %s\n", command->usage ? command->usage : command->name);
+        return;
+    }
+    if (command->flags & CMD_DRAWS) clear_graphics(bg_color);
+    command_call(command, &args);
+    if (command->flags & CMD_DRAWS) {
+        // The drawing stays up until a key
+        reset_key_repeat_state();
+        wait_for_key_press();
+        restore_shell_screen();
     }
 }
 
-int x, y, width, height;
-int color;
-int brightcolor;
-int darkcolor;
+// Reads the file table in the background; the first file access waits for it if needed
+static void filesystem_loader(void* arg) {
+    (void)arg;
+    init_filesystem();
+    boot_mark("filesystem (background)");
+}
+
+void kmain(uint32_t magic, multiboot_info_t* mbi) {
+    // RAM comes first: the heap and everything after it allocate from it
+    pmm_init(magic, mbi);
+    boot_mark("memory map");
+    acpi_init();            // Before paging: the RSDP search starts in page 0
+    boot_mark("acpi");
+    paging_init();
+    boot_mark("paging");
+    heap_init();
+    boot_mark("heap");
+    interrupts_init();
+    serial_init();
+    boot_mark("interrupts, serial");
+    timer_init();
+    boot_mark("timer calibration");
+    thread_init();
+    var_init();
+    keyboard_init();
+    boot_mark("threads, keyboard");
+    smp_init();
+    boot_mark("other cpus");
+    mutex_init(&script_mutex);
+    mutex_init(&job_mutex);
+    for (uint32_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        command_register(&commands[i]);
+    }
+    thread_create("fsload", filesystem_loader, 0, THREAD_PRIO_LOW);
 
-void kmain() {
-    // Initialize graphics mode
+    // Initialize graphics mode; the first grid flush paints every cell
     init_graphics();
-    clear_graphics(bg_color);
-    
-    // Initialize filesystem
-    
+    grid_init();
     
-    // Draw shell prompt
-    draw_string(10, 10, "Graphics OS Shell", fg_color);
-    draw_string(10, 30, "> ", fg_color);
+    // Draw shell banner and prompt
+    draw_shell_banner();
+    console_init(SHELL_TOP, bg_color);
+    boot_mark("first prompt");
+    boot_timeline_serial();
+    console_write("> ", fg_color);
     
     char cmd[80] = { 0 };
     int cmd_pos = 0;
-    int cursor_x = 26; // After "> "
-    cursor_y = 30;  // Use the global cursor_y  // Use the global cursor_y
-    
-    init_filesystem();
     while (1) {
-        char c = get_key();
-        
-        if (c == '\n') {
-            fill_rect(cursor_x, cursor_y, 8, 8, bg_color); // Clear the prompt area
+        char c = wait_for_key_press();
+
+        // A finished script leaves its last mode X frame up until the next key
+        if (!script_running && graphics_is_modex()) {
+            switch_to_graphics();
+            restore_shell_screen();
+            continue;
+        }
+
+        if ((ctrl_pressed && (c == 'c' || c == 'C')) || c == KEY_CTRL_C) {
+            mutex_lock(&script_mutex);
+            if (script_running) thread_cancel(script_thread);
+            mutex_unlock(&script_mutex);
+            console_write("^C\n", fg_color);
+            console_write("> ", fg_color);
+            cmd_pos = 0;
+        }
+        else if (c == '\n') {
             cmd[cmd_pos] = 0;
-            cursor_y += 16; // Move to next line
+            console_putc('\n', fg_color);
             
-            if (strncmp(cmd, "edit ", 5) == 0) {
-                char* fname = cmd + 5;
-                text_editor(fname);
-                clear_graphics(bg_color);
-                draw_string(10, 10, "Graphics OS Shell", fg_color);
-                cursor_y = 30;
-            }
-            else if (strncmp(cmd, "bash ", 5) == 0) {
-                char* fname = cmd + 5;
-                execute_bash_file(fname);
-                cursor_y += 16;
-            }
-            else if (strcmp(cmd, "list") == 0) {
-                draw_string(10, cursor_y, "Files:", fg_color);
-                cursor_y += 16;
-                list_files();  // Now it can access global cursor_y  // Now it can access global cursor_y
-            }
-            else if (strncmp(cmd, "cat ", 4) == 0) {
-                char* fname = cmd + 4;
-                char buf[512];
-                int size = read_file(fname, buf, sizeof(buf));
-                if (size >= 0) {
-                    buf[size] = 0;
-                    draw_string(10, cursor_y, buf, fg_color);
-                    cursor_y += 16;
-                }
-                else {
-                    draw_string(10, cursor_y, "cat: file not found", fg_color);
-                    cursor_y += 16;
-                }
-            }
-            else if (parse_rect_cmd(cmd, &x, &y, &width, &height, &color)) {
-                clear_graphics(bg_color);
-                
-                // Draw filled rectangle with parsed color
-                fill_rect(x, y, width, height, color);
-                
-                // Wait for key press
-                wait_key_release();
-                clear_graphics(bg_color);
-                draw_string(10, 10, "Graphics OS Shell", fg_color);
-                cursor_y = 30;
-            }
-            else if (parse_cube_cmd(cmd, &x, &y, &width, &height, &color, &darkcolor, &brightcolor)) {
-                clear_graphics(VGA_BLACK);
-    
-                // Calculate depth offset for 3D effect
-                int depth = width / 4;
-    
-                // Draw the front face (main rectangle)
-                fill_rect(x, y, width, height, color);
-    
-                // Draw the right face (darker color for shadow effect)
-                for (int i = 0; i < depth; i++) {
-                    fill_rect(x + width + i, y - i, 1, height, darkcolor);
-                }
-                fill_rect(x + width, y - depth, depth, height, darkcolor);
-    
-                // Draw the top face (brighter color for highlight effect)
-                for (int i = 0; i < depth; i++) {
-                    fill_rect(x + depth - i, y + i - depth, width, 1, brightcolor);
-                }
-    
-                // Wait for key press
-                
-    
-                // Reset key repeat state and wait for any key press
-                reset_key_repeat_state();
-                wait_for_key_press();
-    
-                clear_graphics(bg_color);
-                draw_string(10, 10, "Graphics OS Shell", fg_color);
-                cursor_y = 30;
-            }
+            shell_command(cmd);
 
-            else if (strcmp(cmd, "clear") == 0) {
-                clear_graphics(bg_color);
-                draw_string(10, 10, "Graphics OS Shell", fg_color);
-                cursor_y = 30;
-            }
-            else if (strncmp(cmd,"help", 4)== 0 || strncmp(cmd,"info", 4)== 0|| strncmp(cmd,"i", 4)== 0) {
-                draw_string(10, cursor_y, "Commands: \nedit(works but save doesnt), \nlist(doesnt work), \ncat file(doesntwork), \nrect xpos y pos width height color,\ncube xpos ypos width height \ncolor darkcolor brightcolor,\n clear", fg_color);
-                cursor_y += 65;
-            }
-            else if (parse_bg_cmd(cmd, &color))
-            {
-                bg_color = color; // Reset background color
-                clear_graphics(bg_color);
-                draw_string(10, 10, "Graphics OS Shell", fg_color);
-                cursor_y = 30; // Reset cursor position
-            }
-            else if (parse_fg_cmd(cmd, &color))
-            {
-                fg_color = color; // Reset background color
-                clear_graphics(bg_color);
-                draw_string(10, 10, "Graphics OS Shell", fg_color);
-                cursor_y = 30; // Reset cursor position
-            }
-            else {
-                // Check if command ends with .bash and execute as bash file
-                int cmd_len = strlen(cmd);
-                if (cmd_len > 5 && strcmp(cmd + cmd_len - 5, ".bash") == 0) {
-                    execute_bash_file(cmd);
-                    cursor_y += 16;
-                }
-                else {
-                    draw_string(10, cursor_y, "Unknown command", fg_color);
-                    cursor_y += 16;
-                }
-            }
-            
-            if (cursor_y >= 180) {
-                clear_graphics(bg_color);
-                draw_string(10, 10, "Graphics OS Shell", fg_color);
-                cursor_y = 30;
-            }
-            
             // Draw new prompt
- 
-           draw_string(10, cursor_y, "> ", fg_color);
-            cursor_x = 26;
+            console_write("> ", fg_color);
             cmd_pos = 0;
         }
+        else if ((uint8_t)c == KEY_PAGE_UP) {
+            console_page_up();
+        }
+        else if ((uint8_t)c == KEY_PAGE_DOWN) {
+            console_page_down();
+        }
         else if (c == '\b') {
-    if (cmd_pos > 0) {
-        // Check if Ctrl is pressed (you'll need to track Ctrl key state)
-        // For now, assuming you have a ctrl_pressed variable similar to shift_pressed
+            if (cmd_pos > 0) {
                 if (ctrl_pressed) {
-                    fill_rect(cursor_x, cursor_y, 8, 8, bg_color); // Clear the prompt area
                     // Ctrl+Backspace: delete until space or beginning
-                    int original_pos = cmd_pos;
-            
                     // If current character before cursor is a space, delete it first
                     if (cmd[cmd_pos - 1] == ' ') {
                         cmd_pos--;
+                        console_backspace();
                     }
             
                     // Then move backwards until we find a space or reach the beginning
                     while (cmd_pos > 0 && cmd[cmd_pos - 1] != ' ') {
                         cmd_pos--;
+                        console_backspace();
                     }
-            
-                    // Clear the deleted characters visually
-                    int chars_deleted = original_pos - cmd_pos;
-                    cursor_x -= chars_deleted * 8;
-                    fill_rect(cursor_x, cursor_y, chars_deleted * 8, 8, bg_color);
                 } else {
                     // Regular backspace: delete one character
                     cmd_pos--;
-                    fill_rect(cursor_x, cursor_y, 8, 8, bg_color);
-                    cursor_x -= 8;
-                    fill_rect(cursor_x, cursor_y, 8, 8, bg_color);
+                    console_backspace();
                 }
             }
         }
         else if (c >= 32 && c <= 126) {
             if (cmd_pos < (int)sizeof(cmd) - 1) {
                 cmd[cmd_pos++] = c;
-                fill_rect(cursor_x, cursor_y, 8, 8, bg_color); // Clear previous character
-                draw_char(cursor_x, cursor_y, c, fg_color);
-                cursor_x += 8;
+                console_putc(c, fg_color);
             }
         }
-        draw_char(cursor_x, cursor_y, '_', VGA_GREEN);
-        increment_system_tick();
+        console_draw_cursor(VGA_GREEN);
     }
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -1,13 +1,255 @@
 [bits 32]
 global start
+global isr_stub_table
+global gdt_start
+global stack_guard
+global stack_top
+global switch_context
+global isr_spurious
+global ap_trampoline
+global ap_trampoline_end
+global ap_params
 
 extern kmain
+extern interrupt_dispatch
+extern ap_main
+extern boot_start_tsc
 
+MAX_CPUS equ 8
+AP_TRAMPOLINE equ 0x8000
+
+section .text
 start:
-    mov esp, 0x90000
+    mov esp, stack_top
+    mov edi, eax                    ; Multiboot magic
+    mov esi, ebx                    ; Multiboot info pointer
+
+    ; Timestamp the entry for the boot timeline, if the CPU has a TSC
+    mov eax, 1
+    cpuid
+    test edx, 0x10
+    jz .no_tsc
+    rdtsc
+    mov [boot_start_tsc], eax
+    mov [boot_start_tsc + 4], edx
+.no_tsc:
+
+    ; Load our own flat GDT; the one GRUB leaves behind is not guaranteed
+    lgdt [gdt_descriptor]
+    jmp 0x08:.reload_segments
+.reload_segments:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; kmain(magic, multiboot_info)
+    push esi
+    push edi
     call kmain
 
 hang:
     cli
     hlt
     jmp hang
+
+; Interrupt entry stubs. Every stub leaves the same frame on the stack:
+; error code (0 if the CPU pushed none) and vector number, then
+; interrupt_common saves the general registers and calls into C.
+%macro ISR_NOERR 1
+isr%1:
+    push dword 0
+    push dword %1
+    jmp interrupt_common
+%endmacro
+
+%macro ISR_ERR 1
+isr%1:
+    push dword %1
+    jmp interrupt_common
+%endmacro
+
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR   8
+ISR_NOERR 9
+ISR_ERR   10
+ISR_ERR   11
+ISR_ERR   12
+ISR_ERR   13
+ISR_ERR   14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR   17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_ERR   21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_ERR   29
+ISR_ERR   30
+ISR_NOERR 31
+
+; Hardware IRQs 0-15 are remapped to vectors 32-47
+ISR_NOERR 32
+ISR_NOERR 33
+ISR_NOERR 34
+ISR_NOERR 35
+ISR_NOERR 36
+ISR_NOERR 37
+ISR_NOERR 38
+ISR_NOERR 39
+ISR_NOERR 40
+ISR_NOERR 41
+ISR_NOERR 42
+ISR_NOERR 43
+ISR_NOERR 44
+ISR_NOERR 45
+ISR_NOERR 46
+ISR_NOERR 47
+
+; Local APIC timer, the reschedule IPI and the TLB flush IPI
+ISR_NOERR 48
+ISR_NOERR 49
+ISR_NOERR 50
+
+; The local APIC expects no EOI for its spurious vector
+isr_spurious:
+    iret
+
+interrupt_common:
+    pusha
+    cld
+    push esp                ; interrupt_frame_t*
+    call interrupt_dispatch
+    add esp, 4
+    popa
+    add esp, 8              ; Drop vector and error code
+    iret
+
+; void switch_context(uint32_t* save_esp, uint32_t next_esp)
+; Saves the callee-saved registers on the current stack, parks its esp in
+; *save_esp and resumes the thread whose stack top is next_esp.
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; Application processor entry. smp_init copies ap_trampoline..ap_trampoline_end
+; to AP_TRAMPOLINE and fills ap_params; STARTUP IPIs begin here in real mode
+; with cs:ip = AP_TRAMPOLINE:0, so every address inside is rebased by hand.
+%define TRAMPOLINE_ADDR(label) (label - ap_trampoline + AP_TRAMPOLINE)
+
+[bits 16]
+ap_trampoline:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [TRAMPOLINE_ADDR(ap_gdt_descriptor)]
+    mov eax, cr0
+    or eax, 1                       ; Protected mode
+    mov cr0, eax
+    jmp dword 0x08:TRAMPOLINE_ADDR(ap_protected)
+
+[bits 32]
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; Same page directory and paging features as the BSP
+    mov eax, [TRAMPOLINE_ADDR(ap_params) + 4]
+    mov cr4, eax
+    mov eax, [TRAMPOLINE_ADDR(ap_params)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000              ; PG | WP
+    mov cr0, eax
+    mov esp, [TRAMPOLINE_ADDR(ap_params) + 8]
+
+    ; Now the kernel proper is reachable: switch to its GDT and leave low memory
+    lgdt [gdt_descriptor]
+    jmp 0x08:.reload_segments
+.reload_segments:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    call ap_main
+    jmp hang
+
+align 8
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+ap_gdt_descriptor:
+    dw ap_gdt_descriptor - ap_gdt - 1
+    dd TRAMPOLINE_ADDR(ap_gdt)
+
+; cr3, cr4, stack top
+ap_params:
+    dd 0, 0, 0
+ap_trampoline_end:
+
+section .data
+align 8
+gdt_start:
+    dq 0                    ; Null descriptor
+    dq 0x00CF9A000000FFFF   ; 0x08: flat 4 GB ring 0 code
+    dq 0x00CF92000000FFFF   ; 0x10: flat 4 GB ring 0 data
+    dq 0                    ; 0x18: kernel TSS, filled in by interrupts_init
+    dq 0                    ; 0x20: double fault TSS, filled in by interrupts_init
+    times MAX_CPUS - 1 dq 0 ; 0x28: application processor TSSes, one each
+    times MAX_CPUS - 1 dq 0 ; Then their double fault TSSes, one each
+gdt_end:
+
+gdt_descriptor:
+    dw gdt_end - gdt_start - 1
+    dd gdt_start
+
+; Stub addresses, indexed by vector, for building the IDT in C
+isr_stub_table:
+%assign i 0
+%rep 51
+    dd isr%+i
+%assign i i+1
+%endrep
+
+KERNEL_STACK_SIZE equ 65536
+
+section .bss nobits alloc noexec write align=4096
+; paging_init leaves the guard page unmapped, so running off the bottom of
+; the stack faults instead of overwriting whatever sits below it
+stack_guard:
+    resb 4096
+    resb KERNEL_STACK_SIZE
+stack_top:
@@ -0,0 +1,273 @@
+#include "keyboard.h"
+#include <stdint.h>
+#include "io.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "thread.h"
+#include "serial.h"
+
+#define KBD_DATA 0x60
+#define KBD_STATUS 0x64
+#define KEY_REPEAT_DELAY 500        // Initial delay in milliseconds
+#define KEY_REPEAT_RATE 50          // Repeat interval in milliseconds
+#define SCANCODE_RING_SIZE 256      // Indices are uint8_t so they wrap for free
+
+// Single-producer/single-consumer ring: only the IRQ handler writes `ring_head`,
+// only get_key() writes `ring_tail`, so no lock is needed
+static volatile uint8_t scancode_ring[SCANCODE_RING_SIZE];
+static volatile uint8_t ring_head = 0;
+static volatile uint8_t ring_tail = 0;
+static volatile uint32_t dropped_scancodes = 0;
+static wait_queue_t key_waiters;
+
+// Decoder state, consumer side only
+int ctrl_pressed = 0;
+static int shift_pressed = 0;
+static int left_shift = 0, right_shift = 0;
+static int left_ctrl = 0, right_ctrl = 0;
+static int extended = 0;            // Previous byte was the 0xE0 prefix
+
+// Key repeat state
+static uint16_t last_key_pressed = 0;   // Scancode, | 0x100 for extended keys
+static uint32_t key_press_time = 0;
+static uint32_t key_repeat_time = 0;
+static uint8_t key_repeating = 0;
+
+static void keyboard_irq(interrupt_frame_t* frame) {
+    (void)frame;
+    uint8_t scancode = inb(KBD_DATA);
+
+    uint8_t next = ring_head + 1;
+    if (next == ring_tail) {
+        dropped_scancodes++;
+        return;
+    }
+    scancode_ring[ring_head] = scancode;
+    __asm__ volatile ("" : : : "memory");   // Publish the byte before the index
+    ring_head = next;
+    wait_queue_wake_all(&key_waiters);
+}
+
+static int ring_pop(uint8_t* scancode) {
+    if (ring_tail == ring_head) return 0;
+    *scancode = scancode_ring[ring_tail];
+    __asm__ volatile ("" : : : "memory");
+    ring_tail = ring_tail + 1;
+    return 1;
+}
+
+void keyboard_init() {
+    // Drop anything the controller buffered before we took over
+    while (inb(KBD_STATUS) & 1) {
+        inb(KBD_DATA);
+    }
+    wait_queue_init(&key_waiters);
+    irq_install_handler(IRQ_KEYBOARD, keyboard_irq);
+}
+
+uint32_t keyboard_dropped() {
+    return dropped_scancodes;
+}
+
+char scancode_ascii[] = {
+    0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0,
+    '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0, '*', 0, ' ',
+    0, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0, 0, 0, 0, 0, '-', 0, 0, 0, '+', 0, 0, 0, 0, 0, 0, 0, 0, 0x8A, 0x8B
+};
+
+char scancode_ascii_shifted[] = {
+    0, 27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
+    '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
+    0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~', 0,
+    '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0, '*', 0, ' ',
+    0, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0, 0, 0, 0, 0, '_', 0, 0, 0, '+', 0, 0, 0, 0, 0, 0, 0, 0, 0x8A, 0x8B
+};
+
+// Keys that only exist behind the 0xE0 prefix
+static char convert_extended_to_char(uint8_t scancode) {
+    switch (scancode) {
+        case 0x48: return KEY_UP;
+        case 0x50: return KEY_DOWN;
+        case 0x4B: return KEY_LEFT;
+        case 0x4D: return KEY_RIGHT;
+        case 0x49: return KEY_PAGE_UP;
+        case 0x51: return KEY_PAGE_DOWN;
+        case 0x47: return KEY_HOME;
+        case 0x4F: return KEY_END;
+        case 0x53: return KEY_DELETE;
+        case 0x1C: return '\n';     // Keypad Enter
+        case 0x35: return '/';      // Keypad slash
+    }
+    return 0;
+}
+
+char convert_scancode_to_char(uint8_t scancode) {
+    // Handle function keys
+    if (scancode == 0x3B) return 0x80; // F1
+    if (scancode == 0x3C) return 0x81; // F2
+    if (scancode == 0x3D) return 0x82; // F3
+    if (scancode == 0x3E) return 0x83; // F4
+    if (scancode == 0x3F) return 0x84; // F5
+    if (scancode == 0x40) return 0x85; // F6
+    if (scancode == 0x41) return 0x86; // F7
+    if (scancode == 0x42) return 0x87; // F8
+    if (scancode == 0x43) return 0x88; // F9
+    if (scancode == 0x44) return 0x89; // F10
+    if (scancode == 0x57) return 0x8A; // F11
+    if (scancode == 0x58) return 0x8B; // F12
+    
+    // Keypad arrows with Num Lock off
+    if (scancode == 0x48) return KEY_UP;
+    if (scancode == 0x50) return KEY_DOWN;
+    if (scancode == 0x4B) return KEY_LEFT;
+    if (scancode == 0x4D) return KEY_RIGHT;
+
+    // Page Up/Down scroll the console history
+    if (scancode == 0x49) return KEY_PAGE_UP;
+    if (scancode == 0x51) return KEY_PAGE_DOWN;
+    
+    // Handle regular keys
+    if (scancode < sizeof(scancode_ascii)) {
+        if (shift_pressed) {
+            return scancode_ascii_shifted[scancode];
+        } else {
+            return scancode_ascii[scancode];
+        }
+    }
+    
+    return 0;
+}
+
+static char key_to_char(uint16_t key) {
+    if (key & 0x100) return convert_extended_to_char(key & 0x7F);
+    return convert_scancode_to_char(key);
+}
+
+// Feed one byte through the decoder; returns a character for key presses
+static char decode_scancode(uint8_t scancode) {
+    if (scancode == 0xE0) {
+        extended = 1;
+        return 0;
+    }
+    int is_extended = extended;
+    extended = 0;
+
+    int released = scancode & 0x80;
+    uint8_t code = scancode & 0x7F;
+
+    // Shift keys; the controller wraps some extended keys in fake E0 2A / E0 AA shifts
+    if (code == 0x2A || code == 0x36) {
+        if (is_extended) return 0;
+        if (code == 0x2A) left_shift = !released;
+        else right_shift = !released;
+        shift_pressed = left_shift || right_shift;
+        return 0;
+    }
+    // Ctrl keys: left is 1D, right is E0 1D
+    if (code == 0x1D) {
+        if (is_extended) right_ctrl = !released;
+        else left_ctrl = !released;
+        ctrl_pressed = left_ctrl || right_ctrl;
+        return 0;
+    }
+
+    uint16_t key = is_extended ? (0x100 | code) : code;
+    if (released) {
+        if (key == last_key_pressed) {
+            last_key_pressed = 0;
+            key_repeating = 0;
+        }
+        return 0;
+    }
+
+    // The keyboard's own typematic repeats are ignored; repeat runs off the timer
+    if (key == last_key_pressed) return 0;
+
+    char c = key_to_char(key);
+    if (c) {
+        last_key_pressed = key;
+        key_press_time = timer_ms();
+        key_repeating = 0;
+    }
+    return c;
+}
+
+char get_key() {
+    uint8_t scancode;
+    while (ring_pop(&scancode)) {
+        char c = decode_scancode(scancode);
+        if (c) return c;
+    }
+
+    // Handle key repeat for held keys
+    if (last_key_pressed) {
+        uint32_t current_time = timer_ms();
+        
+        if (!key_repeating) {
+            // Check if initial delay has passed
+            if (current_time - key_press_time >= KEY_REPEAT_DELAY) {
+                key_repeating = 1;
+                key_repeat_time = current_time;
+                return key_to_char(last_key_pressed);
+            }
+        } else {
+            // Check if repeat interval has passed
+            if (current_time - key_repeat_time >= KEY_REPEAT_RATE) {
+                key_repeat_time = current_time;
+                return key_to_char(last_key_pressed);
+            }
+        }
+    }
+    
+    return 0;  // No key event
+}
+
+// When the held key will next repeat, or 0 if nothing is held
+static uint64_t key_repeat_deadline() {
+    if (!last_key_pressed) return 0;
+    uint32_t due = key_repeating ? key_repeat_time + KEY_REPEAT_RATE : key_press_time + KEY_REPEAT_DELAY;
+    return (uint64_t)due * NS_PER_MS;
+}
+
+void keyboard_input_ready() {
+    wait_queue_wake_all(&key_waiters);
+}
+
+// Wait for any key press (not release) on the keyboard or the serial line,
+// blocking the calling thread (or halting the CPU before threads exist) in
+// between. The only wakeups are input IRQs and, while a key is held, its
+// next repeat.
+char wait_for_key_press() {
+    while (1) {
+        uint32_t flags = irq_save();
+        char c = get_key();
+        if (!c) c = serial_get_key();
+        if (c) {
+            irq_restore(flags);
+            return c;
+        }
+        if (threads_active()) {
+            // The IRQ may arrive on another CPU; recheck under the wait lock
+            uint32_t wait_flags = wait_lock_irqsave();
+            if (ring_tail == ring_head && !serial_rx_pending()) {
+                wait_queue_sleep_until(&key_waiters, key_repeat_deadline());
+            }
+            wait_unlock_irqrestore(wait_flags);
+            irq_restore(flags);
+        } else {
+            cpu_idle_until(key_repeat_deadline());
+        }
+    }
+}
+
+// Forget a held key so a fresh press is needed
+void reset_key_repeat_state() {
+    last_key_pressed = 0;
+    key_press_time = 0;
+    key_repeat_time = 0;
+    key_repeating = 0;
+}
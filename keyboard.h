@@ -0,0 +1,30 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include <stdint.h>
+
+// Special key codes returned by get_key() above the ASCII range
+#define KEY_F1 0x80
+#define KEY_F12 0x8B
+#define KEY_UP 0x90
+#define KEY_DOWN 0x91
+#define KEY_LEFT 0x92
+#define KEY_RIGHT 0x93
+#define KEY_PAGE_UP 0x94
+#define KEY_PAGE_DOWN 0x95
+#define KEY_HOME 0x96
+#define KEY_END 0x97
+#define KEY_DELETE 0x98
+#define KEY_CTRL_C 0x03         // Ctrl+C as a single byte, from the serial line
+
+extern int ctrl_pressed;
+
+void keyboard_init();
+char get_key();
+char wait_for_key_press();
+// Wake wait_for_key_press for input that arrived elsewhere (the serial line)
+void keyboard_input_ready();
+void reset_key_repeat_state();
+uint32_t keyboard_dropped();
+
+#endif
@@ -0,0 +1,148 @@
+#include "kprintf.h"
+#include <stdint.h>
+#include <stdarg.h>
+#include "console.h"
+#include "timer.h"
+
+#define KPRINTF_BUFFER 256
+
+typedef struct {
+    char* buf;
+    int size;
+    int len;                    // Length of the full output, even past `size`
+} out_t;
+
+static void emit(out_t* out, char c) {
+    if (out->len < out->size - 1) out->buf[out->len] = c;
+    out->len++;
+}
+
+static void emit_field(out_t* out, const char* text, int len, int width, int left, char pad) {
+    if (!left) {
+        for (int i = len; i < width; i++) emit(out, pad);
+    }
+    for (int i = 0; i < len; i++) emit(out, text[i]);
+    if (left) {
+        for (int i = len; i < width; i++) emit(out, ' ');
+    }
+}
+
+// Digits of `value` in `base`, most significant first; 64-bit division goes
+// through div64_32 since there is no libgcc
+static int format_number(char* digits, uint64_t value, uint32_t base, int upper) {
+    const char* set = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char reversed[24];
+    int count = 0;
+    do {
+        uint32_t rem;
+        value = div64_32(value, base, &rem);
+        reversed[count++] = set[rem];
+    } while (value);
+    for (int i = 0; i < count; i++) digits[i] = reversed[count - 1 - i];
+    return count;
+}
+
+int kvsnprintf(char* buf, int size, const char* fmt, va_list args) {
+    out_t out = { buf, size, 0 };
+
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            emit(&out, *fmt);
+            continue;
+        }
+        fmt++;
+
+        int left = 0;
+        char pad = ' ';
+        for (; *fmt == '-' || *fmt == '0'; fmt++) {
+            if (*fmt == '-') left = 1;
+            else pad = '0';
+        }
+        int width = 0;
+        for (; *fmt >= '0' && *fmt <= '9'; fmt++) width = width * 10 + (*fmt - '0');
+        int longs = 0;
+        for (; *fmt == 'l'; fmt++) longs++;
+
+        char digits[24];
+        int len;
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            int64_t value = longs >= 2 ? va_arg(args, int64_t) : va_arg(args, int);
+            int negative = value < 0;
+            len = format_number(digits + 1, negative ? -(uint64_t)value : (uint64_t)value, 10, 0);
+            if (negative) {
+                // The sign goes before zero padding, not after it
+                if (pad == '0') {
+                    emit(&out, '-');
+                    if (width) width--;
+                    emit_field(&out, digits + 1, len, width, left, pad);
+                    break;
+                }
+                digits[0] = '-';
+                emit_field(&out, digits, len + 1, width, left, pad);
+            } else {
+                emit_field(&out, digits + 1, len, width, left, pad);
+            }
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X': {
+            uint64_t value = longs >= 2 ? va_arg(args, uint64_t) : va_arg(args, unsigned int);
+            len = format_number(digits, value, *fmt == 'u' ? 10 : 16, *fmt == 'X');
+            emit_field(&out, digits, len, width, left, pad);
+            break;
+        }
+        case 'p': {
+            emit(&out, '0');
+            emit(&out, 'x');
+            len = format_number(digits, (uint32_t)va_arg(args, void*), 16, 0);
+            emit_field(&out, digits, len, 8, 0, '0');
+            break;
+        }
+        case 's': {
+            const char* str = va_arg(args, const char*);
+            if (!str) str = "(null)";
+            len = 0;
+            while (str[len]) len++;
+            emit_field(&out, str, len, width, left, ' ');
+            break;
+        }
+        case 'c':
+            digits[0] = (char)va_arg(args, int);
+            emit_field(&out, digits, 1, width, left, ' ');
+            break;
+        case '%':
+            emit(&out, '%');
+            break;
+        case '\0':
+            fmt--;              // Lone '%' at the end
+            break;
+        default:
+            emit(&out, '%');
+            emit(&out, *fmt);
+            break;
+        }
+    }
+
+    if (size > 0) buf[out.len < size ? out.len : size - 1] = '\0';
+    return out.len;
+}
+
+int ksnprintf(char* buf, int size, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+void kprintf(uint8_t color, const char* fmt, ...) {
+    char buf[KPRINTF_BUFFER];
+    va_list args;
+    va_start(args, fmt);
+    kvsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    console_write(buf, color);
+}
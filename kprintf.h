@@ -0,0 +1,15 @@
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+#include <stdint.h>
+#include <stdarg.h>
+
+// Formatting for the kernel: %d %i %u %x %X %p %s %c %%, an optional '-' or
+// '0' flag, a field width and the l/ll length modifiers
+int kvsnprintf(char* buf, int size, const char* fmt, va_list args);
+int ksnprintf(char* buf, int size, const char* fmt, ...);
+
+// Formatted console output, which the console mirrors to the serial line
+void kprintf(uint8_t color, const char* fmt, ...);
+
+#endif
@@ -2,9 +2,12 @@
 section .multiboot
 align 4
 
+MULTIBOOT_MAGIC equ 0x1BADB002
+MULTIBOOT_FLAGS equ 0x03            ; Page-align modules, provide memory info and map
+
 multiboot_header:
-    dd 0x1BADB002
-    dd 0x00
-    dd -(0x1BADB002 + 0x00)
+    dd MULTIBOOT_MAGIC
+    dd MULTIBOOT_FLAGS
+    dd -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
 
 section .text
@@ -0,0 +1,200 @@
+#include "paging.h"
+#include <stdint.h>
+#include "pmm.h"
+#include "string.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "apic.h"
+
+#define LARGE_PAGE_SIZE 0x400000
+#define MSR_PAT 0x277
+#define CPUID_PSE (1 << 3)
+#define CPUID_PAT (1 << 16)
+#define CR0_WP (1u << 16)
+#define CR0_PG (1u << 31)
+#define CR4_PSE (1 << 4)
+
+// PAT entries, low to high: WB, WC, UC-, UC, repeated for the PAT=1 half
+#define PAT_VALUE 0x00070106
+
+extern uint8_t stack_guard[];
+
+static uint32_t page_directory[1024] __attribute__((aligned(PAGE_SIZE)));
+static int have_pse = 0;
+static int have_pat = 0;
+static int paging_enabled = 0;
+static spinlock_t paging_lock;      // Page tables are shared by every CPU
+
+// TLB shootdown: one CPU at a time asks the others to flush and waits
+// until each has checked in
+static spinlock_t shootdown_lock;
+static volatile uint32_t shootdown_waiting;
+static volatile uint8_t shootdown_asked[MAX_CPUS];
+
+static void cpuid(uint32_t leaf, uint32_t* edx) {
+    uint32_t eax, ebx, ecx;
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(*edx) : "a"(leaf));
+}
+
+static void wrmsr(uint32_t msr, uint32_t lo, uint32_t hi) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"(lo), "d"(hi));
+}
+
+static void flush_tlb() {
+    uint32_t cr3;
+    __asm__ volatile ("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+// Page table covering `addr`, splitting a 4 MB mapping or creating an empty table as needed
+static uint32_t* table_for(uint32_t addr) {
+    uint32_t* pde = &page_directory[addr >> 22];
+    if ((*pde & PAGE_PRESENT) && !(*pde & PAGE_LARGE)) {
+        return (uint32_t*)(*pde & ~(PAGE_SIZE - 1));
+    }
+
+    uint32_t* table = (uint32_t*)pmm_alloc_pages(0);
+    if (!table) return 0;
+    if (*pde & PAGE_PRESENT) {
+        uint32_t base = *pde & ~(LARGE_PAGE_SIZE - 1);
+        uint32_t flags = *pde & (PAGE_WRITE | PAGE_PWT | PAGE_PCD);
+        for (int i = 0; i < 1024; i++) {
+            table[i] = (base + i * PAGE_SIZE) | flags | PAGE_PRESENT;
+        }
+    } else {
+        memset(table, 0, PAGE_SIZE);
+    }
+    *pde = (uint32_t)table | PAGE_PRESENT | PAGE_WRITE;
+    return table;
+}
+
+static void map_pages(uint32_t phys, uint32_t size, uint32_t cache) {
+    if (!have_pat && cache == PAGE_WC) cache = PAGE_UNCACHED;
+    uint32_t addr = phys & ~(PAGE_SIZE - 1);
+    size += phys - addr;
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    while (size) {
+        uint32_t* pde = &page_directory[addr >> 22];
+        int has_table = (*pde & PAGE_PRESENT) && !(*pde & PAGE_LARGE);
+        if (have_pse && !has_table && !(addr & (LARGE_PAGE_SIZE - 1)) && size >= LARGE_PAGE_SIZE) {
+            *pde = addr | cache | PAGE_LARGE | PAGE_WRITE | PAGE_PRESENT;
+            addr += LARGE_PAGE_SIZE;
+            size -= LARGE_PAGE_SIZE;
+            continue;
+        }
+        uint32_t* table = table_for(addr);
+        if (!table) return;
+        table[(addr >> 12) & 1023] = addr | cache | PAGE_WRITE | PAGE_PRESENT;
+        addr += PAGE_SIZE;
+        size -= PAGE_SIZE;
+    }
+}
+
+static void unmap_page(uint32_t addr) {
+    uint32_t* table = table_for(addr);
+    if (table) table[(addr >> 12) & 1023] = 0;
+}
+
+void paging_init() {
+    uint32_t features;
+    cpuid(1, &features);
+    have_pse = (features & CPUID_PSE) != 0;
+    have_pat = (features & CPUID_PAT) != 0;
+
+    // Nothing is mapped with the old PAT yet, so a cache flush is all the switch needs
+    if (have_pat) {
+        __asm__ volatile ("wbinvd");
+        wrmsr(MSR_PAT, PAT_VALUE, PAT_VALUE);
+    }
+
+    // All RAM in 4 MB pages where possible. Below that, the first 4 MB gets a real
+    // table so page 0 can catch null pointers and the VGA window can be WC.
+    uint32_t top = (pmm_highest_address() + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    if (top < LARGE_PAGE_SIZE) top = LARGE_PAGE_SIZE;
+    map_pages(LARGE_PAGE_SIZE, top - LARGE_PAGE_SIZE, PAGE_CACHED);
+    table_for(0);
+    map_pages(PAGE_SIZE, LARGE_PAGE_SIZE - PAGE_SIZE, PAGE_CACHED);
+    map_pages(VGA_WINDOW_START, VGA_WINDOW_END - VGA_WINDOW_START, PAGE_WC);
+    unmap_page(0);
+    unmap_page((uint32_t)stack_guard);
+
+    uint32_t cr0, cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    if (have_pse) cr4 |= CR4_PSE;
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4));
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(page_directory) : "memory");
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_PG | CR0_WP;
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0) : "memory");
+    paging_enabled = 1;
+}
+
+// Application processors load the same page directory but have their own PAT
+void paging_init_cpu() {
+    if (have_pat) {
+        __asm__ volatile ("wbinvd");
+        wrmsr(MSR_PAT, PAT_VALUE, PAT_VALUE);
+    }
+}
+
+void paging_tlb_ipi() {
+    int self = this_cpu()->index;
+    if (!shootdown_asked[self]) return;
+    shootdown_asked[self] = 0;
+    flush_tlb();
+    __asm__ volatile ("lock; decl %0" : "+m"(shootdown_waiting) : : "memory");
+}
+
+// The other CPUs may still hold the old translations. A CPU waiting for
+// its own turn here checks in meanwhile, so two of them can't deadlock.
+static void shootdown() {
+    if (!smp_active()) return;
+    uint32_t flags = irq_save();
+    while (!spin_try_lock(&shootdown_lock)) {
+        paging_tlb_ipi();
+        cpu_relax();
+    }
+    cpu_t* self = this_cpu();
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpu_t* cpu = cpu_get(i);
+        if (cpu == self || !cpu->online) continue;
+        __asm__ volatile ("lock; incl %0" : "+m"(shootdown_waiting) : : "memory");
+        shootdown_asked[i] = 1;
+        apic_send_ipi(cpu->apic_id, VECTOR_TLB_FLUSH);
+    }
+    while (shootdown_waiting) cpu_relax();
+    spin_unlock(&shootdown_lock);
+    irq_restore(flags);
+}
+
+void paging_map(uint32_t phys, uint32_t size, uint32_t cache) {
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+    map_pages(phys, size, cache);
+    if (paging_enabled) flush_tlb();
+    spin_unlock_irqrestore(&paging_lock, flags);
+    if (paging_enabled) shootdown();
+}
+
+void paging_map_framebuffer(uint32_t phys, uint32_t size) {
+    paging_map(phys, size, PAGE_WC);
+}
+
+void paging_unmap(uint32_t addr) {
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+    unmap_page(addr);
+    if (paging_enabled) __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+    spin_unlock_irqrestore(&paging_lock, flags);
+    if (paging_enabled) shootdown();
+}
+
+int paging_has_wc() {
+    return have_pat;
+}
+
+int paging_is_stack_guard(uint32_t addr) {
+    if (addr < PAGE_SIZE) return 0;     // Page 0 is the null page, not a guard
+    uint32_t pde = page_directory[addr >> 22];
+    if (!(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) return 0;
+    uint32_t* table = (uint32_t*)(pde & ~(PAGE_SIZE - 1));
+    return table[(addr >> 12) & 1023] == 0;
+}
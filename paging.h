@@ -0,0 +1,37 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+#define PAGE_PRESENT 0x001
+#define PAGE_WRITE   0x002
+#define PAGE_PWT     0x008
+#define PAGE_PCD     0x010
+#define PAGE_LARGE   0x080      // 4 MB page in a directory entry (PSE)
+
+// Caching attributes for paging_map(); PAT entry 1 is reprogrammed from
+// write-through to write-combining, which is what PWT alone selects
+#define PAGE_CACHED    0
+#define PAGE_WC        PAGE_PWT
+#define PAGE_UNCACHED  (PAGE_PCD | PAGE_PWT)
+
+#define VGA_WINDOW_START 0xA0000
+#define VGA_WINDOW_END   0xC0000
+
+// Identity map all RAM the frame allocator knows about and turn paging on
+void paging_init();
+void paging_init_cpu();
+
+// Identity map [phys, phys + size) with the given caching attribute
+void paging_map(uint32_t phys, uint32_t size, uint32_t cache);
+void paging_map_framebuffer(uint32_t phys, uint32_t size);
+void paging_unmap(uint32_t addr);
+
+// VECTOR_TLB_FLUSH: another CPU changed the page tables
+void paging_tlb_ipi();
+
+int paging_has_wc();
+// True for an address in a deliberately unmapped guard page (boot or thread stack)
+int paging_is_stack_guard(uint32_t addr);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "pipe.h"
+#include "timer.h"
+#include "string.h"
+
+// head and tail only grow and are taken mod PIPE_SIZE, so the ring is full
+// when they are PIPE_SIZE apart. Each end moves only its own counter, so
+// the bytes need no lock; the wait lock is only held to check before
+// sleeping, and each end wakes the other after moving its counter.
+// Cancellation does not wake a sleeper, so a blocked end also wakes every
+// PIPE_POLL_MS to check for it.
+
+#define PIPE_POLL_NS ((uint64_t)PIPE_POLL_MS * NS_PER_MS)
+
+static inline void barrier() {
+    __asm__ volatile ("" : : : "memory");
+}
+
+void pipe_init(pipe_t* p) {
+    p->head = 0;
+    p->tail = 0;
+    p->writer_done = 0;
+    p->reader_done = 0;
+    wait_queue_init(&p->readers);
+    wait_queue_init(&p->writers);
+}
+
+int pipe_write_space(pipe_t* p, char** where) {
+    uint32_t flags = wait_lock_irqsave();
+    while (p->head - p->tail == PIPE_SIZE && !p->reader_done && !thread_should_stop()) {
+        wait_queue_sleep_until(&p->writers, now_ns() + PIPE_POLL_NS);
+    }
+    wait_unlock_irqrestore(flags);
+    if (p->reader_done || thread_should_stop()) return 0;
+
+    uint32_t at = p->head & (PIPE_SIZE - 1);
+    uint32_t free = PIPE_SIZE - (p->head - p->tail);
+    *where = p->buf + at;
+    return free < PIPE_SIZE - at ? free : PIPE_SIZE - at;
+}
+
+void pipe_write_commit(pipe_t* p, int n) {
+    barrier();                     // The bytes land before the reader can see them
+    p->head += n;
+    wait_queue_wake_one(&p->readers);
+}
+
+int pipe_write(pipe_t* p, const char* data, int len) {
+    while (len > 0) {
+        char* space;
+        int n = pipe_write_space(p, &space);
+        if (!n) return 0;
+        if (n > len) n = len;
+        memcpy(space, data, n);
+        pipe_write_commit(p, n);
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+void pipe_close_write(pipe_t* p) {
+    p->writer_done = 1;
+    wait_queue_wake_all(&p->readers);
+}
+
+int pipe_read_data(pipe_t* p, const char** where) {
+    uint32_t flags = wait_lock_irqsave();
+    while (p->head == p->tail && !p->writer_done && !thread_should_stop()) {
+        wait_queue_sleep_until(&p->readers, now_ns() + PIPE_POLL_NS);
+    }
+    wait_unlock_irqrestore(flags);
+    if (thread_should_stop()) return 0;
+
+    // Left behind by a writer that has finished still counts
+    uint32_t head = p->head;
+    barrier();
+    uint32_t at = p->tail & (PIPE_SIZE - 1);
+    uint32_t used = head - p->tail;
+    *where = p->buf + at;
+    return used < PIPE_SIZE - at ? used : PIPE_SIZE - at;
+}
+
+void pipe_read_consume(pipe_t* p, int n) {
+    barrier();                     // Done with the bytes before the writer reuses them
+    p->tail += n;
+    wait_queue_wake_one(&p->writers);
+}
+
+void pipe_close_read(pipe_t* p) {
+    p->reader_done = 1;
+    wait_queue_wake_all(&p->writers);
+}
+
+void pipe_read_lines(pipe_t* p, void (*fn)(const char* line, int len, void* ctx), void* ctx) {
+    char carry[PIPE_LINE_MAX];
+    int carried = 0;
+    const char* data;
+    int n;
+    while ((n = pipe_read_data(p, &data)) > 0) {
+        int start = 0;
+        for (int i = 0; i < n; i++) {
+            if (data[i] != '\n') continue;
+            if (carried) {
+                int add = i - start;
+                if (add > PIPE_LINE_MAX - carried) add = PIPE_LINE_MAX - carried;
+                memcpy(carry + carried, data + start, add);
+                fn(carry, carried + add, ctx);
+                carried = 0;
+            } else {
+                fn(data + start, i - start, ctx);
+            }
+            start = i + 1;
+        }
+
+        // The unfinished end of the piece waits in `carry` for the rest;
+        // past PIPE_LINE_MAX a line is cut short
+        int rest = n - start;
+        if (rest > PIPE_LINE_MAX - carried) rest = PIPE_LINE_MAX - carried;
+        memcpy(carry + carried, data + start, rest);
+        carried += rest;
+        pipe_read_consume(p, n);
+    }
+    if (carried) fn(carry, carried, ctx);
+}
@@ -0,0 +1,44 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <stdint.h>
+#include "thread.h"
+
+#define PIPE_SIZE 4096             // Power of two
+#define PIPE_POLL_MS 20            // How often a blocked end looks for cancellation
+#define PIPE_LINE_MAX 256          // Longest line pipe_read_lines() passes on whole
+
+// Ring buffer between one writer and one reader. The writer fills space in
+// the ring and the reader takes bytes from it in place, so nothing is copied
+// on the way through; a writer that gets ahead waits for the reader.
+typedef struct {
+    char buf[PIPE_SIZE];
+    volatile uint32_t head;        // Written so far; only the writer moves it
+    volatile uint32_t tail;        // Read so far; only the reader moves it
+    volatile int writer_done;
+    volatile int reader_done;
+    wait_queue_t readers;
+    wait_queue_t writers;
+} pipe_t;
+
+void pipe_init(pipe_t* p);
+
+// Writing in place: free space in one piece, waiting while the ring is full.
+// 0 once the reader has gone or the thread is stopped.
+int pipe_write_space(pipe_t* p, char** where);
+void pipe_write_commit(pipe_t* p, int n);
+// Copies `len` bytes in; 0 if the reader went away first
+int pipe_write(pipe_t* p, const char* data, int len);
+void pipe_close_write(pipe_t* p);
+
+// Reading in place: bytes waiting in one piece, waiting while the ring is
+// empty. 0 at the end of the stream or when the thread is stopped.
+int pipe_read_data(pipe_t* p, const char** where);
+void pipe_read_consume(pipe_t* p, int n);
+void pipe_close_read(pipe_t* p);
+
+// Calls `fn` once per line, without the newline. Lines are passed from the
+// ring itself unless they wrap around its end or are split across writes.
+void pipe_read_lines(pipe_t* p, void (*fn)(const char* line, int len, void* ctx), void* ctx);
+
+#endif
@@ -0,0 +1,267 @@
+#include "pmm.h"
+#include <stdint.h>
+#include "string.h"
+#include "io.h"
+#include "spinlock.h"
+
+// Per-frame state, one byte each. Only the first frame of a block carries
+// its order; frames inside a block stay FRAME_TAIL.
+#define FRAME_TAIL     0x00
+#define FRAME_FREE     0x80     // | order: head of a free block
+#define FRAME_USED     0x40     // | order: head of an allocated block
+#define FRAME_USABLE   0x20     // RAM not yet handed to the free lists
+#define FRAME_RESERVED 0xFF
+#define ORDER_MASK     0x0F
+
+#define LOW_MEMORY_END 0x100000 // IVT, BIOS data, boot stack, VGA windows, ROMs
+#define MAX_RESERVED   24
+
+// Free blocks link through their own first bytes; RAM is identity mapped
+typedef struct free_block {
+    struct free_block* next;
+    struct free_block* prev;
+} free_block_t;
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} phys_range_t;
+
+extern uint8_t kernel_start[];
+extern uint8_t kernel_end[];
+
+static spinlock_t pmm_lock;
+static uint8_t* frame_state = 0;
+static uint32_t frame_count = 0;
+static uint32_t usable_pages = 0;
+static uint32_t free_pages = 0;
+static free_block_t* free_lists[PMM_MAX_ORDER + 1];
+static uint32_t free_counts[PMM_MAX_ORDER + 1];
+
+static phys_range_t reserved[MAX_RESERVED];
+static int reserved_count = 0;
+
+static uint32_t page_up(uint32_t addr) {
+    return (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+static void reserve(uint32_t start, uint32_t end) {
+    if (end <= start || reserved_count == MAX_RESERVED) return;
+    reserved[reserved_count].start = start & ~(PAGE_SIZE - 1);
+    reserved[reserved_count].end = page_up(end);
+    reserved_count++;
+}
+
+static void list_push(uint32_t frame, uint32_t order) {
+    free_block_t* block = (free_block_t*)(frame << PAGE_SHIFT);
+    block->prev = 0;
+    block->next = free_lists[order];
+    if (block->next) block->next->prev = block;
+    free_lists[order] = block;
+    free_counts[order]++;
+    frame_state[frame] = FRAME_FREE | order;
+}
+
+static void list_remove(uint32_t frame, uint32_t order) {
+    free_block_t* block = (free_block_t*)(frame << PAGE_SHIFT);
+    if (block->prev) block->prev->next = block->next;
+    else free_lists[order] = block->next;
+    if (block->next) block->next->prev = block->prev;
+    free_counts[order]--;
+    frame_state[frame] = FRAME_TAIL;
+}
+
+// Walk the memory map, clipped to the 32-bit physical space
+typedef void (*region_fn)(uint32_t start, uint32_t end);
+
+static void for_each_region(multiboot_info_t* mbi, region_fn fn) {
+    if (mbi && (mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+        uint32_t addr = mbi->mmap_addr;
+        uint32_t end = mbi->mmap_addr + mbi->mmap_length;
+        while (addr < end) {
+            multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)addr;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->base_high == 0) {
+                uint32_t start = entry->base_low;
+                uint32_t stop = start + entry->length_low;
+                if (entry->length_high || stop < start) stop = 0xFFFFF000;
+                fn(page_up(start), stop & ~(PAGE_SIZE - 1));
+            }
+            addr += entry->size + sizeof(entry->size);
+        }
+    } else if (mbi && (mbi->flags & MULTIBOOT_INFO_MEMORY)) {
+        fn(LOW_MEMORY_END, (LOW_MEMORY_END + mbi->mem_upper * 1024) & ~(PAGE_SIZE - 1));
+    } else {
+        // No boot information: assume the 16 MB every PC we target has
+        fn(LOW_MEMORY_END, 16 * 1024 * 1024);
+    }
+}
+
+static uint32_t highest = 0;
+
+static void note_highest(uint32_t start, uint32_t end) {
+    if (end > start && end > highest) highest = end;
+}
+
+// First spot in [start, end) big enough for `bytes` that avoids every reservation
+static uint32_t placement = 0;
+static uint32_t placement_size = 0;
+
+static void find_placement(uint32_t start, uint32_t end) {
+    if (placement) return;
+    uint32_t candidate = start;
+    for (int moved = 1; moved; ) {
+        moved = 0;
+        for (int i = 0; i < reserved_count; i++) {
+            if (candidate < reserved[i].end && candidate + placement_size > reserved[i].start) {
+                candidate = reserved[i].end;
+                moved = 1;
+            }
+        }
+    }
+    if (candidate >= start && candidate + placement_size <= end) placement = candidate;
+}
+
+// Mark [start, end) usable minus reservations, starting the search at reservation `from`
+static void mark_usable_from(uint32_t start, uint32_t end, int from) {
+    if (end <= start) return;
+    for (int i = from; i < reserved_count; i++) {
+        if (start < reserved[i].end && end > reserved[i].start) {
+            mark_usable_from(start, reserved[i].start, i + 1);
+            mark_usable_from(reserved[i].end, end, i + 1);
+            return;
+        }
+    }
+    for (uint32_t frame = start >> PAGE_SHIFT; frame < (end >> PAGE_SHIFT); frame++) {
+        frame_state[frame] = FRAME_USABLE;
+    }
+}
+
+static void mark_usable(uint32_t start, uint32_t end) {
+    mark_usable_from(start, end, 0);
+}
+
+// Cut a run of usable frames into the largest naturally aligned blocks
+static void release_run(uint32_t frame, uint32_t end) {
+    while (frame < end) {
+        uint32_t order = PMM_MAX_ORDER;
+        while ((frame & ((1u << order) - 1)) || frame + (1u << order) > end) order--;
+        for (uint32_t i = 1; i < (1u << order); i++) frame_state[frame + i] = FRAME_TAIL;
+        list_push(frame, order);
+        free_pages += 1u << order;
+        frame += 1u << order;
+    }
+}
+
+void pmm_init(uint32_t magic, multiboot_info_t* mbi) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) mbi = 0;
+
+    reserve(0, LOW_MEMORY_END);
+    reserve((uint32_t)kernel_start, (uint32_t)kernel_end);
+    if (mbi) {
+        reserve((uint32_t)mbi, (uint32_t)mbi + sizeof(multiboot_info_t));
+        if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+            reserve(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+        }
+        if (mbi->flags & MULTIBOOT_INFO_MODS) {
+            multiboot_module_t* mods = (multiboot_module_t*)mbi->mods_addr;
+            reserve(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t));
+            for (uint32_t i = 0; i < mbi->mods_count; i++) {
+                reserve(mods[i].mod_start, mods[i].mod_end);
+            }
+        }
+    }
+
+    for_each_region(mbi, note_highest);
+    frame_count = highest >> PAGE_SHIFT;
+
+    // The frame state table lives in the first free RAM big enough for it
+    placement_size = page_up(frame_count);
+    for_each_region(mbi, find_placement);
+    if (!placement) return;
+    frame_state = (uint8_t*)placement;
+    memset(frame_state, FRAME_RESERVED, frame_count);
+    reserve(placement, placement + placement_size);
+
+    for_each_region(mbi, mark_usable);
+
+    uint32_t run = 0;
+    for (uint32_t frame = 0; frame <= frame_count; frame++) {
+        int usable = frame < frame_count && frame_state[frame] == FRAME_USABLE;
+        if (usable && !run) run = frame;
+        if (!usable && run) {
+            usable_pages += frame - run;
+            release_run(run, frame);
+            run = 0;
+        }
+    }
+}
+
+// Every CPU and interrupt handler shares the free lists; entry points hold pmm_lock with interrupts off
+uint32_t pmm_alloc_pages(uint32_t order) {
+    if (order > PMM_MAX_ORDER) return 0;
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t found = order;
+    while (found <= PMM_MAX_ORDER && !free_lists[found]) found++;
+    if (found > PMM_MAX_ORDER) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0;
+    }
+
+    uint32_t frame = (uint32_t)free_lists[found] >> PAGE_SHIFT;
+    list_remove(frame, found);
+
+    // Split down, handing the upper halves back to the lower lists
+    while (found > order) {
+        found--;
+        list_push(frame + (1u << found), found);
+    }
+
+    frame_state[frame] = FRAME_USED | order;
+    free_pages -= 1u << order;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return frame << PAGE_SHIFT;
+}
+
+void pmm_free_pages(uint32_t addr) {
+    uint32_t frame = addr >> PAGE_SHIFT;
+    if (!addr || frame >= frame_count || (frame_state[frame] & ~ORDER_MASK) != FRAME_USED) return;
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t order = frame_state[frame] & ORDER_MASK;
+    frame_state[frame] = FRAME_TAIL;
+    free_pages += 1u << order;
+
+    // Coalesce with the buddy for as long as it is a free block of the same size
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1u << order);
+        if (buddy >= frame_count || frame_state[buddy] != (FRAME_FREE | order)) break;
+        list_remove(buddy, order);
+        if (buddy < frame) frame = buddy;
+        order++;
+    }
+    list_push(frame, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+uint32_t pmm_order_for(uint32_t bytes) {
+    uint32_t order = 0;
+    while (order < PMM_MAX_ORDER && ((uint32_t)PAGE_SIZE << order) < bytes) order++;
+    return order;
+}
+
+uint32_t pmm_total_pages() {
+    return usable_pages;
+}
+
+uint32_t pmm_free_page_count() {
+    return free_pages;
+}
+
+uint32_t pmm_highest_address() {
+    return highest;
+}
+
+uint32_t pmm_free_blocks(uint32_t order) {
+    return order <= PMM_MAX_ORDER ? free_counts[order] : 0;
+}
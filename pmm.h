@@ -0,0 +1,25 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+#include "multiboot.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+#define PMM_MAX_ORDER 10        // Largest buddy block: 2^10 pages = 4 MB
+
+void pmm_init(uint32_t magic, multiboot_info_t* mbi);
+
+// Physical address of 2^order contiguous pages, or 0 when none are left
+uint32_t pmm_alloc_pages(uint32_t order);
+void pmm_free_pages(uint32_t addr);
+
+// Smallest order whose block holds `bytes`
+uint32_t pmm_order_for(uint32_t bytes);
+
+uint32_t pmm_total_pages();
+uint32_t pmm_free_page_count();
+uint32_t pmm_highest_address();
+uint32_t pmm_free_blocks(uint32_t order);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "profile.h"
+#include "arena.h"
+#include "kprintf.h"
+#include "timer.h"
+#include "string.h"
+
+#define REPORT_LINES 12            // Slowest lines shown
+#define TEXT_SHOWN 28              // Characters of each line's source
+
+typedef struct {
+    uint32_t count;                // Statements started
+    uint64_t cycles;
+} prof_count_t;
+
+thread_t* profile_thread;
+
+static const char* source;
+static uint32_t line_count;
+static prof_count_t* lines;        // Per source line, from 1
+static uint32_t* order;
+static prof_count_t kinds[PROF_KINDS];
+static uint64_t parts[PROF_PARTS];
+static uint64_t run_start;
+static uint64_t run_cycles;
+
+static const char* kind_names[PROF_KINDS] = {
+    "assignment", "rect", "cube", "print", "if/loops", "calls", "line interp.", "other"
+};
+
+int profile_begin(arena_t* arena, const char* text) {
+    line_count = 2;
+    for (const char* p = text; *p; p++) {
+        if (*p == '\n') line_count++;
+    }
+    lines = (prof_count_t*)arena_alloc(arena, line_count * sizeof(prof_count_t));
+    order = (uint32_t*)arena_alloc(arena, line_count * sizeof(uint32_t));
+    if (!lines || !order) return 0;
+    memset(lines, 0, line_count * sizeof(prof_count_t));
+    memset(kinds, 0, sizeof(kinds));
+    memset(parts, 0, sizeof(parts));
+    source = text;
+    run_start = rdtsc();
+    profile_thread = thread_current();
+    return 1;
+}
+
+void profile_end() {
+    profile_thread = 0;
+    run_cycles = rdtsc() - run_start;
+}
+
+void profile_step(uint32_t line, int kind, int start, uint64_t cycles) {
+    if (line < line_count) {
+        lines[line].count += start;
+        lines[line].cycles += cycles;
+    }
+    kinds[kind].count += start;
+    kinds[kind].cycles += cycles;
+}
+
+void profile_part(int part, uint64_t cycles) {
+    parts[part] += cycles;
+}
+
+// Tenths of a percent, without a 64-bit division
+static uint32_t permille(uint64_t part, uint64_t total) {
+    while (total > 0xFFFFFFFFull) {
+        part >>= 1;
+        total >>= 1;
+    }
+    if (!total) return 0;
+    return (uint32_t)div64_32(part * 1000, (uint32_t)total, 0);
+}
+
+static void print_line_text(uint32_t line, uint8_t color) {
+    const char* p = source;
+    for (uint32_t i = 1; i < line && *p; p++) {
+        if (*p == '\n') i++;
+    }
+    while (*p == ' ' || *p == '\t') p++;
+    char text[TEXT_SHOWN + 1];
+    int len = 0;
+    while (p[len] && p[len] != '\n' && p[len] != '\r' && len < TEXT_SHOWN) {
+        text[len] = p[len];
+        len++;
+    }
+    text[len] = '\0';
+    kprintf(color, "%s\n", text);
+}
+
+void profile_report(uint8_t color) {
+    uint64_t total = 0;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < line_count; i++) {
+        total += lines[i].cycles;
+        if (lines[i].count || lines[i].cycles) order[used++] = i;
+    }
+
+    // Insertion sort, slowest first; scripts are at most a few hundred lines
+    for (uint32_t i = 1; i < used; i++) {
+        uint32_t line = order[i];
+        uint32_t j = i;
+        while (j > 0 && lines[order[j - 1]].cycles < lines[line].cycles) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = line;
+    }
+
+    uint32_t khz = tsc_khz();
+    uint32_t ms = khz ? (uint32_t)div64_32(run_cycles, khz, 0) : 0;
+    kprintf(color, "Profile: %llu kcycles in the VM, %u ms in all (unpaced, no JIT)\n",
+            div64_32(total, 1000, 0), ms);
+    kprintf(color, "line    count   kcycles      %%\n");
+    for (uint32_t i = 0; i < used && i < REPORT_LINES; i++) {
+        prof_count_t* c = &lines[order[i]];
+        uint32_t share = permille(c->cycles, total);
+        kprintf(color, "%4u %8u %9llu %3u.%u  ", order[i], c->count,
+                div64_32(c->cycles, 1000, 0), share / 10, share % 10);
+        print_line_text(order[i], color);
+    }
+
+    kprintf(color, "kind           count   kcycles      %%\n");
+    for (int k = 0; k < PROF_KINDS; k++) {
+        if (!kinds[k].count && !kinds[k].cycles) continue;
+        uint32_t share = permille(kinds[k].cycles, total);
+        kprintf(color, "%-12s %7u %9llu %3u.%u\n", kind_names[k], kinds[k].count,
+                div64_32(kinds[k].cycles, 1000, 0), share / 10, share % 10);
+    }
+    uint32_t subst = permille(parts[PROF_SUBSTITUTE], total);
+    uint32_t draw = permille(parts[PROF_DRAW], total);
+    kprintf(color, "substitution %llu kcycles (%u.%u%%), drawing %llu kcycles (%u.%u%%)\n",
+            div64_32(parts[PROF_SUBSTITUTE], 1000, 0), subst / 10, subst % 10,
+            div64_32(parts[PROF_DRAW], 1000, 0), draw / 10, draw % 10);
+}
@@ -0,0 +1,41 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include "arena.h"
+#include "io.h"
+#include "thread.h"
+
+// Statement kinds, recorded by the compiler for every code word
+enum { PROF_ASSIGN, PROF_RECT, PROF_CUBE, PROF_PRINT, PROF_CONTROL, PROF_CALL, PROF_EXEC, PROF_OTHER, PROF_KINDS };
+
+// Kernel work timed wherever it happens, across all lines
+enum { PROF_SUBSTITUTE, PROF_DRAW, PROF_PARTS };
+
+extern thread_t* profile_thread;   // Being profiled, or 0
+
+static inline int profile_active() {
+    return profile_thread && profile_thread == thread_current();
+}
+
+// Start counting for a script with this source; 0 if out of memory
+int profile_begin(arena_t* arena, const char* source);
+void profile_end();
+
+// `cycles` spent in one op of a statement; `start` is set on its first op
+void profile_step(uint32_t line, int kind, int start, uint64_t cycles);
+void profile_part(int part, uint64_t cycles);
+
+// Lines by time spent, then the statement kinds and the parts
+void profile_report(uint8_t color);
+
+// For timing a part: both are no-ops unless this thread is being profiled
+static inline uint64_t profile_start() {
+    return profile_active() ? rdtsc() : 0;
+}
+
+static inline void profile_stop(int part, uint64_t start) {
+    if (start) profile_part(part, rdtsc() - start);
+}
+
+#endif
@@ -0,0 +1,1524 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "script.h"
+#include "string.h"
+#include "graphics.h"
+#include "console.h"
+#include "thread.h"
+#include "vars.h"
+#include "jit.h"
+#include "profile.h"
+#include "dlist.h"
+#include "command.h"
+
+// The line interpreter in kernel.c runs whatever the compiler leaves as text
+extern int fg_color;
+extern int strlen(const char* str);
+extern int atoi(const char* str);
+extern int execute_single_command(const char* cmd);
+
+#define MAX_LINE 256
+#define MAX_NAME VAR_NAME_MAX
+#define MAX_ARGS 8
+#define MAX_PARAMS 6
+#define STACK_SIZE 256
+#define EXPR_DEPTH (MAX_LINE / 2)  // Most values one line can leave on the stack
+#define CALL_DEPTH 64
+#define SAVE_DEPTH 128             // Locals saved by the calls in progress
+
+enum { ASSIGN_NONE, ASSIGN_LET, ASSIGN_SET, ASSIGN_ADD, ASSIGN_SUB, ASSIGN_INC, ASSIGN_DEC };
+
+enum { LINE_EOF, LINE_TEXT, LINE_CLOSE };
+
+// Names assigned anywhere in the script. Numbers read from a variable that
+// is ever given a value that isn't an integer are left to the line
+// interpreter, which parses the substituted text.
+typedef struct {
+    const char* name;
+    uint8_t dynamic;
+} var_info_t;
+
+typedef struct {
+    arena_t* arena;
+    script_t* s;
+    uint32_t code_cap;
+    uint32_t string_cap;
+    uint32_t slot_cap;
+    uint32_t loop_cap;
+    uint32_t func_cap;
+    uint32_t functions;            // Function bodies compiled so far
+    int in_function;
+    int dry;                       // Parse only: emit nothing, create no slots
+    var_info_t* vars;
+    uint32_t var_count;
+    uint32_t var_cap;
+    const char* source;
+    const char* line_pos;          // Where line_number was counted up to
+    uint32_t line_number;
+    uint32_t where;                // source_map entry for the words being emitted
+    const char* pos;               // Next unread source character
+    const char* line_start;        // Where the line just read starts
+    int failed;                    // Out of memory
+} compiler_t;
+
+// Double an arena-backed array; 0 leaves the old one in place
+static void* grow(compiler_t* c, void* array, uint32_t elem_size, uint32_t* cap) {
+    uint32_t new_cap = *cap ? *cap * 2 : 16;
+    void* bigger = arena_realloc(c->arena, array, *cap * elem_size, new_cap * elem_size);
+    if (!bigger) {
+        c->failed = 1;
+        return 0;
+    }
+    *cap = new_cap;
+    return bigger;
+}
+
+static const char* copy_text(compiler_t* c, const char* text, int len) {
+    char* copy = (char*)arena_alloc(c->arena, len + 1);
+    if (!copy) {
+        c->failed = 1;
+        return "";
+    }
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static void emit(compiler_t* c, int32_t word) {
+    script_t* s = c->s;
+    if (c->dry) return;
+    if (s->length == c->code_cap) {
+        uint32_t old_cap = c->code_cap;
+        int32_t* code = (int32_t*)grow(c, s->code, sizeof(int32_t), &c->code_cap);
+        if (!code) return;
+        s->code = code;
+        uint32_t* map = (uint32_t*)arena_realloc(c->arena, s->source_map, old_cap * sizeof(uint32_t),
+                                                 c->code_cap * sizeof(uint32_t));
+        if (!map) {
+            c->failed = 1;
+            return;
+        }
+        s->source_map = map;
+    }
+    s->source_map[s->length] = c->where;
+    c->where &= ~MAP_START;
+    s->code[s->length++] = word;
+}
+
+// Line of `p`, counting on from the last line asked for
+static uint32_t line_at(compiler_t* c, const char* p) {
+    if (p < c->line_pos) {
+        c->line_pos = c->source;
+        c->line_number = 1;
+    }
+    for (; c->line_pos < p; c->line_pos++) {
+        if (*c->line_pos == '\n') c->line_number++;
+    }
+    return c->line_number;
+}
+
+// The words emitted from now on belong to a new statement on the line just read
+static void start_statement(compiler_t* c, int kind) {
+    c->where = line_at(c, c->line_start) << 8 | MAP_START | kind;
+}
+
+static int32_t add_string(compiler_t* c, const char* text, int len) {
+    script_t* s = c->s;
+    if (s->string_count == c->string_cap) {
+        const char** strings = (const char**)grow(c, s->strings, sizeof(char*), &c->string_cap);
+        if (!strings) return 0;
+        s->strings = strings;
+    }
+    s->strings[s->string_count] = copy_text(c, text, len);
+    return s->string_count++;
+}
+
+static int32_t new_slot(compiler_t* c, var_t* var) {
+    script_t* s = c->s;
+    if (!var) {
+        c->failed = 1;
+        return 0;
+    }
+    if (s->slot_count == c->slot_cap) {
+        var_t** vars = (var_t**)grow(c, s->vars, sizeof(var_t*), &c->slot_cap);
+        if (!vars) return 0;
+        s->vars = vars;
+    }
+    s->vars[s->slot_count] = var;
+    return s->slot_count++;
+}
+
+static int32_t slot_for(compiler_t* c, const char* name) {
+    script_t* s = c->s;
+    var_t* var = var_intern(name, strlen(name));
+    for (uint32_t i = 0; i < s->slot_count; i++) {
+        if (s->vars[i] == var) return i;
+    }
+    return new_slot(c, var);
+}
+
+// Loop counters are not in the variable store; they live with the script
+static int32_t hidden_slot(compiler_t* c) {
+    var_t* var = (var_t*)arena_alloc(c->arena, sizeof(var_t));
+    if (var) {
+        memset(var, 0, sizeof(var_t));
+        var->type = VAR_INT;
+    }
+    return new_slot(c, var);
+}
+
+static var_info_t* find_var(compiler_t* c, const char* name) {
+    for (uint32_t i = 0; i < c->var_count; i++) {
+        if (strcmp(c->vars[i].name, name) == 0) return &c->vars[i];
+    }
+    return 0;
+}
+
+static void add_var(compiler_t* c, const char* name) {
+    if (!*name || find_var(c, name)) return;
+    if (c->var_count == c->var_cap) {
+        var_info_t* vars = (var_info_t*)grow(c, c->vars, sizeof(var_info_t), &c->var_cap);
+        if (!vars) return;
+        c->vars = vars;
+    }
+    c->vars[c->var_count].name = copy_text(c, name, strlen(name));
+    c->vars[c->var_count].dynamic = 0;
+    c->var_count++;
+}
+
+static int is_space(char ch) {
+    return ch == ' ' || ch == '\t';
+}
+
+static const char* skip_spaces(const char* p) {
+    while (is_space(*p)) p++;
+    return p;
+}
+
+static int is_lower(char ch) {
+    return ch >= 'a' && ch <= 'z';
+}
+
+// Characters substitute_variables accepts after a '$'
+static int is_name_char(char ch) {
+    return is_lower(ch) || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_';
+}
+
+static int parse_literal(const char* tok, int32_t* value) {
+    const char* p = tok;
+    int negative = 0;
+    if (*p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (*p < '0' || *p > '9') return 0;
+    int32_t result = 0;
+    while (*p >= '0' && *p <= '9') result = result * 10 + (*p++ - '0');
+    if (*p) return 0;
+    *value = negative ? -result : result;
+    return 1;
+}
+
+// The variable a $name or bare lowercase token stands for, if it is one
+static const char* operand_name(const char* tok) {
+    const char* name = tok;
+    if (*tok == '$') name++;
+    int len = 0;
+    for (const char* p = name; *p; p++, len++) {
+        if (*tok == '$' ? !is_name_char(*p) : !is_lower(*p)) return 0;
+    }
+    return len > 0 && len < MAX_NAME ? name : 0;
+}
+
+// Whether a token always evaluates to an integer
+static int int_operand(compiler_t* c, const char* tok) {
+    int32_t value;
+    if (parse_literal(tok, &value)) return 1;
+    const char* name = operand_name(tok);
+    var_info_t* var = name ? find_var(c, name) : 0;
+    return var && !var->dynamic;
+}
+
+// Copy `text` to `out` if it is exactly one token
+static int single_token(const char* text, char* out) {
+    const char* p = skip_spaces(text);
+    int len = 0;
+    while (*p && !is_space(*p)) out[len++] = *p++;
+    out[len] = '\0';
+    return len > 0 && *skip_spaces(p) == '\0';
+}
+
+// Split a copy of `line` into `args`; returns the token count even past `max`.
+// Spaces inside parentheses don't split, so (x + 1) is one argument.
+static int split_args(const char* line, char* buf, char** args, int max) {
+    int count = 0;
+    strcpy(buf, line);
+    char* p = buf;
+    while (1) {
+        while (is_space(*p)) *p++ = '\0';
+        if (!*p) break;
+        if (count < max) args[count] = p;
+        count++;
+        int depth = 0;
+        while (*p && (depth > 0 || !is_space(*p))) {
+            if (*p == '(') depth++;
+            if (*p == ')') depth--;
+            p++;
+        }
+    }
+    return count;
+}
+
+// The part of a for/if/while/function line before its '{'
+static void header_text(const char* line, char* out) {
+    int len = 0;
+    while (line[len] && line[len] != '{') {
+        out[len] = line[len];
+        len++;
+    }
+    out[len] = '\0';
+}
+
+// Recognise the same assignments as parse_let_command and parse_assignment,
+// and "local" like "let"; `value` points at the text after the operator
+static int scan_assignment(const char* line, char* name, const char** value) {
+    const char* p = 0;
+    int len = 0;
+    if (strncmp(line, "let ", 4) == 0) p = line + 4;
+    if (strncmp(line, "local ", 6) == 0) p = line + 6;
+    if (p) {
+        p = skip_spaces(p);
+        while (*p && !is_space(*p) && *p != '=' && len < MAX_NAME - 1) name[len++] = *p++;
+        name[len] = '\0';
+        while (is_space(*p) || *p == '=') p++;
+        *value = p;
+        return len ? ASSIGN_LET : ASSIGN_NONE;
+    }
+
+    p = skip_spaces(line);
+    while (*p && !is_space(*p) && *p != '+' && *p != '-' && *p != '=' && len < MAX_NAME - 1) name[len++] = *p++;
+    name[len] = '\0';
+    if (!len) return ASSIGN_NONE;
+    p = skip_spaces(p);
+    int kind = ASSIGN_NONE;
+    if (p[0] == '+' && p[1] == '=') kind = ASSIGN_ADD;
+    else if (p[0] == '-' && p[1] == '=') kind = ASSIGN_SUB;
+    else if (p[0] == '+' && p[1] == '+') kind = ASSIGN_INC;
+    else if (p[0] == '-' && p[1] == '-') kind = ASSIGN_DEC;
+    else if (p[0] == '=' && p[1] != '=') {
+        *value = skip_spaces(p + 1);
+        return ASSIGN_SET;
+    }
+    if (kind != ASSIGN_NONE) *value = skip_spaces(p + 2);
+    return kind;
+}
+
+static int find_func(compiler_t* c, const char* name) {
+    for (uint32_t i = 0; i < c->s->func_count; i++) {
+        if (strcmp(c->s->funcs[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Functions are known before any code is compiled, so they can be called
+// above their definition; the parameters are variables like any other
+static void add_function(compiler_t* c, const char* line) {
+    char header[MAX_LINE];
+    char buf[MAX_LINE];
+    char* args[MAX_PARAMS + 2];
+    header_text(line, header);
+    int argc = split_args(header, buf, args, MAX_PARAMS + 2);
+    if (argc < 2 || argc > MAX_PARAMS + 2 || strlen(args[1]) >= MAX_NAME || find_func(c, args[1]) >= 0) return;
+
+    script_t* s = c->s;
+    if (s->func_count == c->func_cap) {
+        script_func_t* funcs = (script_func_t*)grow(c, s->funcs, sizeof(script_func_t), &c->func_cap);
+        if (!funcs) return;
+        s->funcs = funcs;
+    }
+    s->funcs[s->func_count].name = copy_text(c, args[1], strlen(args[1]));
+    s->funcs[s->func_count].entry = 0;
+    s->funcs[s->func_count].params = argc - 2;
+    s->func_count++;
+    for (int i = 2; i < argc; i++) {
+        if (strlen(args[i]) < MAX_NAME) add_var(c, args[i]);
+    }
+}
+
+// Integer expressions with C precedence. Constants are folded as they are
+// parsed: one is only pushed once it meets something that isn't constant.
+typedef struct {
+    int constant;
+    int32_t value;                 // If constant; otherwise the code leaves it on the stack
+} operand_t;
+
+typedef struct {
+    const char* text;
+    int prec;
+    int32_t op;
+} binary_op_t;
+
+// Two-character operators first, so "<<" isn't taken for "<"
+static const binary_op_t binary_ops[] = {
+    { "<<", 5, OP_SHL }, { ">>", 5, OP_SHR }, { "<=", 4, OP_LE }, { ">=", 4, OP_GE },
+    { "==", 3, OP_EQ }, { "!=", 3, OP_NE },
+    { "*", 7, OP_MUL }, { "/", 7, OP_DIV }, { "%", 7, OP_MOD },
+    { "+", 6, OP_ADD }, { "-", 6, OP_SUB }, { "<", 4, OP_LT }, { ">", 4, OP_GT },
+    { "&", 2, OP_AND }, { "|", 1, OP_OR },
+};
+
+int32_t script_div(int32_t a, int32_t b) {
+    if (b == 0) return 0;
+    if (b == -1) return 0u - (uint32_t)a;    // INT_MIN / -1 would trap
+    return a / b;
+}
+
+int32_t script_mod(int32_t a, int32_t b) {
+    if (b == 0 || b == -1) return 0;
+    return a % b;
+}
+
+// One binary operator, for folding and for the VM; wraps like the machine does
+static int32_t arith(int32_t op, int32_t a, int32_t b) {
+    uint32_t x = a;
+    uint32_t y = b;
+    switch (op) {
+    case OP_ADD: return x + y;
+    case OP_SUB: return x - y;
+    case OP_MUL: return x * y;
+    case OP_DIV: return script_div(a, b);
+    case OP_MOD: return script_mod(a, b);
+    case OP_SHL: return x << (y & 31);
+    case OP_SHR: return a >> (y & 31);
+    case OP_AND: return a & b;
+    case OP_OR: return a | b;
+    case OP_EQ: return a == b;
+    case OP_NE: return a != b;
+    case OP_LT: return a < b;
+    case OP_GT: return a > b;
+    case OP_LE: return a <= b;
+    default: return a >= b;
+    }
+}
+
+typedef struct {
+    const char* p;
+    int bad;
+} expr_t;
+
+static void push_operand(compiler_t* c, operand_t* o) {
+    if (!o->constant) return;
+    emit(c, OP_PUSH);
+    emit(c, o->value);
+    o->constant = 0;
+}
+
+// Push a held-back constant underneath the code emitted since `mark`
+static void insert_push(compiler_t* c, uint32_t mark, int32_t value) {
+    emit(c, 0);
+    emit(c, 0);
+    if (c->dry || c->failed) return;
+    int32_t* code = c->s->code;
+    uint32_t* map = c->s->source_map;
+    memmove(code + mark + 2, code + mark, (c->s->length - 2 - mark) * sizeof(int32_t));
+    memmove(map + mark + 2, map + mark, (c->s->length - 2 - mark) * sizeof(uint32_t));
+    code[mark] = OP_PUSH;
+    code[mark + 1] = value;
+    map[mark] = map[mark + 2];           // Takes over MAP_START if the statement began there
+    map[mark + 1] = map[mark + 2] = map[mark] & ~MAP_START;
+}
+
+static int is_name_start(char ch) {
+    return is_lower(ch) || (ch >= 'A' && ch <= 'Z') || ch == '_';
+}
+
+static void parse_binary(compiler_t* c, expr_t* e, int min_prec, operand_t* left);
+
+// NAME(ARG, ...), after the '('
+static void parse_call(compiler_t* c, expr_t* e, int func) {
+    uint32_t count = 0;
+    e->p = skip_spaces(e->p);
+    if (*e->p == ')') {
+        e->p++;
+    } else {
+        while (!e->bad) {
+            operand_t arg;
+            parse_binary(c, e, 0, &arg);
+            push_operand(c, &arg);
+            count++;
+            e->p = skip_spaces(e->p);
+            if (*e->p == ')') {
+                e->p++;
+                break;
+            }
+            if (*e->p++ != ',') e->bad = 1;
+        }
+    }
+    if (count != c->s->funcs[func].params) e->bad = 1;
+    emit(c, OP_CALL);
+    emit(c, func);
+}
+
+static void parse_unary(compiler_t* c, expr_t* e, operand_t* out) {
+    out->constant = 0;
+    e->p = skip_spaces(e->p);
+    char ch = *e->p;
+    if (ch == '(') {
+        e->p++;
+        parse_binary(c, e, 0, out);
+        e->p = skip_spaces(e->p);
+        if (*e->p == ')') {
+            e->p++;
+        } else {
+            e->bad = 1;
+        }
+        return;
+    }
+    if (ch == '-') {
+        e->p++;
+        parse_unary(c, e, out);
+        if (out->constant) {
+            out->value = 0u - (uint32_t)out->value;
+        } else {
+            emit(c, OP_NEG);
+        }
+        return;
+    }
+    if (ch >= '0' && ch <= '9') {
+        uint32_t value = 0;
+        while (*e->p >= '0' && *e->p <= '9') value = value * 10 + (*e->p++ - '0');
+        out->constant = 1;
+        out->value = value;
+        return;
+    }
+
+    // $name, name, or a call
+    char name[MAX_NAME];
+    int len = 0;
+    const char* p = ch == '$' ? e->p + 1 : e->p;
+    if (is_name_start(*p)) {
+        while (is_name_char(*p) && len < MAX_NAME - 1) name[len++] = *p++;
+    }
+    name[len] = '\0';
+    if (!len || is_name_char(*p)) {
+        e->bad = 1;
+        return;
+    }
+    if (ch != '$' && *p == '(') {
+        int func = find_func(c, name);
+        e->p = p + 1;
+        if (func < 0) {
+            e->bad = 1;
+            return;
+        }
+        parse_call(c, e, func);
+        return;
+    }
+    e->p = p;
+    if (!find_var(c, name)) {
+        e->bad = 1;
+        return;
+    }
+    if (!c->dry) {
+        int32_t slot = slot_for(c, name);
+        emit(c, OP_LOAD);
+        emit(c, slot);
+    }
+}
+
+static void parse_binary(compiler_t* c, expr_t* e, int min_prec, operand_t* left) {
+    parse_unary(c, e, left);
+    while (!e->bad) {
+        e->p = skip_spaces(e->p);
+        const binary_op_t* op = 0;
+        for (uint32_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+            int len = strlen(binary_ops[i].text);
+            if (strncmp(e->p, binary_ops[i].text, len) == 0) {
+                op = &binary_ops[i];
+                break;
+            }
+        }
+        if (!op || op->prec < min_prec) return;
+        e->p += strlen(op->text);
+
+        uint32_t mark = c->s->length;
+        operand_t right;
+        parse_binary(c, e, op->prec + 1, &right);
+        if (left->constant && right.constant) {
+            left->value = arith(op->op, left->value, right.value);
+            continue;
+        }
+        if (left->constant) {
+            insert_push(c, mark, left->value);
+            left->constant = 0;
+        }
+        push_operand(c, &right);
+        emit(c, op->op);
+    }
+}
+
+// All of `text` as an expression, with a constant result left in `out`
+// rather than pushed; 0, with nothing emitted, if it isn't one
+static int parse_expression(compiler_t* c, const char* text, operand_t* out) {
+    uint32_t mark = c->s->length;
+    expr_t e;
+    e.p = text;
+    e.bad = 0;
+    parse_binary(c, &e, 0, out);
+    if (!e.bad && *skip_spaces(e.p) == '\0') return 1;
+    c->s->length = mark;
+    return 0;
+}
+
+// An expression for an assignment or a command argument. A lone variable
+// must hold an integer: otherwise substitution would give its text.
+static int compile_expression(compiler_t* c, const char* text, operand_t* out) {
+    char tok[MAX_LINE];
+    int32_t value;
+    if (single_token(text, tok) && !parse_literal(tok, &value) && operand_name(tok) && !int_operand(c, tok)) {
+        return 0;
+    }
+    return parse_expression(c, text, out);
+}
+
+static int emit_expression(compiler_t* c, const char* text) {
+    operand_t o;
+    if (!compile_expression(c, text, &o)) return 0;
+    push_operand(c, &o);
+    return 1;
+}
+
+static int value_is_int(compiler_t* c, int kind, const char* value) {
+    if (kind == ASSIGN_LET && !*value) return 1;   // "let x" sets 0
+    operand_t o;
+    c->dry = 1;
+    int is_int = compile_expression(c, value, &o);
+    c->dry = 0;
+    return is_int;
+}
+
+// Lines for the pre-pass; with `split_braces` loop bodies on the same line as their braces count too
+static int next_fragment(const char** pos, char* out, int split_braces) {
+    const char* p = *pos;
+    while (*p == '\n' || *p == '\r' || (split_braces && (*p == '{' || *p == '}'))) p++;
+    if (!*p) return 0;
+    int len = 0;
+    while (*p && *p != '\n' && *p != '\r' && !(split_braces && (*p == '{' || *p == '}'))) {
+        if (len < MAX_LINE - 1) out[len++] = *p;
+        p++;
+    }
+    out[len] = '\0';
+    *pos = p;
+    return 1;
+}
+
+// Find every variable the script assigns, then mark those that are ever
+// given something other than an integer, until nothing changes
+static void collect_variables(compiler_t* c, const char* source) {
+    char line[MAX_LINE];
+    char name[MAX_NAME];
+    const char* value;
+
+    for (int split = 0; split < 2; split++) {
+        const char* p = source;
+        while (next_fragment(&p, line, split)) {
+            const char* t = skip_spaces(line);
+            if (*t == '#') continue;
+            if (strncmp(t, "for ", 4) == 0) {
+                char tok[MAX_LINE];
+                char* args[2];
+                if (split_args(t, tok, args, 2) >= 2 && strlen(args[1]) < MAX_NAME) add_var(c, args[1]);
+            } else if (strncmp(t, "function ", 9) == 0) {
+                add_function(c, t);
+            } else if (scan_assignment(t, name, &value) != ASSIGN_NONE) {
+                add_var(c, name);
+            }
+        }
+    }
+
+    int changed = 1;
+    while (changed && !c->failed) {
+        changed = 0;
+        for (int split = 0; split < 2; split++) {
+            const char* p = source;
+            while (next_fragment(&p, line, split)) {
+                const char* t = skip_spaces(line);
+                if (*t == '#') continue;
+                int kind = scan_assignment(t, name, &value);
+                if ((kind == ASSIGN_LET || kind == ASSIGN_SET) && !value_is_int(c, kind, value)) {
+                    var_info_t* var = find_var(c, name);
+                    if (var && !var->dynamic) {
+                        var->dynamic = 1;
+                        changed = 1;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Text with nothing substitute_variables would replace
+static int literal_text(compiler_t* c, const char* text) {
+    char name[MAX_NAME];
+    for (const char* p = text; *p; ) {
+        if (*p == '$') return 0;
+        if (!is_lower(*p)) {
+            p++;
+            continue;
+        }
+        int len = 0;
+        while (is_lower(*p) && len < MAX_NAME - 1) name[len++] = *p++;
+        name[len] = '\0';
+        if (find_var(c, name)) return 0;
+    }
+    return 1;
+}
+
+static int compile_assignment(compiler_t* c, int kind, const char* name, const char* value) {
+    if (!find_var(c, name)) return 0;
+    int32_t slot = slot_for(c, name);
+    operand_t amount;
+
+    switch (kind) {
+    case ASSIGN_INC:
+    case ASSIGN_DEC:
+        emit(c, OP_ADD_IMM);
+        emit(c, slot);
+        emit(c, kind == ASSIGN_INC ? 1 : -1);
+        return 1;
+    case ASSIGN_ADD:
+    case ASSIGN_SUB:
+        emit(c, OP_LOAD);
+        emit(c, slot);
+        if (!compile_expression(c, value, &amount)) return 0;
+        if (amount.constant) {
+            c->s->length -= 2;
+            emit(c, OP_ADD_IMM);
+            emit(c, slot);
+            emit(c, kind == ASSIGN_ADD ? amount.value : (int32_t)(0u - (uint32_t)amount.value));
+            return 1;
+        }
+        emit(c, kind == ASSIGN_ADD ? OP_ADD : OP_SUB);
+        break;
+    default:
+        if (kind == ASSIGN_LET && !*value) {
+            emit(c, OP_PUSH);
+            emit(c, 0);
+        } else if (emit_expression(c, value)) {
+            // Pushed
+        } else if (literal_text(c, value)) {
+            emit(c, OP_SET_TEXT);
+            emit(c, slot);
+            emit(c, add_string(c, value, strlen(value)));
+            return 1;
+        } else {
+            return 0;
+        }
+        break;
+    }
+    emit(c, OP_STORE);
+    emit(c, slot);
+    return 1;
+}
+
+// Substitution for print text is resolved here: literal runs become strings,
+// variables become slot reads
+static int compile_print(compiler_t* c, const char* text) {
+    char lit[MAX_LINE];
+    char name[MAX_NAME];
+    int len = 0;
+    const char* p = text;
+
+    while (*p) {
+        const char* start = p;
+        int name_len = 0;
+        int dollar = *p == '$';
+        if (dollar) {
+            p++;
+            while (is_name_char(*p) && name_len < MAX_NAME - 1) name[name_len++] = *p++;
+        } else if (is_lower(*p)) {
+            while (is_lower(*p) && name_len < MAX_NAME - 1) name[name_len++] = *p++;
+        } else {
+            lit[len++] = *p++;
+            continue;
+        }
+        name[name_len] = '\0';
+
+        var_info_t* var = name_len ? find_var(c, name) : 0;
+        // Bare words in front of an assignment operator are left alone
+        if (var && !dollar) {
+            const char* q = skip_spaces(p);
+            if (((q[0] == '+' || q[0] == '-') && (q[1] == q[0] || q[1] == '=')) ||
+                ((q[0] == '*' || q[0] == '/') && q[1] == '=') || (q[0] == '=' && q[1] != '=')) {
+                var = 0;
+            }
+        }
+        if (!var) {
+            while (start < p) lit[len++] = *start++;
+            continue;
+        }
+        if (len) {
+            emit(c, OP_PRINT_STR);
+            emit(c, add_string(c, lit, len));
+            len = 0;
+        }
+        int32_t slot = slot_for(c, name);
+        emit(c, OP_PRINT_VAR);
+        emit(c, slot);
+        emit(c, add_string(c, start, p - start));
+    }
+    if (len) {
+        emit(c, OP_PRINT_STR);
+        emit(c, add_string(c, lit, len));
+    }
+    emit(c, OP_NEWLINE);
+    return 1;
+}
+
+static void compile_error(compiler_t* c, const char* what, const char* text) {
+    c->s->errors++;
+    console_write("ERROR: ", VGA_RED);
+    console_write(what, VGA_RED);
+    console_write(": ", VGA_RED);
+    console_write(text, VGA_RED);
+    console_putc('\n', VGA_RED);
+}
+
+// NAME ARG... calls a function and drops what it returns
+static int compile_call(compiler_t* c, int func, int argc, char** args, const char* line) {
+    if ((uint32_t)argc != c->s->funcs[func].params) {
+        compile_error(c, "wrong number of arguments", line);
+        return 1;
+    }
+    for (int i = 0; i < argc; i++) {
+        if (!emit_expression(c, args[i])) {
+            compile_error(c, "bad argument", args[i]);
+            return 1;
+        }
+    }
+    emit(c, OP_CALL);
+    emit(c, func);
+    emit(c, OP_POP);
+    return 1;
+}
+
+static int compile_statement(compiler_t* c, const char* line) {
+    char name[MAX_NAME];
+    const char* value;
+    int kind = scan_assignment(line, name, &value);
+    if (kind != ASSIGN_NONE) return compile_assignment(c, kind, name, value);
+
+    char buf[MAX_LINE];
+    char* args[MAX_ARGS];
+    int argc = split_args(line, buf, args, MAX_ARGS);
+    int func = find_func(c, args[0]);
+    if (func >= 0) return compile_call(c, func, argc - 1, args + 1, line);
+    if (argc == 1 && strstr(args[0], "(") && emit_expression(c, line)) {
+        emit(c, OP_POP);                   // f(x) on its own
+        return 1;
+    }
+    if (find_var(c, args[0])) return 0;    // Substitution would rewrite the command itself
+    if (command_is_pipeline(line, CMD_SCRIPT)) return 0;    // Its stages run as threads
+
+    if (strncmp(line, "print ", 6) == 0) return compile_print(c, skip_spaces(line + 6));
+    if (strncmp(line, "echo ", 5) == 0) return compile_print(c, skip_spaces(line + 5));
+    if (strcmp(line, "modex") == 0) {
+        emit(c, OP_MODEX);
+        return 1;
+    }
+    if (strcmp(line, "frame") == 0) {
+        emit(c, OP_FRAME);
+        return 1;
+    }
+
+    int op, operands;
+    if (strcmp(args[0], "fps") == 0) {
+        op = OP_FPS;
+        operands = 1;
+    } else if (strcmp(args[0], "rect") == 0) {
+        op = OP_RECT;
+        operands = 5;
+    } else if (strcmp(args[0], "cube") == 0) {
+        op = OP_CUBE;
+        operands = 7;
+    } else {
+        return 0;
+    }
+    if (argc != operands + 1) return 0;
+    for (int i = 1; i <= operands; i++) {
+        if (!emit_expression(c, args[i])) return 0;
+    }
+    emit(c, op);
+    return 1;
+}
+
+// Anything the compiler can't do natively runs as text on the line interpreter
+static void compile_line(compiler_t* c, const char* line) {
+    uint32_t mark = c->s->length;
+    uint32_t where = c->where;
+    if (compile_statement(c, line)) return;
+    c->s->length = mark;
+    c->where = (where & ~0x7F) | PROF_EXEC;
+    int32_t text = add_string(c, line, strlen(line));
+    emit(c, OP_EXEC);
+    emit(c, text);
+    c->s->fallback_lines++;
+}
+
+// Read the next line. Inside a loop body the '}' matching the body ends
+// the line, and on its own closes the body.
+static int next_line(compiler_t* c, char* line, int in_body) {
+    const char* p = c->pos;
+    if (!*p) return LINE_EOF;
+    if (in_body && *p == '}') {
+        c->pos = p + 1;
+        return LINE_CLOSE;
+    }
+    c->line_start = p;
+    int len = 0;
+    int depth = 0;
+    while (*p && *p != '\n' && *p != '\r' && len < MAX_LINE - 1) {
+        if (*p == '{') depth++;
+        if (*p == '}' && in_body && depth-- == 0) break;
+        line[len++] = *p++;
+    }
+    line[len] = '\0';
+    while (*p == '\n' || *p == '\r') p++;
+    c->pos = p;
+    return LINE_TEXT;
+}
+
+static void compile_block(compiler_t* c, int in_body);
+
+// Find the '{' after a header, on its line or further down, and carry on after it
+static int open_body(compiler_t* c) {
+    const char* brace = c->line_start;
+    while (*brace && *brace != '\n' && *brace != '\r' && *brace != '{') brace++;
+    if (*brace != '{') {
+        while (is_space(*brace) || *brace == '\n' || *brace == '\r') brace++;
+        if (*brace != '{') {
+            console_write("ERROR: No opening brace found!\n", VGA_RED);
+            c->s->errors++;
+            return 0;
+        }
+    }
+    c->pos = brace + 1;
+    return 1;
+}
+
+// A loop bound: a literal or variable, anything else reads as a number like atoi()
+static void emit_bound(compiler_t* c, const char* tok) {
+    if (tok && emit_expression(c, tok)) return;
+    emit(c, OP_PUSH);
+    emit(c, tok ? atoi(tok) : 0);
+}
+
+// for NAME FIRST LAST { ... } runs the body with NAME = FIRST..LAST; the
+// counter is a hidden slot, so the body can change NAME without upsetting it
+static void compile_for(compiler_t* c, const char* header) {
+    if (!open_body(c)) return;
+
+    char buf[MAX_LINE];
+    char* args[4];
+    char text[MAX_LINE];
+    header_text(header, text);
+    int argc = split_args(text, buf, args, 4);
+    if (argc < 2 || strlen(args[1]) >= MAX_NAME) {
+        compile_block(c, 1);                 // Skip the body
+        return;
+    }
+    int32_t slot = slot_for(c, args[1]);
+    int32_t counter = hidden_slot(c);
+    int32_t limit = hidden_slot(c);
+
+    emit_bound(c, argc > 2 ? args[2] : 0);
+    emit(c, OP_STORE);
+    emit(c, counter);
+    emit_bound(c, argc > 3 ? args[3] : 0);
+    emit(c, OP_STORE);
+    emit(c, limit);
+
+    script_t* s = c->s;
+    if (s->loop_count == c->loop_cap) {
+        script_loop_t* loops = (script_loop_t*)grow(c, s->loops, sizeof(script_loop_t), &c->loop_cap);
+        if (!loops) return;
+        s->loops = loops;
+    }
+    script_loop_t* loop = &s->loops[s->loop_count];
+    memset(loop, 0, sizeof(script_loop_t));
+    loop->enter = s->length;
+    uint32_t loop_at = s->length + 1;
+    emit(c, OP_ENTER);
+    emit(c, s->loop_count++);
+
+    uint32_t top = s->length;
+    emit(c, OP_LOOP_TEST);
+    emit(c, counter);
+    emit(c, limit);
+    uint32_t exit_at = s->length;
+    emit(c, 0);
+    emit(c, OP_COPY);
+    emit(c, slot);
+    emit(c, counter);
+
+    compile_block(c, 1);
+
+    emit(c, OP_NEXT);
+    emit(c, counter);
+    emit(c, top);
+    if (c->failed) return;
+    // The loop array may have moved while the body added loops of its own
+    s->code[exit_at] = s->length;
+    s->loops[s->code[loop_at]].exit = s->length;
+}
+
+static void patch(compiler_t* c, int32_t at) {
+    if (at >= 0 && !c->failed) c->s->code[at] = c->s->length;
+}
+
+typedef struct {
+    uint32_t length;
+    uint32_t loops;
+    uint32_t functions;
+} code_mark_t;
+
+static void mark_code(compiler_t* c, code_mark_t* mark) {
+    mark->length = c->s->length;
+    mark->loops = c->s->loop_count;
+    mark->functions = c->functions;
+}
+
+// Throw away code that can never run, unless it defines loops or
+// functions: those are numbered, so they stay
+static int drop_code(compiler_t* c, code_mark_t* mark) {
+    if (c->s->loop_count != mark->loops || c->functions != mark->functions) return 0;
+    c->s->length = mark->length;
+    return 1;
+}
+
+// A condition for if or while; a constant one decides at load time
+static void compile_condition(compiler_t* c, const char* text, operand_t* test) {
+    if (!parse_expression(c, text, test)) {
+        compile_error(c, "bad condition", text);
+        test->constant = 1;
+        test->value = 0;
+    }
+}
+
+// "else" after the closing brace, on the same line or the next
+static int open_else(compiler_t* c) {
+    const char* p = c->pos;
+    while (is_space(*p) || *p == '\n' || *p == '\r') p++;
+    if (strncmp(p, "else", 4) != 0 || is_name_char(p[4])) return 0;
+    c->pos = p + 4;
+    return 1;
+}
+
+static void compile_if(compiler_t* c, const char* header);
+
+static void compile_else(compiler_t* c) {
+    char line[MAX_LINE];
+    const char* p = skip_spaces(c->pos);
+    if (strncmp(p, "if ", 3) == 0) {
+        c->pos = p;
+        next_line(c, line, 1);
+        start_statement(c, PROF_CONTROL);
+        compile_if(c, line + 3);
+        return;
+    }
+    c->line_start = c->pos;
+    if (!open_body(c)) return;
+    compile_block(c, 1);
+}
+
+// if COND { ... } else if COND { ... } else { ... }
+static void compile_if(compiler_t* c, const char* header) {
+    char cond[MAX_LINE];
+    header_text(header, cond);
+    operand_t test;
+    if (!open_body(c)) return;
+    compile_condition(c, cond, &test);
+    int never = test.constant && !test.value;
+    int always = test.constant && test.value;
+
+    code_mark_t then_mark;
+    mark_code(c, &then_mark);
+    int32_t skip = -1;
+    if (!always) {
+        emit(c, never ? OP_JUMP : OP_JUMP_FALSE);
+        skip = c->s->length;
+        emit(c, 0);
+    }
+    compile_block(c, 1);
+    int has_else = open_else(c);
+    if (never && drop_code(c, &then_mark)) skip = -1;
+    if (!has_else) {
+        patch(c, skip);
+        return;
+    }
+
+    code_mark_t else_mark;
+    mark_code(c, &else_mark);
+    int32_t end = -1;
+    if (skip >= 0 || always) {
+        emit(c, OP_JUMP);
+        end = c->s->length;
+        emit(c, 0);
+    }
+    patch(c, skip);
+    compile_else(c);
+    if (always && drop_code(c, &else_mark)) end = -1;
+    patch(c, end);
+}
+
+// while COND { ... }; unlike for, iterations aren't paced to the frame rate
+static void compile_while(compiler_t* c, const char* header) {
+    char cond[MAX_LINE];
+    header_text(header, cond);
+    operand_t test;
+    if (!open_body(c)) return;
+
+    code_mark_t mark;
+    mark_code(c, &mark);
+    uint32_t top = c->s->length;
+    compile_condition(c, cond, &test);
+    int32_t exit = -1;
+    if (!test.constant || !test.value) {
+        emit(c, test.constant ? OP_JUMP : OP_JUMP_FALSE);
+        exit = c->s->length;
+        emit(c, 0);
+    }
+    compile_block(c, 1);
+    emit(c, OP_LOOP);
+    emit(c, top);
+    if (test.constant && !test.value && drop_code(c, &mark)) return;
+    patch(c, exit);
+}
+
+// function NAME PARAM... { ... }. The body sits behind a jump; a call saves
+// the parameters as locals, then pops the arguments into them.
+static void compile_function(compiler_t* c, const char* header) {
+    char buf[MAX_LINE];
+    char* args[MAX_PARAMS + 2];
+    char text[MAX_LINE];
+    header_text(header, text);
+    if (!open_body(c)) return;
+    int argc = split_args(text, buf, args, MAX_PARAMS + 2);
+    int func = argc >= 2 ? find_func(c, args[1]) : -1;
+    if (func < 0 || (uint32_t)argc != c->s->funcs[func].params + 2) {
+        compile_error(c, "bad function", text);
+        compile_block(c, 1);                 // Skip the body
+        return;
+    }
+
+    emit(c, OP_JUMP);
+    int32_t over = c->s->length;
+    emit(c, 0);
+    uint32_t body = c->s->length;
+    uint32_t first_slot = c->s->slot_count;
+    c->s->funcs[func].entry = body;
+    for (int i = 2; i < argc; i++) {
+        emit(c, OP_LOCAL);
+        emit(c, slot_for(c, args[i]));
+    }
+    for (int i = argc - 1; i >= 2; i--) {
+        emit(c, OP_STORE);
+        emit(c, slot_for(c, args[i]));
+    }
+    c->in_function++;
+    compile_block(c, 1);
+    c->in_function--;
+    emit(c, OP_PUSH);
+    emit(c, 0);
+    emit(c, OP_RET);
+
+    // The counters of the body's loops are saved like the parameters, or a
+    // recursive call would run on with its caller's loop. They are only
+    // known now, so calls enter through the saves after the body.
+    uint32_t saves = c->s->length;
+    for (uint32_t i = first_slot; i < c->s->slot_count && !c->failed; i++) {
+        if (c->s->vars[i]->name[0]) continue;
+        emit(c, OP_LOCAL);
+        emit(c, i);
+    }
+    if (c->s->length != saves) {
+        emit(c, OP_JUMP);
+        emit(c, body);
+        c->s->funcs[func].entry = saves;
+    }
+    c->functions++;
+    patch(c, over);
+}
+
+// return [VALUE]; outside a function it ends the script
+static void compile_return(compiler_t* c, const char* value) {
+    if (!c->in_function) {
+        emit(c, OP_HALT);
+        return;
+    }
+    if (!*value) {
+        emit(c, OP_PUSH);
+        emit(c, 0);
+    } else if (!emit_expression(c, value)) {
+        compile_error(c, "bad return value", value);
+        emit(c, OP_PUSH);
+        emit(c, 0);
+    }
+    emit(c, OP_RET);
+}
+
+// local NAME [= VALUE]: the old value comes back when the function returns
+static void compile_local(compiler_t* c, const char* line) {
+    char name[MAX_NAME];
+    const char* value;
+    if (scan_assignment(line, name, &value) != ASSIGN_LET) return;
+    if (c->in_function) {
+        emit(c, OP_LOCAL);
+        emit(c, slot_for(c, name));
+    }
+    if (*value || !c->in_function) {
+        char let[MAX_LINE + 4];
+        strcpy(let, "let ");
+        strcpy(let + 4, skip_spaces(line + 6));
+        compile_line(c, let);
+    }
+}
+
+// For the profiler's totals per kind of statement
+static int statement_kind(compiler_t* c, const char* line) {
+    char name[MAX_NAME];
+    const char* value;
+    if (scan_assignment(line, name, &value) != ASSIGN_NONE) return PROF_ASSIGN;
+    if (strncmp(line, "print ", 6) == 0 || strncmp(line, "echo ", 5) == 0) return PROF_PRINT;
+    if (strncmp(line, "rect ", 5) == 0) return PROF_RECT;
+    if (strncmp(line, "cube ", 5) == 0) return PROF_CUBE;
+    int len = 0;
+    while (line[len] && !is_space(line[len]) && line[len] != '(' && len < MAX_NAME - 1) {
+        name[len] = line[len];
+        len++;
+    }
+    name[len] = '\0';
+    return find_func(c, name) >= 0 ? PROF_CALL : PROF_OTHER;
+}
+
+static void compile_block(compiler_t* c, int in_body) {
+    char line[MAX_LINE];
+    int kind;
+    uint32_t where = c->where & ~MAP_START;  // Code after a body belongs to its header
+    while (!c->failed && (kind = next_line(c, line, in_body)) != LINE_EOF) {
+        if (kind == LINE_CLOSE) break;
+        const char* t = skip_spaces(line);
+        if (!*t || *t == '#' || *t == '}') continue;
+        if (strncmp(t, "for ", 4) == 0) {
+            start_statement(c, PROF_CONTROL);
+            compile_for(c, t);
+        } else if (strncmp(t, "if ", 3) == 0) {
+            start_statement(c, PROF_CONTROL);
+            compile_if(c, t + 3);
+        } else if (strncmp(t, "while ", 6) == 0) {
+            start_statement(c, PROF_CONTROL);
+            compile_while(c, t + 6);
+        } else if (strncmp(t, "function ", 9) == 0) {
+            start_statement(c, PROF_CALL);
+            compile_function(c, t);
+        } else if (strcmp(t, "return") == 0 || strncmp(t, "return ", 7) == 0) {
+            start_statement(c, PROF_CALL);
+            compile_return(c, skip_spaces(t + 6));
+        } else if (strncmp(t, "local ", 6) == 0) {
+            start_statement(c, PROF_ASSIGN);
+            compile_local(c, t);
+        } else {
+            start_statement(c, statement_kind(c, t));
+            compile_line(c, t);
+        }
+    }
+    c->where = where;
+}
+
+script_t* script_compile(const char* source, arena_t* arena) {
+    compiler_t c;
+    memset(&c, 0, sizeof(c));
+    c.arena = arena;
+    c.s = (script_t*)arena_alloc(arena, sizeof(script_t));
+    if (!c.s) return 0;
+    memset(c.s, 0, sizeof(script_t));
+    c.s->arena = arena;
+
+    collect_variables(&c, source);
+    c.source = source;
+    c.line_pos = source;
+    c.line_number = 1;
+    c.pos = source;
+    compile_block(&c, 0);
+    emit(&c, OP_HALT);
+
+    // A function whose definition didn't compile returns 0
+    for (uint32_t i = 0; i < c.s->func_count; i++) {
+        if (c.s->funcs[i].entry) continue;
+        c.s->funcs[i].entry = c.s->length;
+        emit(&c, OP_PUSH);
+        emit(&c, 0);
+        emit(&c, OP_RET);
+    }
+
+    return c.failed ? 0 : c.s;
+}
+
+int script_next_iteration(script_t* s) {
+    // Draw the frame, then pace iterations on vertical retrace; in mode X
+    // this also flips pages
+    dlist_flush();
+    if (!(s->run_flags & SCRIPT_UNPACED)) gfx_present();
+    return thread_should_stop();
+}
+
+// What OP_LOCAL took away from a variable
+typedef struct {
+    var_t* var;
+    char* text;
+    int32_t value;
+    uint8_t type;
+} saved_var_t;
+
+typedef struct {
+    int32_t* ret;
+    uint32_t saved;                // Locals saved before the call
+} call_frame_t;
+
+typedef struct {
+    int32_t stack[STACK_SIZE];
+    call_frame_t frames[CALL_DEPTH];
+    saved_var_t saved[SAVE_DEPTH];
+    uint32_t saved_count;
+} vm_t;
+
+static void restore_locals(vm_t* vm, uint32_t count) {
+    while (vm->saved_count > count) {
+        saved_var_t* save = &vm->saved[--vm->saved_count];
+        var_t* var = save->var;
+        if (var->type == VAR_STRING) var_free_text(var);
+        var->type = save->type;
+        var->value = save->value;
+        var->text = save->text;
+    }
+}
+
+static void run(script_t* s, vm_t* vm) {
+    int32_t* stack = vm->stack;
+    int sp = 0;
+    int fp = 0;
+    int32_t* code = s->code;
+    int32_t* ip = code;
+    var_t** v = s->vars;
+    var_t* var;
+    saved_var_t* save;
+    char text[12];
+    int result;
+    uint32_t* map = profile_active() ? s->source_map : 0;
+    uint64_t last = 0;
+    uint32_t last_pc = 0;
+
+    for (;;) {
+        if (map) {
+            // Each op is charged to the statement it was compiled from
+            uint64_t now = rdtsc();
+            if (last) {
+                uint32_t where = map[last_pc];
+                profile_step(where >> 8, where & 0x7F, (where & MAP_START) != 0, now - last);
+            }
+            last_pc = ip - code;
+            last = rdtsc();
+        }
+        switch (*ip) {
+        case OP_PUSH:
+            stack[sp++] = ip[1];
+            ip += 2;
+            break;
+        case OP_LOAD:
+            stack[sp++] = v[ip[1]]->value;
+            ip += 2;
+            break;
+        case OP_STORE:
+            var_set_int(v[ip[1]], stack[--sp]);
+            ip += 2;
+            break;
+        case OP_ADD:
+            sp--;
+            stack[sp - 1] += stack[sp];
+            ip++;
+            break;
+        case OP_SUB:
+            sp--;
+            stack[sp - 1] -= stack[sp];
+            ip++;
+            break;
+        case OP_POP:
+            sp--;
+            ip++;
+            break;
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+        case OP_SHL:
+        case OP_SHR:
+        case OP_AND:
+        case OP_OR:
+        case OP_EQ:
+        case OP_NE:
+        case OP_LT:
+        case OP_GT:
+        case OP_LE:
+        case OP_GE:
+            sp--;
+            stack[sp - 1] = arith(*ip, stack[sp - 1], stack[sp]);
+            ip++;
+            break;
+        case OP_NEG:
+            stack[sp - 1] = 0u - (uint32_t)stack[sp - 1];
+            ip++;
+            break;
+        case OP_ADD_IMM:
+            var = v[ip[1]];
+            var_set_int(var, var->value + ip[2]);
+            ip += 3;
+            break;
+        case OP_COPY:
+            var_set_int(v[ip[1]], v[ip[2]]->value);
+            ip += 3;
+            break;
+        case OP_SET_TEXT:
+            var_set_text(v[ip[1]], s->strings[ip[2]]);
+            ip += 3;
+            break;
+        case OP_JUMP:
+            ip = code + ip[1];
+            break;
+        case OP_JUMP_FALSE:
+            ip = stack[--sp] ? ip + 2 : code + ip[1];
+            break;
+        case OP_LOOP:
+            if (thread_should_stop()) return;
+            ip = code + ip[1];
+            break;
+        case OP_CALL:
+            if (fp == CALL_DEPTH) {
+                console_write("ERROR: Too many nested calls\n", VGA_RED);
+                return;
+            }
+            // Values still waiting in the caller's expression stay on the stack,
+            // so the callee must have room for a whole line of its own
+            if (sp > STACK_SIZE - EXPR_DEPTH) {
+                console_write("ERROR: expression stack overflow\n", VGA_RED);
+                return;
+            }
+            vm->frames[fp].ret = ip + 2;
+            vm->frames[fp].saved = vm->saved_count;
+            fp++;
+            ip = code + s->funcs[ip[1]].entry;
+            break;
+        case OP_LOCAL:
+            // Once per call: a local in a loop body is saved the first time round
+            var = v[ip[1]];
+            for (uint32_t i = fp ? vm->frames[fp - 1].saved : 0; i < vm->saved_count && var; i++) {
+                if (vm->saved[i].var == var) var = 0;
+            }
+            if (!var) {
+                ip += 2;
+                break;
+            }
+            if (vm->saved_count == SAVE_DEPTH) {
+                console_write("ERROR: Too many locals\n", VGA_RED);
+                return;
+            }
+            save = &vm->saved[vm->saved_count++];
+            save->var = var;
+            save->text = var->text;
+            save->value = var->value;
+            save->type = var->type;
+            var->text = 0;
+            var->value = 0;
+            var->type = VAR_UNSET;
+            ip += 2;
+            break;
+        case OP_RET:
+            // The return value stays on top of the stack
+            fp--;
+            restore_locals(vm, vm->frames[fp].saved);
+            ip = vm->frames[fp].ret;
+            break;
+        case OP_ENTER:
+            // Long loops may run as machine code instead
+            result = jit_run_loop(s, ip[1]);
+            if (result == JIT_STOPPED) return;
+            ip = result == JIT_FINISHED ? code + s->loops[ip[1]].exit : ip + 2;
+            break;
+        case OP_LOOP_TEST:
+            ip = v[ip[1]]->value > v[ip[2]]->value ? code + ip[3] : ip + 4;
+            break;
+        case OP_NEXT:
+            if (script_next_iteration(s)) return;
+            v[ip[1]]->value++;
+            ip = code + ip[2];
+            break;
+        case OP_RECT:
+            sp -= 5;
+            if (stack[sp + 4] >= 0 && stack[sp + 4] <= 0xFF) {
+                dlist_rect(stack[sp], stack[sp + 1], stack[sp + 2], stack[sp + 3], stack[sp + 4]);
+            }
+            ip++;
+            break;
+        case OP_CUBE:
+            sp -= 7;
+            if (stack[sp + 4] >= 0 && stack[sp + 4] <= 0xFF) {
+                dlist_cube(stack[sp], stack[sp + 1], stack[sp + 2], stack[sp + 3],
+                           stack[sp + 4], stack[sp + 5], stack[sp + 6]);
+            }
+            ip++;
+            break;
+        case OP_PRINT_STR:
+            dlist_flush();                   // Text goes over what was drawn before it
+            console_write(s->strings[ip[1]], fg_color);
+            ip += 2;
+            break;
+        case OP_PRINT_VAR:
+            var = v[ip[1]];
+            dlist_flush();
+            console_write(var->type == VAR_UNSET ? s->strings[ip[2]] : var_text(var, text), fg_color);
+            ip += 3;
+            break;
+        case OP_NEWLINE:
+            console_putc('\n', fg_color);
+            ip++;
+            break;
+        case OP_MODEX:
+            dlist_flush();
+            switch_to_modex();
+            ip++;
+            break;
+        case OP_FRAME:
+            if (script_next_iteration(s)) return;
+            ip++;
+            break;
+        case OP_FPS:
+            gfx_set_frame_rate(stack[--sp]);
+            ip++;
+            break;
+        case OP_EXEC:
+            execute_single_command(s->strings[ip[1]]);
+            ip += 2;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+void script_run(script_t* s, int flags) {
+    vm_t vm;
+    vm.saved_count = 0;
+    s->run_flags = flags;
+    dlist_begin();
+    run(s, &vm);
+    dlist_end();
+    restore_locals(&vm, 0);              // Stopped inside a function
+}
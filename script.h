@@ -0,0 +1,108 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdint.h>
+#include "arena.h"
+#include "vars.h"
+
+#define SCRIPT_UNPACED 1           // script_run: don't wait for the frame deadline after each loop iteration
+
+// Word code; operands follow the opcode
+enum {
+    OP_HALT,
+    OP_PUSH,        // value
+    OP_LOAD,        // slot
+    OP_STORE,       // slot
+    OP_POP,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,         // Division by zero gives 0
+    OP_MOD,
+    OP_SHL,         // Shift counts are taken mod 32
+    OP_SHR,         // Arithmetic
+    OP_AND,
+    OP_OR,
+    OP_EQ,          // Comparisons push 1 or 0
+    OP_NE,
+    OP_LT,
+    OP_GT,
+    OP_LE,
+    OP_GE,
+    OP_NEG,
+    OP_ADD_IMM,     // slot value: ++, --, += N and -= N
+    OP_COPY,        // to from
+    OP_SET_TEXT,    // slot string: assignment of text without substitutions
+    OP_JUMP,        // target
+    OP_JUMP_FALSE,  // target: pops the condition
+    OP_LOOP,        // target: a while-loop's jump back, which checks for Ctrl+C
+    OP_CALL,        // function: the arguments are on the stack, first to last
+    OP_LOCAL,       // slot: save the variable until the function returns, and unset it
+    OP_RET,         // Pops the return value, restores the locals and pushes the value again
+    OP_ENTER,       // loop: start of a for-loop, where the JIT may take over
+    OP_LOOP_TEST,   // counter limit exit: leave the loop once counter > limit
+    OP_NEXT,        // counter top: end of an iteration
+    OP_RECT,        // Pops x y width height color
+    OP_CUBE,        // Pops x y width height color dark bright
+    OP_PRINT_STR,   // string
+    OP_PRINT_VAR,   // slot string: the string is printed while the slot is unset
+    OP_NEWLINE,
+    OP_MODEX,
+    OP_FRAME,
+    OP_FPS,         // Pops the rate
+    OP_EXEC,        // string: a line for the line interpreter
+};
+
+// Every for-loop is OP_ENTER, OP_LOOP_TEST, OP_COPY of the counter into
+// the loop variable, the body, then OP_NEXT
+typedef struct script_loop {
+    uint32_t enter;                // Code offset of the OP_ENTER
+    uint32_t exit;                 // First word after the OP_NEXT
+    void* native;                  // Machine code from the JIT, once compiled
+    uint8_t jit_state;
+} script_loop_t;
+
+// function NAME PARAM... { ... }; the parameters are locals
+typedef struct script_func {
+    const char* name;
+    uint32_t entry;                // Code offset of the body
+    uint32_t params;
+} script_func_t;
+
+// A .bash script compiled to word code. Variables are numbered slots that
+// point into the variable store; lines the compiler doesn't understand are
+// kept as text for the line interpreter, which shares the same store.
+#define MAP_START 0x80            // source_map: the first word of a statement
+
+typedef struct script {
+    int32_t* code;
+    uint32_t length;               // Words of code
+    uint32_t* source_map;          // Per word: line << 8 | MAP_START | PROF_ kind; 0 when loaded from the cache
+    const char** strings;
+    uint32_t string_count;
+    var_t** vars;                  // Per slot
+    uint32_t slot_count;
+    script_loop_t* loops;
+    uint32_t loop_count;
+    script_func_t* funcs;
+    uint32_t func_count;
+    uint32_t fallback_lines;       // Lines handed to the line interpreter
+    uint32_t errors;               // Reported while compiling
+    arena_t* arena;                // Holds all of the above, and JIT code
+    int run_flags;                 // Of the script_run() in progress
+} script_t;
+
+// Everything, the script included, is allocated from `arena`; returns 0 when
+// it runs out. The slots hold on to variables, so clear the store before
+// compiling, not between compiling and running.
+script_t* script_compile(const char* source, arena_t* arena);
+void script_run(script_t* script, int flags);
+
+// Integer division as scripts see it: x / 0 and x % 0 are 0, and nothing traps
+int32_t script_div(int32_t a, int32_t b);
+int32_t script_mod(int32_t a, int32_t b);
+
+// End of a loop iteration: wait for the frame unless unpaced; nonzero when the thread should stop
+int script_next_iteration(script_t* script);
+
+#endif
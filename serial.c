@@ -0,0 +1,225 @@
+#include "serial.h"
+#include <stdint.h>
+#include "io.h"
+#include "interrupts.h"
+#include "keyboard.h"
+#include "spinlock.h"
+
+#define IRQ_COM1 4
+
+// Register offsets from the base port
+#define UART_DATA 0
+#define UART_IER 1
+#define UART_DIVISOR_LOW 0
+#define UART_DIVISOR_HIGH 1
+#define UART_IIR 2
+#define UART_FCR 2
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+
+#define IER_RX 0x01
+#define IER_TX_EMPTY 0x02
+#define LCR_8N1 0x03
+#define LCR_DLAB 0x80
+#define FCR_ENABLE_CLEAR_14 0xC7    // FIFOs on, both cleared, RX interrupt at 14 bytes
+#define MCR_DTR_RTS_OUT2 0x0B       // OUT2 gates the UART's interrupt line
+#define MCR_LOOPBACK 0x1E
+#define LSR_DATA_READY 0x01
+#define LSR_TX_EMPTY 0x20
+#define IIR_NONE 0x01
+#define UART_FIFO_SIZE 16
+
+#define RING_MASK (SERIAL_RING_SIZE - 1)
+
+static int present = 0;
+static int irq_driven = 0;
+static volatile int polled = 0;
+
+// Transmit ring, filled by any CPU and drained into the FIFO by the IRQ
+static spinlock_t tx_lock;
+static char tx_ring[SERIAL_RING_SIZE];
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static int tx_irq_on = 0;
+
+// Receive ring: only the IRQ writes `rx_head`, only the reader writes `rx_tail`
+static volatile char rx_ring[SERIAL_RING_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+// Escape sequence decoder for arrow and paging keys, reader side only
+static int esc_state = 0;
+static char esc_param = 0;
+static int after_cr = 0;            // Swallow the LF of a CR LF pair
+
+static uint8_t reg_read(int reg) {
+    return inb(SERIAL_COM1 + reg);
+}
+
+static void reg_write(int reg, uint8_t value) {
+    outb(SERIAL_COM1 + reg, value);
+}
+
+static void poll_putc(char c) {
+    while (!(reg_read(UART_LSR) & LSR_TX_EMPTY)) cpu_relax();
+    reg_write(UART_DATA, c);
+}
+
+// Move queued bytes into the FIFO; the caller holds tx_lock
+static void fill_fifo() {
+    if (!(reg_read(UART_LSR) & LSR_TX_EMPTY)) return;
+    for (int i = 0; i < UART_FIFO_SIZE && tx_tail != tx_head; i++) {
+        reg_write(UART_DATA, tx_ring[tx_tail]);
+        tx_tail = (tx_tail + 1) & RING_MASK;
+    }
+    int want = tx_tail != tx_head;
+    if (want != tx_irq_on) {
+        tx_irq_on = want;
+        reg_write(UART_IER, IER_RX | (want ? IER_TX_EMPTY : 0));
+    }
+}
+
+static void serial_irq(interrupt_frame_t* frame) {
+    (void)frame;
+    int got_input = 0;
+    while (!(reg_read(UART_IIR) & IIR_NONE)) {
+        while (reg_read(UART_LSR) & LSR_DATA_READY) {
+            char c = reg_read(UART_DATA);
+            uint32_t next = (rx_head + 1) & RING_MASK;
+            if (next != rx_tail) {
+                rx_ring[rx_head] = c;
+                __asm__ volatile ("" : : : "memory");
+                rx_head = next;
+                got_input = 1;
+            }
+        }
+        spin_lock(&tx_lock);
+        fill_fifo();
+        spin_unlock(&tx_lock);
+    }
+    if (got_input) keyboard_input_ready();
+}
+
+void serial_init() {
+    // Loopback test: a missing UART reads back 0xFF
+    reg_write(UART_IER, 0);
+    reg_write(UART_MCR, MCR_LOOPBACK);
+    reg_write(UART_DATA, 0xAE);
+    if (reg_read(UART_DATA) != 0xAE) return;
+
+    uint16_t divisor = 115200 / SERIAL_BAUD;
+    reg_write(UART_LCR, LCR_DLAB);
+    reg_write(UART_DIVISOR_LOW, divisor & 0xFF);
+    reg_write(UART_DIVISOR_HIGH, divisor >> 8);
+    reg_write(UART_LCR, LCR_8N1);
+    reg_write(UART_FCR, FCR_ENABLE_CLEAR_14);
+    reg_write(UART_MCR, MCR_DTR_RTS_OUT2);
+    present = 1;
+
+    irq_install_handler(IRQ_COM1, serial_irq);
+    reg_write(UART_IER, IER_RX);
+    irq_driven = 1;
+}
+
+int serial_present() {
+    return present;
+}
+
+void serial_putc(char c) {
+    if (!present) return;
+    if (polled || !irq_driven) {
+        poll_putc(c);
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+    // Full ring: wait for the FIFO by hand rather than drop output
+    while (((tx_head + 1) & RING_MASK) == tx_tail) {
+        while (!(reg_read(UART_LSR) & LSR_TX_EMPTY)) cpu_relax();
+        fill_fifo();
+    }
+    tx_ring[tx_head] = c;
+    tx_head = (tx_head + 1) & RING_MASK;
+    fill_fifo();
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void serial_write(const char* str) {
+    while (*str) {
+        if (*str == '\n') serial_putc('\r');
+        serial_putc(*str++);
+    }
+}
+
+int serial_rx_pending() {
+    return rx_tail != rx_head;
+}
+
+static int rx_pop(char* c) {
+    if (rx_tail == rx_head) return 0;
+    *c = rx_ring[rx_tail];
+    __asm__ volatile ("" : : : "memory");
+    rx_tail = (rx_tail + 1) & RING_MASK;
+    return 1;
+}
+
+// Terminals send Enter as CR, Backspace as DEL and arrows as ESC [ A..D,
+// Page Up/Down as ESC [ 5 ~ / ESC [ 6 ~
+char serial_get_key() {
+    char c;
+    while (rx_pop(&c)) {
+        if (esc_state == 1) {
+            esc_state = c == '[' ? 2 : 0;
+            continue;
+        }
+        if (esc_state == 2) {
+            esc_state = 0;
+            switch (c) {
+            case 'A': return KEY_UP;
+            case 'B': return KEY_DOWN;
+            case 'C': return KEY_RIGHT;
+            case 'D': return KEY_LEFT;
+            case 'H': return KEY_HOME;
+            case 'F': return KEY_END;
+            }
+            if (c >= '0' && c <= '9') {
+                esc_param = c;
+                esc_state = 3;
+            }
+            continue;
+        }
+        if (esc_state == 3) {
+            esc_state = 0;
+            if (c != '~') continue;
+            switch (esc_param) {
+            case '3': return KEY_DELETE;
+            case '5': return KEY_PAGE_UP;
+            case '6': return KEY_PAGE_DOWN;
+            }
+            continue;
+        }
+
+        if (c == 0x1B) {
+            esc_state = 1;
+            continue;
+        }
+        int was_cr = after_cr;
+        after_cr = c == '\r';
+        if (c == '\n' && was_cr) continue;
+        if (c == '\r') return '\n';
+        if (c == 0x7F) return '\b';
+        return c;
+    }
+    return 0;
+}
+
+void serial_panic() {
+    if (!present) return;
+    polled = 1;
+    // Whatever was queued goes out first, without the lock its holder may never release
+    while (tx_tail != tx_head) {
+        poll_putc(tx_ring[tx_tail]);
+        tx_tail = (tx_tail + 1) & RING_MASK;
+    }
+}
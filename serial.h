@@ -0,0 +1,24 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+#define SERIAL_COM1 0x3F8
+#define SERIAL_BAUD 115200
+#define SERIAL_RING_SIZE 1024       // Power of two
+
+// COM1, interrupt driven once interrupts_init has run; output is dropped
+// if no UART answers
+void serial_init();
+int serial_present();
+void serial_putc(char c);
+void serial_write(const char* str);     // "\n" goes out as "\r\n"
+
+// Next input byte translated to a key code (see keyboard.h), or 0
+char serial_get_key();
+int serial_rx_pending();
+
+// Switch to polled output that takes no locks, for panic messages
+void serial_panic();
+
+#endif
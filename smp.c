@@ -0,0 +1,119 @@
+#include "smp.h"
+#include <stdint.h>
+#include "io.h"
+#include "acpi.h"
+#include "apic.h"
+#include "interrupts.h"
+#include "paging.h"
+#include "pmm.h"
+#include "string.h"
+#include "timer.h"
+
+#define INIT_DELAY_MS 10
+#define STARTUP_RETRY_MS 1
+#define STARTUP_TIMEOUT_MS 100
+
+// Filled in by the BSP in the trampoline's copy below 1 MB
+typedef struct {
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack_top;
+} __attribute__((packed)) ap_params_t;
+
+extern uint8_t ap_trampoline[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_params[];
+
+static cpu_t cpus[MAX_CPUS];
+static uint8_t cpu_of_apic[256];
+static int online_count = 1;
+static int active = 0;              // LAPIC IDs identify the CPU from here on
+static uint8_t* ap_stack = 0;       // Stack handed to the CPU being started
+
+cpu_t* this_cpu() {
+    if (!active) return &cpus[0];
+    return &cpus[cpu_of_apic[lapic_id()]];
+}
+
+int smp_active() {
+    return active;
+}
+
+int cpu_count() {
+    return online_count;
+}
+
+cpu_t* cpu_get(int index) {
+    return &cpus[index];
+}
+
+// First C code on an application processor, running on ap_stack
+void ap_main() {
+    cpu_t* cpu = this_cpu();
+    paging_init_cpu();
+    interrupts_init_cpu(cpu->index);
+    lapic_enable();
+    lapic_timer_start(THREAD_SLICE_MS);
+    thread_start_cpu(cpu, ap_stack);
+}
+
+static int wait_online(cpu_t* cpu, uint32_t ms) {
+    uint64_t deadline = now_ns() + (uint64_t)ms * NS_PER_MS;
+    while (!cpu->online && now_ns() < deadline) cpu_relax();
+    return cpu->online;
+}
+
+// Up to two STARTUPs as the MP specification asks; INIT went out already
+static int start_cpu(cpu_t* cpu) {
+    uint32_t stack = pmm_alloc_pages(THREAD_STACK_ORDER);
+    if (!stack) return 0;
+    paging_unmap(stack);            // Guard page, as for every thread stack
+    ap_stack = (uint8_t*)stack;
+
+    ap_params_t* params = (ap_params_t*)(AP_TRAMPOLINE + (ap_params - ap_trampoline));
+    params->stack_top = stack + (PAGE_SIZE << THREAD_STACK_ORDER);
+
+    apic_send_startup(cpu->apic_id, AP_TRAMPOLINE);
+    if (!wait_online(cpu, STARTUP_RETRY_MS)) {
+        apic_send_startup(cpu->apic_id, AP_TRAMPOLINE);
+        wait_online(cpu, STARTUP_TIMEOUT_MS);
+    }
+    if (cpu->online) return 1;
+
+    paging_map(stack, PAGE_SIZE, PAGE_CACHED);
+    pmm_free_pages(stack);
+    return 0;
+}
+
+void smp_init() {
+    const acpi_madt_t* madt = acpi_madt();
+    if (!madt || madt->cpu_count < 2 || !apic_init()) return;
+
+    uint8_t bsp = lapic_id();
+    cpus[0].apic_id = bsp;
+    cpus[0].online = 1;
+    cpu_of_apic[bsp] = 0;
+    active = 1;
+
+    memcpy((void*)AP_TRAMPOLINE, ap_trampoline, ap_trampoline_end - ap_trampoline);
+    ap_params_t* params = (ap_params_t*)(AP_TRAMPOLINE + (ap_params - ap_trampoline));
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(params->cr3));
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(params->cr4));
+
+    // Every CPU gets its INIT at once so they share a single settle delay
+    for (int i = 0; i < madt->cpu_count; i++) {
+        if (madt->cpu_apic_ids[i] != bsp) apic_send_init(madt->cpu_apic_ids[i]);
+    }
+    sleep_ms(INIT_DELAY_MS);
+
+    // Slots are only kept for CPUs that actually come up
+    for (int i = 0; i < madt->cpu_count && online_count < MAX_CPUS; i++) {
+        uint8_t id = madt->cpu_apic_ids[i];
+        if (id == bsp) continue;
+        cpu_t* cpu = &cpus[online_count];
+        cpu->index = online_count;
+        cpu->apic_id = id;
+        cpu_of_apic[id] = online_count;
+        if (start_cpu(cpu)) online_count++;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include "thread.h"
+#include "spinlock.h"
+
+#define MAX_CPUS 8
+#define AP_TRAMPOLINE 0x8000        // Real-mode entry for the other CPUs, below 1 MB
+
+// Everything the scheduler keeps per CPU
+typedef struct cpu {
+    int index;
+    uint8_t apic_id;
+    volatile int online;
+    thread_t* current;
+    thread_t* idle;                  // Runs when nothing else can; never on a run queue
+    thread_t* switch_prev;           // Thread being switched away from, finished by the next one
+
+    // One FIFO per priority plus a bitmap of the non-empty ones
+    spinlock_t rq_lock;
+    thread_t* run_head[THREAD_PRIORITIES];
+    thread_t* run_tail[THREAD_PRIORITIES];
+    volatile uint32_t ready_mask;
+    volatile uint32_t queued;
+    volatile int need_resched;
+
+    uint32_t switches;
+    uint32_t steals;                 // Threads taken from other CPUs' queues
+} cpu_t;
+
+// Start every other CPU the MADT lists; a no-op on uniprocessor machines
+void smp_init();
+int smp_active();
+int cpu_count();
+cpu_t* cpu_get(int index);
+// Meaningful only with interrupts off, or the caller may move to another CPU
+cpu_t* this_cpu();
+
+#endif
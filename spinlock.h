@@ -0,0 +1,77 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "io.h"
+
+// Test-and-test-and-set lock for short critical sections
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+// FIFO lock: waiters are served in arrival order, so a busy CPU cannot
+// starve the others out of a contended structure
+typedef struct {
+    volatile uint32_t next;
+    volatile uint32_t serving;
+} ticket_lock_t;
+
+static inline void cpu_relax() {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+    while (1) {
+        uint32_t old = 1;
+        __asm__ volatile ("xchg %0, %1" : "+r"(old), "+m"(lock->locked) : : "memory");
+        if (!old) return;
+        while (lock->locked) cpu_relax();
+    }
+}
+
+static inline int spin_try_lock(spinlock_t* lock) {
+    uint32_t old = 1;
+    __asm__ volatile ("xchg %0, %1" : "+r"(old), "+m"(lock->locked) : : "memory");
+    return !old;
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __asm__ volatile ("" : : : "memory");
+    lock->locked = 0;
+}
+
+// Interrupts stay off while the lock is held, so a handler on the same CPU cannot deadlock on it
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline void ticket_lock(ticket_lock_t* lock) {
+    uint32_t ticket = 1;
+    __asm__ volatile ("lock; xaddl %0, %1" : "+r"(ticket), "+m"(lock->next) : : "memory");
+    while (lock->serving != ticket) cpu_relax();
+}
+
+static inline void ticket_unlock(ticket_lock_t* lock) {
+    __asm__ volatile ("" : : : "memory");
+    lock->serving = lock->serving + 1;
+}
+
+static inline uint32_t ticket_lock_irqsave(ticket_lock_t* lock) {
+    uint32_t flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticket_lock_t* lock, uint32_t flags) {
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
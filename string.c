@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include "string.h"
 
 int strcmp(const char* a, const char* b) {
@@ -16,103 +17,6 @@ int strncmp(const char* a, const char* b, int n) {
     if (n < 0) return 0;
     return *(const unsigned char*)a - *(const unsigned char*)b;
 }
-int parse_rect_cmd(const char* cmd, int* x, int* y, int* width, int* height, int* color) {
-    if (strncmp(cmd, "rect", 4) != 0) {
-        return 0;
-    }
-    
-    const char* ptr = cmd + 4;
-    
-    while (*ptr == ' ' || *ptr == '\t') {
-        ptr++;
-    }
-    
-    if (!parse_int(&ptr, x)) return 0;
-    
-    if (!parse_int(&ptr, y)) return 0;
-    
-    if (!parse_int(&ptr, width)) return 0;
-    
-    if (!parse_int(&ptr, height)) return 0;
-    
-    if (!parse_int(&ptr, color)) return 0;
-    
-    if (*color < 0x00 || *color > 0xFF) {
-        return 0;
-    }
-    
-    return 1;
-}
-int parse_bg_cmd(const char* cmd, int* color) {
-    if (strncmp(cmd, "bg", 2) != 0) {
-        return 0;
-    }
-    
-    const char* ptr = cmd + 2;
-    
-    while (*ptr == ' ' || *ptr == '\t') {
-        ptr++;
-    }
-    
-    if (!parse_int(&ptr, color)) return 0;
-    
-    if (*color < 0x00 || *color > 0xFF) {
-        return 0;
-    }
-    
-    return 1;
-}
-
-int parse_fg_cmd(const char* cmd, int* color) {
-    if (strncmp(cmd, "fg", 2) != 0) {
-        return 0;
-    }
-    
-    const char* ptr = cmd + 2;
-    
-    while (*ptr == ' ' || *ptr == '\t') {
-        ptr++;
-    }
-    
-    if (!parse_int(&ptr, color)) return 0;
-    
-    if (*color < 0x00 || *color > 0xFF) {
-        return 0;
-    }
-    
-    return 1;
-}
-int parse_cube_cmd(const char* cmd, int* x, int* y, int* width, int* height, int* color, int* darkcolor, int* brightcolor) {
-    if (strncmp(cmd, "cube", 4) != 0) {
-        return 0;
-    }
-    
-    const char* ptr = cmd + 4;
-    
-    while (*ptr == ' ' || *ptr == '\t') {
-        ptr++;
-    }
-    
-    if (!parse_int(&ptr, x)) return 0;
-    
-    if (!parse_int(&ptr, y)) return 0;
-    
-    if (!parse_int(&ptr, width)) return 0;
-    
-    if (!parse_int(&ptr, height)) return 0;
-    
-    if (!parse_int(&ptr, color)) return 0;
-    
-    if (!parse_int(&ptr, darkcolor)) return 0;
-    
-    if (!parse_int(&ptr, brightcolor)) return 0;
-    
-    if (*color < 0x00 || *color > 0xFF) {
-        return 0;
-    }
-    
-    return 1;
-}
 
 int parse_int(const char** ptr, int* result) {
     while (**ptr == ' ' || **ptr == '\t') {
@@ -170,3 +74,59 @@ char* strstr(const char* haystack, const char* needle) {
     return 0;
 }
 
+
+void* memset(void* dest, int value, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+
+    // Align, then store whole words; on the write-combined framebuffer these fill lines quickly
+    while (n && ((uint32_t)d & 3)) {
+        *d++ = (uint8_t)value;
+        n--;
+    }
+    uint32_t word = (uint8_t)value * 0x01010101u;
+    while (n >= 4) {
+        *(uint32_t*)d = word;
+        d += 4;
+        n -= 4;
+    }
+    while (n--) {
+        *d++ = (uint8_t)value;
+    }
+    return dest;
+}
+
+void* memcpy(void* dest, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+
+    // Copy whole words while both pointers are aligned
+    if ((((uint32_t)d | (uint32_t)s) & 3) == 0) {
+        while (n >= 4) {
+            *(uint32_t*)d = *(const uint32_t*)s;
+            d += 4;
+            s += 4;
+            n -= 4;
+        }
+    }
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (d <= s || d >= s + n) {
+        return memcpy(dest, src, n);
+    }
+
+    // Overlapping with dest above src: copy backwards
+    d += n;
+    s += n;
+    while (n--) {
+        *--d = *--s;
+    }
+    return dest;
+}
@@ -1,15 +1,16 @@
 #ifndef STRING_H
 #define STRING_H
 
+#include <stddef.h>
+
 int strcmp(const char* s1, const char* s2);
 int strncmp(const char* s1, const char* s2, int n);
-int parse_rect_cmd(const char* cmd, int* x, int* y, int* width, int* height, int* color);
 int parse_int(const char** ptr, int* result);
-int parse_cube_cmd(const char* cmd, int* x, int* y, int* width, int* height, int* color, int* darkcolor, int* brightcolor);
 char* strcpy(char* dest, const char* src);
 char* strstr(const char* haystack, const char* needle);
-int parse_bg_cmd(const char* cmd, int* color);
-int parse_fg_cmd(const char* cmd, int* color);
+void* memset(void* dest, int value, size_t n);
+void* memcpy(void* dest, const void* src, size_t n);
+void* memmove(void* dest, const void* src, size_t n);
 #endif
 
 
@@ -0,0 +1,92 @@
+#include "sync.h"
+#include <stdint.h>
+#include "io.h"
+
+// Before thread_init there is only one flow of control, so locks are no-ops.
+// State changes happen under the scheduler's wait lock so a sleeper on one
+// CPU cannot miss a release on another.
+void mutex_init(mutex_t* m) {
+    m->owner = 0;
+    m->depth = 0;
+    wait_queue_init(&m->waiters);
+}
+
+void mutex_lock(mutex_t* m) {
+    thread_t* self = thread_current();
+    if (!self) return;
+
+    uint32_t flags = wait_lock_irqsave();
+    if (m->owner == self) {
+        m->depth++;
+    } else {
+        while (m->owner) wait_queue_sleep(&m->waiters);
+        m->owner = self;
+        m->depth = 1;
+    }
+    wait_unlock_irqrestore(flags);
+}
+
+int mutex_try_lock(mutex_t* m) {
+    thread_t* self = thread_current();
+    if (!self) return 1;
+
+    uint32_t flags = wait_lock_irqsave();
+    int got = 0;
+    if (m->owner == self) {
+        m->depth++;
+        got = 1;
+    } else if (!m->owner) {
+        m->owner = self;
+        m->depth = 1;
+        got = 1;
+    }
+    wait_unlock_irqrestore(flags);
+    return got;
+}
+
+void mutex_unlock(mutex_t* m) {
+    thread_t* self = thread_current();
+    if (!self || m->owner != self) return;
+
+    uint32_t flags = wait_lock_irqsave();
+    int released = --m->depth == 0;
+    if (released) m->owner = 0;
+    wait_unlock_irqrestore(flags);
+
+    if (released) {
+        wait_queue_wake_one(&m->waiters);
+        flags = irq_save();
+        thread_preempt_check();     // A more important waiter runs right away
+        irq_restore(flags);
+    }
+}
+
+void semaphore_init(semaphore_t* s, int count) {
+    s->count = count;
+    wait_queue_init(&s->waiters);
+}
+
+int semaphore_down_until(semaphore_t* s, uint64_t deadline) {
+    uint32_t flags = wait_lock_irqsave();
+    while (s->count == 0) {
+        if (!wait_queue_sleep_until(&s->waiters, deadline)) {
+            wait_unlock_irqrestore(flags);
+            return 0;
+        }
+    }
+    s->count--;
+    wait_unlock_irqrestore(flags);
+    return 1;
+}
+
+void semaphore_down(semaphore_t* s) {
+    semaphore_down_until(s, 0);
+}
+
+// Safe from interrupt handlers
+void semaphore_up(semaphore_t* s) {
+    uint32_t flags = wait_lock_irqsave();
+    s->count++;
+    wait_unlock_irqrestore(flags);
+    wait_queue_wake_one(&s->waiters);
+}
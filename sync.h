@@ -0,0 +1,29 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "thread.h"
+
+// Sleeping mutex. The owner may lock it again; it is released when the
+// matching number of unlocks has been done.
+typedef struct {
+    thread_t* owner;
+    int depth;
+    wait_queue_t waiters;
+} mutex_t;
+
+typedef struct {
+    int count;
+    wait_queue_t waiters;
+} semaphore_t;
+
+void mutex_init(mutex_t* m);
+void mutex_lock(mutex_t* m);
+int mutex_try_lock(mutex_t* m);
+void mutex_unlock(mutex_t* m);
+
+void semaphore_init(semaphore_t* s, int count);
+void semaphore_down(semaphore_t* s);
+int semaphore_down_until(semaphore_t* s, uint64_t deadline);   // 0 on timeout
+void semaphore_up(semaphore_t* s);
+
+#endif
@@ -0,0 +1,119 @@
+#include "textgrid.h"
+#include <stdint.h>
+#include "graphics.h"
+#include "string.h"
+
+// A character cell: glyph plus foreground/background color
+typedef struct {
+    char ch;
+    uint8_t fg;
+    uint8_t bg;
+} cell_t;
+
+// `wanted` is what callers asked for, `shown` is what is currently rasterized.
+// A shown cell with ch == 0 is unknown and always gets repainted.
+static cell_t wanted[GRID_MAX_ROWS * GRID_MAX_COLS];
+static cell_t shown[GRID_MAX_ROWS * GRID_MAX_COLS];
+static uint8_t row_dirty[GRID_MAX_ROWS];
+static int cols = 0;
+static int rows = 0;
+
+void grid_init() {
+    cols = SCREEN_WIDTH / GRID_CELL_SIZE;
+    rows = SCREEN_HEIGHT / GRID_CELL_SIZE;
+    if (cols > GRID_MAX_COLS) cols = GRID_MAX_COLS;
+    if (rows > GRID_MAX_ROWS) rows = GRID_MAX_ROWS;
+
+    for (int i = 0; i < rows * cols; i++) {
+        wanted[i].ch = ' ';
+        wanted[i].fg = 0;
+        wanted[i].bg = 0;
+    }
+    grid_invalidate();
+}
+
+int grid_cols() {
+    return cols;
+}
+
+int grid_rows() {
+    return rows;
+}
+
+void grid_put(int col, int row, char c, uint8_t fg, uint8_t bg) {
+    if (col < 0 || col >= cols || row < 0 || row >= rows) return;
+    if (c < 32 || c > 126) c = ' ';
+
+    cell_t* cell = &wanted[row * cols + col];
+    if (cell->ch == c && cell->fg == fg && cell->bg == bg) return;
+
+    cell->ch = c;
+    cell->fg = fg;
+    cell->bg = bg;
+    row_dirty[row] = 1;
+}
+
+int grid_write(int col, int row, const char* str, uint8_t fg, uint8_t bg) {
+    int written = 0;
+    while (*str && col + written < cols) {
+        grid_put(col + written, row, *str++, fg, bg);
+        written++;
+    }
+    return written;
+}
+
+void grid_fill(int col, int row, int width, int height, char c, uint8_t fg, uint8_t bg) {
+    for (int r = row; r < row + height; r++) {
+        for (int k = col; k < col + width; k++) {
+            grid_put(k, r, c, fg, bg);
+        }
+    }
+}
+
+// Scroll rows [top_row, top_row + height) up by one. The pixels are moved
+// with a single memmove, so only the new bottom row needs rasterizing.
+void grid_scroll_up(int top_row, int height, uint8_t bg) {
+    if (top_row < 0 || height <= 0 || top_row + height > rows) return;
+
+    grid_flush();
+
+    int row_bytes = cols * sizeof(cell_t);
+    memmove(&wanted[top_row * cols], &wanted[(top_row + 1) * cols], (height - 1) * row_bytes);
+    memmove(&shown[top_row * cols], &shown[(top_row + 1) * cols], (height - 1) * row_bytes);
+    scroll_area_up(top_row * GRID_CELL_SIZE, height * GRID_CELL_SIZE, GRID_CELL_SIZE, bg);
+
+    int last = (top_row + height - 1) * cols;
+    for (int k = 0; k < cols; k++) {
+        wanted[last + k].ch = ' ';
+        wanted[last + k].fg = bg;
+        wanted[last + k].bg = bg;
+        shown[last + k] = wanted[last + k];
+    }
+}
+
+// Forget what is on screen, e.g. after something drew pixels directly
+void grid_invalidate() {
+    for (int i = 0; i < rows * cols; i++) {
+        shown[i].ch = 0;
+    }
+    for (int r = 0; r < rows; r++) {
+        row_dirty[r] = 1;
+    }
+}
+
+// Rasterize only the cells whose wanted state differs from what is shown
+void grid_flush() {
+    for (int r = 0; r < rows; r++) {
+        if (!row_dirty[r]) continue;
+        row_dirty[r] = 0;
+
+        for (int k = 0; k < cols; k++) {
+            cell_t* want = &wanted[r * cols + k];
+            cell_t* have = &shown[r * cols + k];
+            if (have->ch == want->ch && have->fg == want->fg && have->bg == want->bg) continue;
+
+            draw_char_bg(k * GRID_CELL_SIZE, r * GRID_CELL_SIZE, want->ch, want->fg, want->bg);
+            *have = *want;
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef TEXTGRID_H
+#define TEXTGRID_H
+
+#include <stdint.h>
+
+#define GRID_CELL_SIZE 8
+#define GRID_MAX_COLS 80    // Enough for 640 pixel wide modes
+#define GRID_MAX_ROWS 60    // Enough for 480 pixel tall modes
+
+void grid_init();
+int grid_cols();
+int grid_rows();
+void grid_put(int col, int row, char c, uint8_t fg, uint8_t bg);
+int grid_write(int col, int row, const char* str, uint8_t fg, uint8_t bg);
+void grid_fill(int col, int row, int width, int height, char c, uint8_t fg, uint8_t bg);
+void grid_scroll_up(int top_row, int height, uint8_t bg);
+void grid_invalidate();
+void grid_flush();
+
+#endif
@@ -0,0 +1,543 @@
+#include "thread.h"
+#include <stdint.h>
+#include "io.h"
+#include "heap.h"
+#include "pmm.h"
+#include "paging.h"
+#include "timer.h"
+#include "smp.h"
+#include "apic.h"
+
+extern void switch_context(uint32_t* save_esp, uint32_t next_esp);
+
+static thread_t boot_thread;
+static thread_t ap_idle_threads[MAX_CPUS];   // Application processors' boot contexts
+static thread_t* all_threads = 0;
+static slab_cache_t* thread_cache = 0;
+static uint32_t next_id = 0;
+
+// Wait queues, the sleep list and the thread list are shared by every CPU.
+// One lock covers them all and is always taken before a run queue lock.
+static spinlock_t wait_lock;
+static thread_t* sleepers = 0;          // Sorted by wake_ns
+
+// Stacks of exited threads, guard page still unmapped, so reusing one never
+// changes a mapping another CPU may have cached. Linked through the first
+// word above the guard.
+static uint8_t* free_stacks = 0;
+
+static uint64_t slice_ns() {
+    return (uint64_t)THREAD_SLICE_MS * NS_PER_MS;
+}
+
+// Run queues; the caller holds cpu->rq_lock
+static void enqueue(cpu_t* cpu, thread_t* t) {
+    t->state = THREAD_READY;
+    t->cpu = cpu;
+    t->next = 0;
+    if (cpu->run_tail[t->priority]) cpu->run_tail[t->priority]->next = t;
+    else cpu->run_head[t->priority] = t;
+    cpu->run_tail[t->priority] = t;
+    cpu->ready_mask |= 1u << t->priority;
+    cpu->queued++;
+}
+
+static thread_t* dequeue_highest(cpu_t* cpu) {
+    if (!cpu->ready_mask) return 0;
+    uint32_t prio;
+    __asm__ ("bsr %1, %0" : "=r"(prio) : "r"(cpu->ready_mask));
+    thread_t* t = cpu->run_head[prio];
+    cpu->run_head[prio] = t->next;
+    if (!cpu->run_head[prio]) {
+        cpu->run_tail[prio] = 0;
+        cpu->ready_mask &= ~(1u << prio);
+    }
+    cpu->queued--;
+    t->next = 0;
+    return t;
+}
+
+static int cpu_is_idle(cpu_t* cpu) {
+    return cpu->current == cpu->idle && !cpu->queued;
+}
+
+// Anything runnable here or worth stealing from another CPU
+static int work_available(cpu_t* self) {
+    if (self->queued) return 1;
+    for (int i = 0; i < cpu_count(); i++) {
+        cpu_t* cpu = cpu_get(i);
+        if (cpu != self && cpu->online && cpu->queued) return 1;
+    }
+    return 0;
+}
+
+// Where a woken thread goes: back where it ran if that CPU is free, else
+// any idle CPU. New threads, with no home yet, go to the least loaded one.
+static cpu_t* select_cpu(thread_t* t) {
+    cpu_t* home = t->cpu;
+    if (home && cpu_is_idle(home)) return home;
+    cpu_t* least = 0;
+    for (int i = 0; i < cpu_count(); i++) {
+        cpu_t* cpu = cpu_get(i);
+        if (!cpu->online) continue;
+        if (cpu_is_idle(cpu)) return cpu;
+        if (!least || cpu->queued < least->queued) least = cpu;
+    }
+    return home ? home : least;
+}
+
+// Make `cpu` reschedule if `t` should run there before its current thread
+static void kick(cpu_t* cpu, thread_t* t) {
+    thread_t* running = cpu->current;
+    if (running != cpu->idle && t->priority <= running->priority) return;
+    cpu->need_resched = 1;
+    if (cpu != this_cpu()) apic_send_ipi(cpu->apic_id, VECTOR_RESCHEDULE);
+}
+
+// Interrupts must be off
+static void make_ready(thread_t* t) {
+    cpu_t* cpu = select_cpu(t);
+    spin_lock(&cpu->rq_lock);
+    enqueue(cpu, t);
+    spin_unlock(&cpu->rq_lock);
+    kick(cpu, t);
+}
+
+// Take the most important thread queued on the busiest other CPU
+static thread_t* steal(cpu_t* self) {
+    cpu_t* victim = 0;
+    for (int i = 0; i < cpu_count(); i++) {
+        cpu_t* cpu = cpu_get(i);
+        if (cpu == self || !cpu->online || !cpu->queued) continue;
+        if (!victim || cpu->queued > victim->queued) victim = cpu;
+    }
+    if (!victim) return 0;
+
+    spin_lock(&victim->rq_lock);
+    thread_t* t = dequeue_highest(victim);
+    spin_unlock(&victim->rq_lock);
+    if (t) self->steals++;
+    return t;
+}
+
+// The caller holds wait_lock
+static void sleep_insert(thread_t* t, uint64_t deadline) {
+    t->wake_ns = deadline;
+    thread_t** link = &sleepers;
+    while (*link && (*link)->wake_ns <= deadline) link = &(*link)->sleep_next;
+    t->sleep_next = *link;
+    *link = t;
+
+    // Only the BSP's timer wakes sleepers; make it re-arm for a new first deadline
+    cpu_t* bsp = cpu_get(0);
+    if (sleepers == t && this_cpu() != bsp) apic_send_ipi(bsp->apic_id, VECTOR_RESCHEDULE);
+}
+
+static void sleep_remove(thread_t* t) {
+    if (!t->wake_ns) return;
+    for (thread_t** link = &sleepers; *link; link = &(*link)->sleep_next) {
+        if (*link == t) {
+            *link = t->sleep_next;
+            break;
+        }
+    }
+    t->wake_ns = 0;
+    t->sleep_next = 0;
+}
+
+static void wait_remove(wait_queue_t* wq, thread_t* t) {
+    thread_t* prev = 0;
+    for (thread_t* it = wq->head; it; prev = it, it = it->next) {
+        if (it != t) continue;
+        if (prev) prev->next = it->next;
+        else wq->head = it->next;
+        if (wq->tail == it) wq->tail = prev;
+        break;
+    }
+    t->next = 0;
+    t->waiting_on = 0;
+}
+
+// Interrupts must be off
+uint64_t thread_next_deadline() {
+    cpu_t* cpu = this_cpu();
+    uint64_t deadline = 0;
+    if (cpu->index == 0) {
+        spin_lock(&wait_lock);
+        if (sleepers) deadline = sleepers->wake_ns;
+        spin_unlock(&wait_lock);
+    }
+    // Only bother preempting when someone of equal priority is waiting for a turn
+    thread_t* current = cpu->current;
+    if (current && (cpu->ready_mask & (1u << current->priority))) {
+        if (!deadline || current->slice_end_ns < deadline) deadline = current->slice_end_ns;
+    }
+    return deadline;
+}
+
+// The PIT is the BSP's; the other CPUs' slices come from their local APIC timers
+static void arm_timer(cpu_t* cpu) {
+    if (cpu->index == 0) timer_arm(thread_next_deadline());
+}
+
+static uint8_t* stack_alloc() {
+    uint32_t flags = spin_lock_irqsave(&wait_lock);
+    uint8_t* stack = free_stacks;
+    if (stack) free_stacks = *(uint8_t**)(stack + PAGE_SIZE);
+    spin_unlock_irqrestore(&wait_lock, flags);
+    if (stack) return stack;
+
+    uint32_t addr = pmm_alloc_pages(THREAD_STACK_ORDER);
+    if (addr) paging_unmap(addr);       // Guard page at the bottom
+    return (uint8_t*)addr;
+}
+
+static void thread_free(thread_t* t) {
+    uint32_t flags = spin_lock_irqsave(&wait_lock);
+    for (thread_t** link = &all_threads; *link; link = &(*link)->all_next) {
+        if (*link == t) {
+            *link = t->all_next;
+            break;
+        }
+    }
+    *(uint8_t**)(t->stack + PAGE_SIZE) = free_stacks;
+    free_stacks = t->stack;
+    spin_unlock_irqrestore(&wait_lock, flags);
+    slab_free(thread_cache, t);
+}
+
+// First thing after every switch, on the new thread's stack: the old thread
+// may now run elsewhere, or be freed if it exited
+static void finish_switch() {
+    cpu_t* cpu = this_cpu();
+    thread_t* prev = cpu->switch_prev;
+    cpu->switch_prev = 0;
+    int dead = prev->state == THREAD_DEAD;
+    __asm__ volatile ("" : : : "memory");
+    prev->on_cpu = 0;
+    if (dead) thread_free(prev);
+}
+
+// Pick the next thread and switch to it. Interrupts must be off.
+static void schedule() {
+    cpu_t* cpu = this_cpu();
+    thread_t* prev = cpu->current;
+
+    spin_lock(&cpu->rq_lock);
+    if (prev->state == THREAD_RUNNING && prev != cpu->idle) enqueue(cpu, prev);
+    thread_t* next = dequeue_highest(cpu);
+    spin_unlock(&cpu->rq_lock);
+    if (!next) next = steal(cpu);
+
+    // Woken before the CPU it blocked on finished switching away from it:
+    // leave it queued and look again shortly rather than wait with interrupts off
+    if (next && next != prev && next->on_cpu) {
+        spin_lock(&cpu->rq_lock);
+        enqueue(cpu, next);
+        spin_unlock(&cpu->rq_lock);
+        next = 0;
+    }
+    if (!next) next = cpu->idle;
+    __asm__ volatile ("" : : : "memory");
+
+    cpu->need_resched = 0;
+    if (prev == cpu->idle && next != prev) prev->state = THREAD_READY;
+    next->state = THREAD_RUNNING;
+    next->cpu = cpu;
+
+    uint64_t now = now_ns();
+    next->slice_end_ns = now + slice_ns();
+    if (next != prev) {
+        next->on_cpu = 1;
+        prev->run_ns += now - prev->switched_in_ns;
+        next->switched_in_ns = now;
+        cpu->current = next;
+        cpu->switch_prev = prev;
+        cpu->switches++;
+        arm_timer(cpu);
+        switch_context(&prev->esp, next->esp);
+        // Running as `prev` again, possibly on another CPU
+        finish_switch();
+    } else {
+        arm_timer(cpu);
+    }
+}
+
+// First code a new thread runs, entered through switch_context's ret
+static void thread_bootstrap() {
+    finish_switch();
+    thread_t* self = this_cpu()->current;
+    interrupts_enable();
+    self->entry(self->arg);
+    thread_exit();
+}
+
+static void idle_loop(void* arg) {
+    (void)arg;
+    while (1) {
+        interrupts_disable();
+        cpu_t* cpu = this_cpu();
+        if (work_available(cpu)) {
+            schedule();
+            continue;
+        }
+        cpu_idle_until(cpu->index == 0 ? thread_next_deadline() : 0);
+    }
+}
+
+// A thread that has a stack and a first frame but is on no queue yet
+static thread_t* thread_alloc(const char* name, void (*entry)(void* arg), void* arg, int priority) {
+    thread_t* t = (thread_t*)slab_alloc(thread_cache);
+    if (!t) return 0;
+    uint8_t* stack = stack_alloc();
+    if (!stack) {
+        slab_free(thread_cache, t);
+        return 0;
+    }
+
+    t->name = name;
+    t->entry = entry;
+    t->arg = arg;
+    t->priority = priority;
+    t->state = THREAD_READY;
+    t->stack = stack;
+    t->wake_ns = 0;
+    t->run_ns = 0;
+    t->cancel = 0;
+    t->timed_out = 0;
+    t->waiting_on = 0;
+    t->cpu = 0;
+    t->on_cpu = 0;
+    t->next = t->sleep_next = 0;
+    t->vars = 0;
+
+    // Initial frame popped by switch_context: edi, esi, ebx, ebp, return address
+    uint32_t* sp = (uint32_t*)(stack + (PAGE_SIZE << THREAD_STACK_ORDER));
+    *--sp = 0;                              // Fake return address for thread_bootstrap
+    *--sp = (uint32_t)thread_bootstrap;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    t->esp = (uint32_t)sp;
+
+    uint32_t flags = spin_lock_irqsave(&wait_lock);
+    t->id = next_id++;
+    t->all_next = all_threads;
+    all_threads = t;
+    spin_unlock_irqrestore(&wait_lock, flags);
+    return t;
+}
+
+void thread_init() {
+    thread_cache = slab_cache_create("threads", sizeof(thread_t));
+
+    cpu_t* cpu = this_cpu();
+    boot_thread.id = next_id++;
+    boot_thread.name = "shell";
+    boot_thread.priority = THREAD_PRIO_HIGH;
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.cpu = cpu;
+    boot_thread.on_cpu = 1;
+    boot_thread.switched_in_ns = now_ns();
+    boot_thread.all_next = all_threads;
+    all_threads = &boot_thread;
+
+    cpu->idle = thread_alloc("idle", idle_loop, 0, THREAD_PRIO_IDLE);
+    cpu->idle->cpu = cpu;
+    cpu->online = 1;
+    cpu->current = &boot_thread;
+}
+
+void thread_start_cpu(cpu_t* cpu, uint8_t* stack) {
+    thread_t* idle = &ap_idle_threads[cpu->index];
+    idle->name = "idle";
+    idle->priority = THREAD_PRIO_IDLE;
+    idle->state = THREAD_RUNNING;
+    idle->stack = stack;
+    idle->cpu = cpu;
+    idle->on_cpu = 1;
+    idle->switched_in_ns = now_ns();
+
+    uint32_t flags = spin_lock_irqsave(&wait_lock);
+    idle->id = next_id++;
+    idle->all_next = all_threads;
+    all_threads = idle;
+    spin_unlock_irqrestore(&wait_lock, flags);
+
+    cpu->idle = idle;
+    cpu->current = idle;
+    cpu->online = 1;
+    idle_loop(0);
+}
+
+int threads_active() {
+    return cpu_get(0)->current != 0;
+}
+
+thread_t* thread_create(const char* name, void (*entry)(void* arg), void* arg, int priority) {
+    thread_t* t = thread_alloc(name, entry, arg, priority);
+    if (!t) return 0;
+    uint32_t flags = irq_save();
+    make_ready(t);
+    irq_restore(flags);
+    return t;
+}
+
+thread_t* thread_current() {
+    uint32_t flags = irq_save();
+    thread_t* t = this_cpu()->current;
+    irq_restore(flags);
+    return t;
+}
+
+int thread_snapshot(thread_info_t* out, int max) {
+    uint32_t flags = spin_lock_irqsave(&wait_lock);
+    int count = 0;
+    for (thread_t* t = all_threads; t && count < max; t = t->all_next, count++) {
+        out[count].id = t->id;
+        out[count].name = t->name;
+        out[count].priority = t->priority;
+        out[count].state = t->state;
+        out[count].cpu = t->cpu ? t->cpu->index : 0;
+        out[count].run_ns = t->run_ns;
+    }
+    spin_unlock_irqrestore(&wait_lock, flags);
+    return count;
+}
+
+void thread_yield() {
+    uint32_t flags = irq_save();
+    schedule();
+    irq_restore(flags);
+}
+
+void thread_exit() {
+    interrupts_disable();
+    this_cpu()->current->state = THREAD_DEAD;
+    schedule();
+    while (1) __asm__ volatile ("hlt");     // Not reached
+}
+
+void thread_sleep_until(uint64_t deadline) {
+    uint32_t flags = spin_lock_irqsave(&wait_lock);
+    if (deadline <= now_ns()) {
+        spin_unlock_irqrestore(&wait_lock, flags);
+        return;
+    }
+    thread_t* self = this_cpu()->current;
+    self->state = THREAD_BLOCKED;
+    sleep_insert(self, deadline);
+    spin_unlock(&wait_lock);
+    schedule();
+    irq_restore(flags);
+}
+
+void thread_cancel(thread_t* thread) {
+    thread->cancel = 1;
+}
+
+int thread_should_stop() {
+    thread_t* self = thread_current();
+    return self && self->cancel;
+}
+
+uint32_t wait_lock_irqsave() {
+    return spin_lock_irqsave(&wait_lock);
+}
+
+void wait_unlock_irqrestore(uint32_t flags) {
+    spin_unlock_irqrestore(&wait_lock, flags);
+}
+
+void wait_queue_init(wait_queue_t* wq) {
+    wq->head = wq->tail = 0;
+}
+
+int wait_queue_sleep_until(wait_queue_t* wq, uint64_t deadline) {
+    thread_t* self = this_cpu()->current;
+    self->state = THREAD_BLOCKED;
+    self->timed_out = 0;
+    self->waiting_on = wq;
+    self->next = 0;
+    if (wq->tail) wq->tail->next = self;
+    else wq->head = self;
+    wq->tail = self;
+    if (deadline) sleep_insert(self, deadline);
+
+    // A wakeup from here on finds the thread queued; schedule() copes with
+    // it being ready again before it has switched away
+    spin_unlock(&wait_lock);
+    schedule();
+    spin_lock(&wait_lock);
+    return !self->timed_out;
+}
+
+void wait_queue_sleep(wait_queue_t* wq) {
+    wait_queue_sleep_until(wq, 0);
+}
+
+void wait_queue_wake_one(wait_queue_t* wq) {
+    uint32_t flags = spin_lock_irqsave(&wait_lock);
+    thread_t* t = wq->head;
+    if (t) {
+        wait_remove(wq, t);
+        sleep_remove(t);
+        make_ready(t);
+    }
+    spin_unlock_irqrestore(&wait_lock, flags);
+}
+
+void wait_queue_wake_all(wait_queue_t* wq) {
+    uint32_t flags = spin_lock_irqsave(&wait_lock);
+    while (wq->head) {
+        thread_t* t = wq->head;
+        wait_remove(wq, t);
+        sleep_remove(t);
+        make_ready(t);
+    }
+    spin_unlock_irqrestore(&wait_lock, flags);
+}
+
+void thread_cpu_tick() {
+    cpu_t* cpu = this_cpu();
+    thread_t* current = cpu->current;
+    if (!current) return;
+
+    if (current == cpu->idle) {
+        if (work_available(cpu)) cpu->need_resched = 1;
+    } else if (now_ns() >= current->slice_end_ns && (cpu->ready_mask & (1u << current->priority))) {
+        cpu->need_resched = 1;
+    }
+}
+
+void thread_timer_tick() {
+    cpu_t* cpu = this_cpu();
+    if (!cpu->current) return;
+
+    uint64_t now = now_ns();
+    spin_lock(&wait_lock);
+    while (sleepers && sleepers->wake_ns <= now) {
+        thread_t* t = sleepers;
+        sleep_remove(t);
+        if (t->waiting_on) {
+            wait_remove(t->waiting_on, t);
+            t->timed_out = 1;
+        }
+        make_ready(t);
+    }
+    spin_unlock(&wait_lock);
+
+    thread_cpu_tick();
+    if (!cpu->need_resched) arm_timer(cpu);
+}
+
+void thread_reschedule_ipi() {
+    cpu_t* cpu = this_cpu();
+    if (cpu->current && !cpu->need_resched) arm_timer(cpu);
+}
+
+void thread_preempt_check() {
+    cpu_t* cpu = this_cpu();
+    if (cpu->current && cpu->need_resched) schedule();
+}
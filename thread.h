@@ -0,0 +1,104 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdint.h>
+
+#define THREAD_PRIORITIES 4
+#define THREAD_PRIO_IDLE 0
+#define THREAD_PRIO_LOW 1
+#define THREAD_PRIO_NORMAL 2
+#define THREAD_PRIO_HIGH 3
+
+#define THREAD_STACK_ORDER 3         // 32 KB stacks, the lowest page is an unmapped guard
+#define THREAD_SLICE_MS 10           // Round-robin quantum between equal priorities
+
+#define THREAD_READY 0
+#define THREAD_RUNNING 1
+#define THREAD_BLOCKED 2
+#define THREAD_DEAD 3
+
+struct wait_queue;
+struct cpu;
+
+typedef struct thread {
+    uint32_t esp;                    // Saved stack pointer while switched out
+    uint32_t id;
+    const char* name;
+    int priority;
+    int state;
+    uint8_t* stack;                  // 0 for the boot thread, which keeps the boot stack
+    void (*entry)(void* arg);
+    void* arg;
+    uint64_t wake_ns;                // Deadline while on the sleep list, else 0
+    uint64_t slice_end_ns;
+    uint64_t run_ns;                 // CPU time used so far
+    uint64_t switched_in_ns;
+    volatile int cancel;             // Set by thread_cancel, polled by the thread
+    int timed_out;
+    struct wait_queue* waiting_on;
+    struct cpu* cpu;                 // Where it last ran, or the queue it waits on
+    volatile int on_cpu;             // Its stack is still live on some CPU
+    struct thread* next;             // Run queue or wait queue link
+    struct thread* sleep_next;
+    struct thread* all_next;
+    struct var_store* vars;          // A script job's own variables, else 0
+} thread_t;
+
+typedef struct wait_queue {
+    thread_t* head;
+    thread_t* tail;
+} wait_queue_t;
+
+// Turns the caller into the first thread and starts the idle thread
+void thread_init();
+// Turns an application processor's boot context into that CPU's idle
+// thread and starts scheduling there; does not return
+void thread_start_cpu(struct cpu* cpu, uint8_t* stack);
+int threads_active();
+
+thread_t* thread_create(const char* name, void (*entry)(void* arg), void* arg, int priority);
+thread_t* thread_current();
+void thread_yield();
+void thread_exit();
+void thread_sleep_until(uint64_t deadline);
+void thread_cancel(thread_t* thread);
+int thread_should_stop();
+
+// Copy of a thread's bookkeeping, taken under the scheduler's lock
+typedef struct {
+    uint32_t id;
+    const char* name;
+    int priority;
+    int state;
+    int cpu;
+    uint64_t run_ns;
+} thread_info_t;
+
+int thread_snapshot(thread_info_t* out, int max);
+
+// Wait queues. Take the wait lock, check the condition you are waiting
+// for, then sleep; the lock is dropped while asleep and held again on
+// return. Wakeups take the lock themselves and are safe from interrupt handlers.
+uint32_t wait_lock_irqsave();
+void wait_unlock_irqrestore(uint32_t flags);
+void wait_queue_init(wait_queue_t* wq);
+void wait_queue_sleep(wait_queue_t* wq);
+int wait_queue_sleep_until(wait_queue_t* wq, uint64_t deadline);   // 0 on timeout
+void wait_queue_wake_one(wait_queue_t* wq);
+void wait_queue_wake_all(wait_queue_t* wq);
+
+// Called by the timer interrupt on the BSP and the local APIC timer elsewhere
+void thread_timer_tick();
+void thread_cpu_tick();
+// Another CPU queued work here, or added a sleeper the BSP's timer must wake first
+void thread_reschedule_ipi();
+
+// Switch now if a wakeup made a more important thread ready. Interrupts
+// must be off; this runs on the way out of every interrupt.
+void thread_preempt_check();
+
+// Earliest time the scheduler needs this CPU back, 0 for none. The BSP's
+// timer also wakes sleepers for everyone.
+uint64_t thread_next_deadline();
+
+#endif
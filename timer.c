@@ -0,0 +1,149 @@
+#include "timer.h"
+#include <stdint.h>
+#include "io.h"
+#include "interrupts.h"
+#include "thread.h"
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+#define CALIBRATION_MS 50
+
+static volatile uint32_t ticks = 0;   // Milliseconds since timer_init while periodic
+static uint32_t tsc_rate_khz = 0;     // 0 if the CPU has no usable TSC
+static uint64_t tsc_boot = 0;
+
+// Once the TSC keeps time, the PIT only fires for the next deadline
+static int tickless = 0;
+
+static void timer_irq(interrupt_frame_t* frame) {
+    (void)frame;
+    if (!tickless) ticks++;
+    thread_timer_tick();
+}
+
+// 64-by-32 bit division with two divl instructions, so no libgcc is needed
+uint64_t div64_32(uint64_t n, uint32_t d, uint32_t* remainder) {
+    uint32_t high = (uint32_t)(n >> 32);
+    uint32_t low = (uint32_t)n;
+    uint32_t q_high = high / d;
+    uint32_t r = high % d;
+    uint32_t q_low;
+    __asm__ ("divl %4" : "=a"(q_low), "=d"(r) : "0"(low), "1"(r), "rm"(d));
+    if (remainder) *remainder = r;
+    return ((uint64_t)q_high << 32) | q_low;
+}
+
+static int cpu_has_tsc() {
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx >> 4) & 1;
+}
+
+// Count TSC cycles across a whole number of PIT periods
+static void calibrate_tsc() {
+    if (!cpu_has_tsc()) return;
+
+    uint32_t start = ticks;
+    while (ticks == start) __asm__ volatile ("hlt");   // Align to a tick edge
+    uint64_t tsc_start = rdtsc();
+    start = ticks;
+    while (ticks - start < CALIBRATION_MS) __asm__ volatile ("hlt");
+    uint64_t cycles = rdtsc() - tsc_start;
+
+    tsc_rate_khz = (uint32_t)div64_32(cycles, CALIBRATION_MS, 0);
+    tsc_boot = tsc_start - (uint64_t)tsc_rate_khz * start;
+}
+
+// Interrupt once after `ns`; counts beyond 16 bits are clamped and the
+// sleeper simply re-arms when it wakes early
+static void pit_arm_oneshot(uint64_t ns) {
+    if (ns > 60 * NS_PER_MS) ns = 60 * NS_PER_MS;   // Longest period the PIT can count
+    uint64_t count = div64_32(ns * PIT_FREQUENCY, 1000000000u, 0);
+    if (count < 1) count = 1;
+    if (count > 0xFFFF) count = 0xFFFF;
+    outb(PIT_COMMAND, 0x30);             // Channel 0, lobyte/hibyte, interrupt on terminal count
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, (count >> 8) & 0xFF);
+}
+
+void timer_init() {
+    uint16_t divisor = PIT_FREQUENCY / TIMER_HZ;
+    outb(PIT_COMMAND, 0x34);             // Channel 0, lobyte/hibyte, rate generator
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+
+    irq_install_handler(IRQ_TIMER, timer_irq);
+    interrupts_enable();
+    calibrate_tsc();
+
+    // With a calibrated TSC there is no need for a periodic tick: stop the PIT
+    // until someone asks for a deadline. Without one, keep the 1 kHz tick.
+    if (tsc_rate_khz) {
+        tickless = 1;
+        outb(PIT_COMMAND, 0x30);
+    }
+}
+
+int timer_is_tickless() {
+    return tickless;
+}
+
+uint32_t timer_ms() {
+    if (!tickless) return ticks;
+    return (uint32_t)div64_32(now_ns(), NS_PER_MS, 0);
+}
+
+uint32_t tsc_khz() {
+    return tsc_rate_khz;
+}
+
+// Monotonic nanoseconds since the timer started: TSC-based when calibrated,
+// PIT tick resolution otherwise
+uint64_t now_ns() {
+    if (!tsc_rate_khz) {
+        return (uint64_t)ticks * NS_PER_MS;
+    }
+
+    uint32_t rem;
+    uint64_t ms = div64_32(rdtsc() - tsc_boot, tsc_rate_khz, &rem);
+    uint64_t sub_ms = div64_32((uint64_t)rem * NS_PER_MS, tsc_rate_khz, 0);
+    return ms * NS_PER_MS + sub_ms;
+}
+
+// Ask for a timer interrupt no later than `deadline` (0 = none needed). The
+// periodic tick already interrupts every millisecond, so only tickless mode arms.
+void timer_arm(uint64_t deadline) {
+    if (!tickless || !deadline) return;
+    uint64_t now = now_ns();
+    pit_arm_oneshot(deadline > now ? deadline - now : 0);
+}
+
+// Halt until the next interrupt; in tickless mode a one-shot is armed so
+// that interrupt comes no later than `deadline` (0 = no deadline). Returns
+// with interrupts enabled.
+void cpu_idle_until(uint64_t deadline) {
+    interrupts_disable();
+    if (tickless && deadline) {
+        uint64_t now = now_ns();
+        if (deadline <= now) {
+            interrupts_enable();
+            return;
+        }
+        pit_arm_oneshot(deadline - now);
+    }
+    // sti takes effect after the next instruction, so no wakeup can slip in before hlt
+    __asm__ volatile ("sti; hlt");
+}
+
+// Once threads run, sleeping gives the CPU to someone else instead of halting
+void sleep_until_ns(uint64_t deadline) {
+    while (now_ns() < deadline) {
+        if (threads_active()) thread_sleep_until(deadline);
+        else cpu_idle_until(deadline);
+    }
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_until_ns(now_ns() + (uint64_t)ms * NS_PER_MS);
+}
@@ -0,0 +1,20 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_HZ 1000              // PIT interrupt rate
+#define NS_PER_MS 1000000
+
+void timer_init();
+int timer_is_tickless();
+uint32_t timer_ms();
+uint64_t now_ns();
+uint32_t tsc_khz();
+void timer_arm(uint64_t deadline);
+void cpu_idle_until(uint64_t deadline);
+void sleep_ms(uint32_t ms);
+void sleep_until_ns(uint64_t deadline);
+uint64_t div64_32(uint64_t n, uint32_t d, uint32_t* remainder);
+
+#endif
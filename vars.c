@@ -0,0 +1,175 @@
+#include <stdint.h>
+#include "vars.h"
+#include "heap.h"
+#include "string.h"
+#include "kprintf.h"
+#include "thread.h"
+
+extern int strlen(const char* str);
+extern int atoi(const char* str);
+
+#define TABLE_MIN 64               // Slots; always a power of two, at most 3/4 full
+
+static slab_cache_t* var_cache = 0;
+static var_store_t shared;
+
+void var_init() {
+    var_cache = slab_cache_create("variables", sizeof(var_t));
+}
+
+static var_store_t* current_store() {
+    var_store_t* store = thread_current()->vars;
+    return store ? store : &shared;
+}
+
+// FNV-1a
+static uint32_t hash_name(const char* name, int len) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int same_name(var_t* var, uint32_t hash, const char* name, int len) {
+    return var->hash == hash && strncmp(var->name, name, len) == 0 && var->name[len] == '\0';
+}
+
+// Linear probing: the slot holding `name`, or the empty slot where it belongs
+static var_t** probe(var_t** slots, uint32_t size, uint32_t hash, const char* name, int len) {
+    uint32_t i = hash & (size - 1);
+    while (slots[i] && !same_name(slots[i], hash, name, len)) i = (i + 1) & (size - 1);
+    return &slots[i];
+}
+
+static int grow_table(var_store_t* store) {
+    uint32_t new_size = store->size ? store->size * 2 : TABLE_MIN;
+    var_t** slots = (var_t**)kmalloc(new_size * sizeof(var_t*));
+    if (!slots) return 0;
+    memset(slots, 0, new_size * sizeof(var_t*));
+    for (uint32_t i = 0; i < store->size; i++) {
+        var_t* var = store->table[i];
+        if (!var) continue;
+        uint32_t j = var->hash & (new_size - 1);
+        while (slots[j]) j = (j + 1) & (new_size - 1);
+        slots[j] = var;
+    }
+    kfree(store->table);
+    store->table = slots;
+    store->size = new_size;
+    return 1;
+}
+
+var_t* var_lookup(const char* name, int len) {
+    var_store_t* store = current_store();
+    if (!store->table) return 0;
+    var_t* var = *probe(store->table, store->size, hash_name(name, len), name, len);
+    return var && var->type != VAR_UNSET ? var : 0;
+}
+
+var_t* var_intern(const char* name, int len) {
+    var_store_t* store = current_store();
+    if (len >= VAR_NAME_MAX) len = VAR_NAME_MAX - 1;
+    uint32_t hash = hash_name(name, len);
+    if (store->table) {
+        var_t* var = *probe(store->table, store->size, hash, name, len);
+        if (var) return var;
+    }
+
+    if ((store->used + 1) * 4 > store->size * 3 && !grow_table(store)) return 0;
+    if (!var_cache) return 0;
+    var_t* var = (var_t*)slab_alloc(var_cache);
+    if (!var) return 0;
+    memset(var, 0, sizeof(var_t));
+    memcpy(var->name, name, len);
+    var->hash = hash;
+    *probe(store->table, store->size, hash, name, len) = var;
+    store->used++;
+    return var;
+}
+
+void var_free_text(var_t* var) {
+    kfree(var->text);
+    var->text = 0;
+}
+
+// An optionally signed run of digits, with nothing but blanks around it
+static int parse_integer(const char* text, int32_t* value) {
+    const char* p = text;
+    while (*p == ' ' || *p == '\t') p++;
+    const char* start = p;
+    if (*p == '-' || *p == '+') p++;
+    if (*p < '0' || *p > '9') return 0;
+    while (*p >= '0' && *p <= '9') p++;
+    const char* end = p;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p || end - start > 11) return 0;
+    *value = atoi(start);
+    return 1;
+}
+
+void var_set_text(var_t* var, const char* text) {
+    int32_t value;
+    if (parse_integer(text, &value)) {
+        var_set_int(var, value);
+        return;
+    }
+
+    int len = strlen(text);
+    if (len > VAR_TEXT_MAX - 1) len = VAR_TEXT_MAX - 1;
+    if (var->type == VAR_STRING) var_free_text(var);
+    var->text = (char*)kmalloc(len + 1);
+    if (!var->text) {
+        var->type = VAR_UNSET;
+        return;
+    }
+    memcpy(var->text, text, len);
+    var->text[len] = '\0';
+    var->type = VAR_STRING;
+    var->value = atoi(var->text);
+}
+
+const char* var_text(var_t* var, char* buf) {
+    if (var->type == VAR_STRING) return var->text;
+    if (var->type == VAR_UNSET) return "";
+    ksnprintf(buf, 12, "%d", var->value);
+    return buf;
+}
+
+static void clear_store(var_store_t* store) {
+    for (uint32_t i = 0; i < store->size; i++) {
+        var_t* var = store->table[i];
+        if (!var) continue;
+        if (var->type == VAR_STRING) var_free_text(var);
+        slab_free(var_cache, var);
+        store->table[i] = 0;
+    }
+    store->used = 0;
+}
+
+void var_clear_all() {
+    clear_store(current_store());
+}
+
+void var_reset_all() {
+    var_store_t* store = current_store();
+    for (uint32_t i = 0; i < store->size; i++) {
+        var_t* var = store->table[i];
+        if (!var) continue;
+        if (var->type == VAR_STRING) var_free_text(var);
+        var->type = VAR_UNSET;
+        var->value = 0;
+    }
+}
+
+void var_use_store(var_store_t* store) {
+    thread_current()->vars = store;
+}
+
+void var_store_free(var_store_t* store) {
+    clear_store(store);
+    kfree(store->table);
+    store->table = 0;
+    store->size = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stdint.h>
+
+#define VAR_NAME_MAX 32
+#define VAR_TEXT_MAX 128           // Longer string values are cut off
+
+enum { VAR_UNSET, VAR_INT, VAR_STRING };
+
+// Script variables, hashed by name. Each name is interned once and keeps
+// its entry until var_clear_all(), so compiled scripts hold the pointer.
+// Integers are kept as integers and only formatted when text is asked for.
+typedef struct var {
+    uint32_t hash;
+    uint8_t type;
+    int32_t value;                 // The integer, or what atoi() makes of the string
+    char* text;                    // VAR_STRING only
+    char name[VAR_NAME_MAX];
+} var_t;
+
+// Where the variables live. Background script jobs each have their own
+// store; every other thread shares one.
+typedef struct var_store {
+    var_t** table;
+    uint32_t size;                 // Slots, a power of two
+    uint32_t used;
+} var_store_t;
+
+void var_init();                                   // Once at boot, before other CPUs start
+
+// These work on the calling thread's store
+var_t* var_lookup(const char* name, int len);      // Set variables only
+var_t* var_intern(const char* name, int len);      // Created unset if new
+void var_set_text(var_t* var, const char* text);   // Integer literals are stored as integers
+const char* var_text(var_t* var, char* buf);       // buf holds 12 bytes, used for integers
+void var_clear_all();
+void var_reset_all();                              // Unsets everything but keeps the entries
+
+void var_free_text(var_t* var);
+
+// Give the calling thread its own store, or 0 for the shared one again
+void var_use_store(var_store_t* store);
+// Free everything in a store no thread is using
+void var_store_free(var_store_t* store);
+
+static inline void var_set_int(var_t* var, int32_t value) {
+    if (var->type == VAR_STRING) var_free_text(var);
+    var->type = VAR_INT;
+    var->value = value;
+}
+
+#endif